@@ -13,5 +13,6 @@ if not exist "build" mkdir "build"
 
 cl %WARN_FLAGS% %BASE_FLAGS% src\mod.c %LINK_FLAGS% /Fe:build\dat_mod.exe
 cl %WARN_FLAGS% %BASE_FLAGS% src\hmex.c %LINK_FLAGS% /Fe:build\hmex.exe
+cl %WARN_FLAGS% %BASE_FLAGS% src\gen.c %LINK_FLAGS% /Fe:build\dat_gen.exe
 
 endlocal
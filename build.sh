@@ -3,21 +3,43 @@
 set -e
 
 WARN_FLAGS="-Wall -Wextra -Wpedantic -Wuninitialized -Wcast-qual -Wdisabled-optimization -Winit-self -Wlogical-op -Wmissing-include-dirs -Wredundant-decls -Wshadow -Wundef -Wstrict-prototypes -Wpointer-to-int-cast -Wint-to-pointer-cast -Wconversion -Wduplicated-cond -Wduplicated-branches -Wformat=2 -Wshift-overflow=2 -Wint-in-bool-context -Wvector-operation-performance -Wvla -Wdisabled-optimization -Wredundant-decls -Wmissing-parameter-type -Wold-style-declaration -Wlogical-not-parentheses -Waddress -Wmemset-transposed-args -Wmemset-elt-size -Wsizeof-pointer-memaccess -Wwrite-strings -Wtrampolines -Werror=implicit-function-declaration"
-if [ "$1" = 'release' ]; then
+if [[ $1 = 'release' || $1 = 'bench' ]]; then
     BASE_FLAGS="-O2"
+elif [ "$1" = 'profile' ]; then
+    BASE_FLAGS="-O2 -g"
+elif [ "$1" = 'stats' ]; then
+    BASE_FLAGS="-O2 -DDAT_STATS -D_POSIX_C_SOURCE=200809L"
 else
     BASE_FLAGS="-ggdb"
 fi
 PATH_FLAGS="-I/usr/include -I/usr/lib -I/usr/local/lib -I/usr/local/include"
-LINK_FLAGS=""
+LINK_FLAGS="-pthread"
 
-if [[ -z $1 || $1 = 'release' || $1 = 'dat_mod' ]]; then
+if [[ -z $1 || $1 = 'release' || $1 = 'dat_mod' || $1 = 'stats' ]]; then
     /usr/bin/c99 ${WARN_FLAGS} ${PATH_FLAGS} ${BASE_FLAGS} src/mod.c ${LINK_FLAGS} -o build/dat_mod
 fi
 if [[ -z $1 || $1 = 'release' || $1 = 'hmex' ]]; then
     /usr/bin/c99 ${WARN_FLAGS} ${PATH_FLAGS} ${BASE_FLAGS} src/hmex.c ${LINK_FLAGS} -o build/hmex
 fi
+if [[ -z $1 || $1 = 'release' || $1 = 'dat_gen' ]]; then
+    /usr/bin/c99 ${WARN_FLAGS} ${PATH_FLAGS} ${BASE_FLAGS} src/gen.c ${LINK_FLAGS} -o build/dat_gen
+fi
+if [ "$1" = 'bench' ]; then
+    /usr/bin/c99 ${WARN_FLAGS} ${PATH_FLAGS} ${BASE_FLAGS} src/bench.c ${LINK_FLAGS} -o build/bench
+fi
+
+# Tracy instrumented builds. Point TRACY_DIR at a Tracy checkout, then run a tool with
+# TRACY_NO_EXIT=1 so it waits for the profiler to connect before exiting.
+if [ "$1" = 'profile' ]; then
+    TRACY_DIR=${TRACY_DIR:-../tracy}
+    TRACY_FLAGS="-DTRACY_ENABLE -isystem ${TRACY_DIR}/public/tracy"
+    c++ -O2 -DTRACY_ENABLE -c ${TRACY_DIR}/public/TracyClient.cpp -o build/TracyClient.o
+    for tool in mod:dat_mod hmex:hmex gen:dat_gen bench:bench; do
+        /usr/bin/c99 ${WARN_FLAGS} ${PATH_FLAGS} ${BASE_FLAGS} ${TRACY_FLAGS} src/${tool%%:*}.c build/TracyClient.o \
+            ${LINK_FLAGS} -lstdc++ -ldl -lm -o build/${tool##*:}
+    done
+fi
 
 if [ "$1" = 'release' ]; then
-    strip build/dat_mod build/hmex build/ml
+    strip build/dat_mod build/hmex build/dat_gen build/ml
 fi
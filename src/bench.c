@@ -0,0 +1,1035 @@
+// clock_gettime
+#define _POSIX_C_SOURCE 200809L
+// syscall
+#define _DEFAULT_SOURCE
+
+#include "dat.h"
+#include "dat.c"
+#include "utils.h"
+#include "gen.h"
+
+#include <time.h>
+
+#ifdef __linux__
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+#endif
+
+#define BENCH_RUNS 31
+
+static uint64_t now_ns(void) {
+    #ifdef WIN32
+        LARGE_INTEGER freq, count;
+        QueryPerformanceFrequency(&freq);
+        QueryPerformanceCounter(&count);
+        return (uint64_t)((double)count.QuadPart * 1e9 / (double)freq.QuadPart);
+    #else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    #endif
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest rank percentile. Sorts `times`.
+static uint64_t percentile_ns(uint64_t *times, uint32_t count, uint32_t percent) {
+    qsort(times, count, sizeof(*times), cmp_u64);
+    return times[(uint32_t)(((uint64_t)count - 1) * percent / 100)];
+}
+
+static uint64_t median_ns(uint64_t *times, uint32_t count) {
+    return percentile_ns(times, count, 50);
+}
+
+// HARDWARE COUNTERS -----------------------------------------------------
+
+enum {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_CACHE_MISSES,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_COUNT,
+};
+
+static const char *const counter_names[COUNTER_COUNT] = {
+    "cycles", "instructions", "cache_misses", "branch_misses",
+};
+
+// Counters are opened as one group and read together, so they cover the same instructions.
+// Without perf_event_open, or when the kernel refuses it, only times are reported.
+static int counter_group = -1;
+static uint64_t counter_sums[COUNTER_COUNT];
+
+static void counters_open(void) {
+    #ifdef __linux__
+        static const uint64_t configs[COUNTER_COUNT] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES,
+        };
+        int fds[COUNTER_COUNT];
+        for (uint32_t i = 0; i < COUNTER_COUNT; ++i) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = configs[i];
+            attr.disabled = i == 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            int leader = i == 0 ? -1 : fds[0];
+            fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+            if (fds[i] < 0) {
+                for (uint32_t k = 0; k < i; ++k) close(fds[k]);
+                return;
+            }
+        }
+        ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        counter_group = fds[0];
+    #endif
+}
+
+static bool counters_read(uint64_t out[COUNTER_COUNT]) {
+    #ifdef __linux__
+        uint64_t buf[1 + COUNTER_COUNT];
+        if (counter_group >= 0 && read(counter_group, buf, sizeof(buf)) == (ssize_t)sizeof(buf)) {
+            memcpy(out, &buf[1], sizeof(buf) - sizeof(buf[0]));
+            return true;
+        }
+    #endif
+    (void)out;
+    return false;
+}
+
+// Each timed run is bracketed by bench_begin and bench_end.
+// Counters are read outside the timed region and summed until the next report.
+static uint64_t bench_counters_start[COUNTER_COUNT];
+
+static uint64_t bench_begin(void) {
+    counters_read(bench_counters_start);
+    return now_ns();
+}
+
+static uint64_t bench_end(uint64_t start) {
+    uint64_t elapsed = now_ns() - start;
+    uint64_t end[COUNTER_COUNT];
+    if (counters_read(end)) {
+        for (uint32_t i = 0; i < COUNTER_COUNT; ++i)
+            counter_sums[i] += end[i] - bench_counters_start[i];
+    }
+    return elapsed;
+}
+
+// REPORTING -------------------------------------------------------------
+
+#define MAX_RESULTS 256
+
+typedef struct BenchResult {
+    char file[64];
+    char group[64];
+    char name[64];
+    uint32_t runs;
+    uint64_t min, p10, p50, p90, p99, max;
+    double counters[COUNTER_COUNT];     // per run
+} BenchResult;
+
+static BenchResult results[MAX_RESULTS];
+static uint32_t result_count;
+static const char *current_file = "";
+static char current_group[64];
+
+static void section(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(current_group, sizeof(current_group), format, args);
+    va_end(args);
+    printf("\n%s\n", current_group);
+}
+
+// Reports times and counters divided by `per`, for runs that repeat an operation `per` times.
+static void report_per(const char *name, uint64_t *times, uint32_t count, uint32_t per) {
+    for (uint32_t i = 0; i < count; ++i) times[i] /= per;
+
+    BenchResult *r = &results[result_count < MAX_RESULTS ? result_count++ : MAX_RESULTS - 1];
+    snprintf(r->file, sizeof(r->file), "%s", current_file);
+    snprintf(r->group, sizeof(r->group), "%s", current_group);
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->runs = count;
+    r->min = percentile_ns(times, count, 0);
+    r->p10 = percentile_ns(times, count, 10);
+    r->p50 = percentile_ns(times, count, 50);
+    r->p90 = percentile_ns(times, count, 90);
+    r->p99 = percentile_ns(times, count, 99);
+    r->max = percentile_ns(times, count, 100);
+    for (uint32_t i = 0; i < COUNTER_COUNT; ++i) {
+        r->counters[i] = (double)counter_sums[i] / count / per;
+        counter_sums[i] = 0;
+    }
+
+    // microseconds, or nanoseconds for per operation times
+    double scale = r->p90 < 10000 ? 1.0 : 1000.0;
+    const char *unit = r->p90 < 10000 ? "ns" : "us";
+    printf("%-40s %10.1f %s  (p10 %.1f, p90 %.1f)", name,
+        (double)r->p50 / scale, unit, (double)r->p10 / scale, (double)r->p90 / scale);
+    if (counter_group >= 0) {
+        double cycles = r->counters[COUNTER_CYCLES];
+        printf("  %.2f ipc, %.0f cache misses, %.0f branch misses",
+            cycles > 0 ? r->counters[COUNTER_INSTRUCTIONS] / cycles : 0.0,
+            r->counters[COUNTER_CACHE_MISSES], r->counters[COUNTER_BRANCH_MISSES]);
+    }
+    printf("\n");
+}
+
+static void report(const char *name, uint64_t *times, uint32_t count) {
+    report_per(name, times, count, 1);
+}
+
+static void json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\') fputc('\\', f);
+        if ((unsigned char)*s >= 0x20) fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static bool write_json(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) return false;
+
+    fprintf(f, "{\n  \"unit\": \"ns\",\n  \"counters\": %s,\n  \"results\": [\n",
+        counter_group >= 0 ? "true" : "false");
+    for (uint32_t i = 0; i < result_count; ++i) {
+        const BenchResult *r = &results[i];
+        fprintf(f, "    {\"file\": ");
+        json_string(f, r->file);
+        fprintf(f, ", \"group\": ");
+        json_string(f, r->group);
+        fprintf(f, ", \"name\": ");
+        json_string(f, r->name);
+        fprintf(f, ", \"runs\": %u, \"min\": %llu, \"p10\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu",
+            r->runs, (unsigned long long)r->min, (unsigned long long)r->p10, (unsigned long long)r->p50,
+            (unsigned long long)r->p90, (unsigned long long)r->p99, (unsigned long long)r->max);
+        if (counter_group >= 0) {
+            for (uint32_t k = 0; k < COUNTER_COUNT; ++k)
+                fprintf(f, ", \"%s\": %.1f", counter_names[k], r->counters[k]);
+        }
+        fprintf(f, "}%s\n", i + 1 < result_count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) == 0;
+}
+
+static uint32_t xorshift32(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+// GENERATED FILES -------------------------------------------------------
+
+// Much larger than GrPs.dat. Sharing is kept low so copying every root separately stays linear.
+static void generate_file(uint8_t **out, uint32_t *out_size) {
+    GenParams params = gen_default_params;
+    params.object_count = 1u << 17;
+    params.root_count = 1024;
+    params.min_size = 16;
+    params.sizes = Gen_SizesUniform;
+    params.fanout = 3.0f;
+    params.share = 0.05f;
+
+    DatFile dat;
+    GenStats stats;
+    dat_expect(gen_file(&params, &dat, &stats));
+    *out = malloc(dat_file_export_max_size(&dat));
+    dat_expect(dat_file_export(&dat, *out, out_size));
+    dat_expect(dat_file_destroy(&dat));
+}
+
+// SORTING ---------------------------------------------------------------
+
+// The comparator based path that radix_sort replaced.
+static int qsort_cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t qsort_dedup(uint32_t *arr, uint32_t count) {
+    qsort(arr, count, sizeof(uint32_t), qsort_cmp_u32);
+    return dedup_sorted_u32(arr, count);
+}
+
+static void bench_sort(const char *name, const uint32_t *input, uint32_t count, bool dedup) {
+    uint32_t *arr = malloc(count * sizeof(uint32_t));
+    uint8_t *tmp = malloc(count * sizeof(uint32_t));
+    uint64_t times[BENCH_RUNS];
+    char label[128];
+
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        memcpy(arr, input, count * sizeof(uint32_t));
+        uint64_t start = bench_begin();
+        if (dedup)
+            qsort_dedup(arr, count);
+        else
+            qsort(arr, count, sizeof(uint32_t), qsort_cmp_u32);
+        times[run] = bench_end(start);
+    }
+    snprintf(label, sizeof(label), "%s (qsort)", name);
+    report(label, times, BENCH_RUNS);
+
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        memcpy(arr, input, count * sizeof(uint32_t));
+        uint64_t start = bench_begin();
+        sort_by_key((uint8_t*)arr, tmp, count, sizeof(uint32_t), dedup);
+        times[run] = bench_end(start);
+    }
+    snprintf(label, sizeof(label), "%s (radix)", name);
+    report(label, times, BENCH_RUNS);
+
+    free(arr);
+    free(tmp);
+}
+
+static void bench_sorting(const uint8_t *file, uint32_t file_size) {
+    DatFile dat;
+    dat_expect(dat_file_import(file, file_size, &dat));
+
+    section("sorting (%u relocs)", dat.reloc_count);
+
+    // reloc table in file order
+    uint32_t reloc_count = dat.reloc_count;
+    uint32_t *relocs = malloc(reloc_count * sizeof(uint32_t));
+    const uint8_t *file_relocs = file + 0x20 + dat.data_size;
+    for (uint32_t i = 0; i < reloc_count; ++i)
+        relocs[i] = READ_U32(file_relocs + i*4);
+    bench_sort("reloc table, file order", relocs, reloc_count, false);
+
+    // shuffled reloc table
+    uint32_t seed = 0x1234567;
+    for (uint32_t i = reloc_count; i > 1; --i) {
+        uint32_t j = xorshift32(&seed) % i;
+        uint32_t t = relocs[i-1];
+        relocs[i-1] = relocs[j];
+        relocs[j] = t;
+    }
+    bench_sort("reloc table, shuffled", relocs, reloc_count, false);
+
+    // object gathering order
+    uint32_t object_count = dat.reloc_count + dat.root_count + dat.extern_count;
+    uint32_t *objects = malloc(object_count * sizeof(uint32_t));
+    uint32_t object_i = 0;
+    for (uint32_t i = 0; i < dat.reloc_count; ++i)
+        objects[object_i++] = READ_U32(&dat.data[dat.reloc_targets[i]]);
+    for (uint32_t i = 0; i < dat.root_count; ++i)
+        objects[object_i++] = dat.root_info[i].data_offset;
+    for (uint32_t i = 0; i < dat.extern_count; ++i)
+        objects[object_i++] = dat.extern_info[i].data_offset;
+    bench_sort("objects + dedup", objects, object_count, true);
+
+    // large synthetic table
+    uint32_t big_count = 1u << 20;
+    uint32_t *big = malloc(big_count * sizeof(uint32_t));
+    for (uint32_t i = 0; i < big_count; ++i)
+        big[i] = (xorshift32(&seed) % (64u << 20)) & ~3u;
+    bench_sort("1M random offsets", big, big_count, false);
+    bench_sort("1M random offsets + dedup", big, big_count, true);
+
+    free(big);
+    free(objects);
+    free(relocs);
+    dat_expect(dat_file_destroy(&dat));
+}
+
+// IMPORT ---------------------------------------------------------------
+
+static void bench_import(const uint8_t *file, uint32_t file_size) {
+    uint64_t times[BENCH_RUNS];
+
+    section("import");
+
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        DatFile dat;
+        uint64_t start = bench_begin();
+        dat_expect(dat_file_import(file, file_size, &dat));
+        times[run] = bench_end(start);
+        dat_expect(dat_file_destroy(&dat));
+    }
+    report("dat_file_import", times, BENCH_RUNS);
+
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        DatFile dat;
+        uint64_t start = bench_begin();
+        dat_expect(dat_file_import_flags(file, file_size, DAT_IMPORT_EAGER_OBJECTS, &dat));
+        times[run] = bench_end(start);
+        dat_expect(dat_file_destroy(&dat));
+    }
+    report("dat_file_import (eager objects)", times, BENCH_RUNS);
+
+    size_t arena_size = (size_t)file_size * 2;
+    void *arena_buf = malloc(arena_size);
+    DatArena arena;
+    dat_arena_init(&arena, arena_buf, arena_size);
+    DatAllocator allocator = dat_arena_allocator(&arena);
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        DatFile dat;
+        uint64_t start = bench_begin();
+        dat_expect(dat_file_import_with_allocator(file, file_size, 0, &allocator, &dat));
+        dat_expect(dat_file_destroy(&dat));
+        dat_arena_reset(&arena);
+        times[run] = bench_end(start);
+    }
+    report("import + destroy (arena)", times, BENCH_RUNS);
+    free(arena_buf);
+}
+
+// Importing a corpus of files takes long enough that fewer runs are needed.
+#define IMPORT_MANY_RUNS 7
+#define IMPORT_MANY_FILES 1000
+
+static void import_many_serial(const DatImportSource *sources, uint32_t count, DatFile *out) {
+    for (uint32_t i = 0; i < count; ++i)
+        dat_expect(dat_file_import(sources[i].buffer, sources[i].buffer_size, &out[i]));
+}
+
+static void bench_import_many(const uint8_t *file, uint32_t file_size) {
+    DatFile src;
+    dat_expect(dat_file_import(file, file_size, &src));
+
+    // A corpus of small and large files, one per root of the source file.
+    uint32_t count = IMPORT_MANY_FILES;
+    DatImportSource *sources = calloc(count, sizeof(DatImportSource));
+    uint64_t corpus_size = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        DatFile dst;
+        dat_expect(dat_file_new(&dst));
+        DatRef copied;
+        const DatRootInfo *root = &src.root_info[i % src.root_count];
+        dat_expect(dat_obj_copy(&dst, &src, root->data_offset, &copied));
+        dat_expect(dat_root_add(&dst, 0, copied, &src.symbols[root->symbol_offset]));
+
+        uint8_t *buf = malloc(dat_file_export_max_size(&dst));
+        uint32_t size;
+        dat_expect(dat_file_export(&dst, buf, &size));
+        sources[i] = (DatImportSource) { NULL, buf, size };
+        corpus_size += size;
+        dat_expect(dat_file_destroy(&dst));
+    }
+
+    DatFile *out = malloc(count * sizeof(DatFile));
+    DAT_RET *errors = malloc(count * sizeof(DAT_RET));
+    uint64_t times[IMPORT_MANY_RUNS];
+    char label[128];
+
+    section("importing %u files (%lu bytes)", count, (unsigned long)corpus_size);
+
+    for (uint32_t run = 0; run < IMPORT_MANY_RUNS; ++run) {
+        uint64_t start = bench_begin();
+        import_many_serial(sources, count, out);
+        times[run] = bench_end(start);
+        for (uint32_t i = 0; i < count; ++i)
+            dat_expect(dat_file_destroy(&out[i]));
+    }
+    uint64_t serial = median_ns(times, IMPORT_MANY_RUNS);
+    report("dat_file_import loop", times, IMPORT_MANY_RUNS);
+
+    // powers of two, then every core
+    uint32_t cores = cpu_count();
+    uint32_t threads = 1;
+    while (1) {
+        for (uint32_t run = 0; run < IMPORT_MANY_RUNS; ++run) {
+            uint64_t start = bench_begin();
+            dat_expect(dat_file_import_many(sources, count, 0, threads, out, errors));
+            times[run] = bench_end(start);
+            for (uint32_t i = 0; i < count; ++i)
+                dat_expect(dat_file_destroy(&out[i]));
+        }
+        uint64_t t = median_ns(times, IMPORT_MANY_RUNS);
+        snprintf(label, sizeof(label), "import_many, %u threads (%.2fx)", threads, (double)serial / (double)t);
+        report(label, times, IMPORT_MANY_RUNS);
+
+        if (threads == cores) break;
+        threads = threads*2 < cores ? threads*2 : cores;
+    }
+
+    for (uint32_t i = 0; i < count; ++i)
+        free((void*)(uintptr_t)sources[i].buffer);
+    free(sources);
+    free(out);
+    free(errors);
+    dat_expect(dat_file_destroy(&src));
+}
+
+// COPYING ---------------------------------------------------------------
+
+static void bench_copy(const uint8_t *file, uint32_t file_size) {
+    DatFile src;
+    dat_expect(dat_file_import_flags(file, file_size, DAT_IMPORT_EAGER_OBJECTS, &src));
+    uint64_t times[BENCH_RUNS];
+
+    section("copying every root");
+
+    uint32_t copied_size = 0;
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        DatFile dst;
+        dat_expect(dat_file_new(&dst));
+        uint64_t start = bench_begin();
+        for (uint32_t i = 0; i < src.root_count; ++i) {
+            DatRef copied;
+            dat_expect(dat_obj_copy(&dst, &src, src.root_info[i].data_offset, &copied));
+        }
+        times[run] = bench_end(start);
+        copied_size = dst.data_size;
+        dat_expect(dat_file_destroy(&dst));
+    }
+    printf("%u bytes copied\n", copied_size);
+    report("dat_obj_copy", times, BENCH_RUNS);
+
+    // lower bound: copying the same number of bytes into fresh memory, as dat_obj_copy must
+    volatile uint8_t sink = 0;
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        uint64_t start = bench_begin();
+        uint8_t *buf = malloc(copied_size);
+        for (uint32_t i = 0; i < copied_size; i += src.data_size) {
+            uint32_t n = copied_size - i < src.data_size ? copied_size - i : src.data_size;
+            memcpy(buf + i, src.data, n);
+        }
+        sink = buf[copied_size / 2];
+        times[run] = bench_end(start);
+        free(buf);
+    }
+    (void)sink;
+    report("malloc + memcpy (same bytes)", times, BENCH_RUNS);
+
+    // Shared objects are copied once, so fewer bytes are copied than above.
+    DatRef *src_refs = malloc(src.root_count * sizeof(DatRef));
+    DatRef *dst_refs = malloc(src.root_count * sizeof(DatRef));
+    for (uint32_t i = 0; i < src.root_count; ++i)
+        src_refs[i] = src.root_info[i].data_offset;
+
+    uint32_t cores = cpu_count();
+    uint32_t threads = 1;
+    while (1) {
+        for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+            DatFile dst;
+            dat_expect(dat_file_new(&dst));
+            uint64_t start = bench_begin();
+            dat_expect(dat_obj_copy_many(&dst, &src, src_refs, src.root_count, threads, dst_refs));
+            times[run] = bench_end(start);
+            copied_size = dst.data_size;
+            dat_expect(dat_file_destroy(&dst));
+        }
+        if (threads == 1)
+            printf("%u bytes copied\n", copied_size);
+        char label[128];
+        snprintf(label, sizeof(label), "dat_obj_copy_many, %u threads", threads);
+        report(label, times, BENCH_RUNS);
+
+        if (threads == cores) break;
+        threads = threads*2 < cores ? threads*2 : cores;
+    }
+    free(src_refs);
+    free(dst_refs);
+
+    dat_expect(dat_file_destroy(&src));
+}
+
+// EXPORT ----------------------------------------------------------------
+
+static void bench_export(const uint8_t *file, uint32_t file_size) {
+    uint64_t times[BENCH_RUNS];
+    section("export");
+
+    DatFile dat;
+    dat_expect(dat_file_import(file, file_size, &dat));
+    uint8_t *buf = malloc(dat_file_export_max_size(&dat));
+
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        uint32_t size;
+        uint64_t start = bench_begin();
+        dat_expect(dat_file_export(&dat, buf, &size));
+        times[run] = bench_end(start);
+    }
+    report("dat_file_export", times, BENCH_RUNS);
+
+    dat_expect(dat_file_begin_edit(&dat));
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        uint32_t size;
+        uint64_t start = bench_begin();
+        dat_expect(dat_file_export(&dat, buf, &size));
+        times[run] = bench_end(start);
+    }
+    report("dat_file_export (edit mode)", times, BENCH_RUNS);
+
+    free(buf);
+    dat_expect(dat_file_destroy(&dat));
+}
+
+// LOOKUPS ---------------------------------------------------------------
+
+static void bench_lookups(const uint8_t *file, uint32_t file_size) {
+    uint64_t times[BENCH_RUNS];
+    section("lookups");
+
+    DatFile dat;
+    dat_expect(dat_file_import(file, file_size, &dat));
+    volatile uint32_t sink = 0;
+
+    // The first lookup builds the root index.
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        DatFile fresh;
+        DatRef found;
+        dat_expect(dat_file_import(file, file_size, &fresh));
+        uint64_t start = bench_begin();
+        dat_expect(dat_root_find(&fresh, &fresh.symbols[fresh.root_info[0].symbol_offset], &found));
+        times[run] = bench_end(start);
+        sink += found;
+        dat_expect(dat_file_destroy(&fresh));
+    }
+    report("first dat_root_find", times, BENCH_RUNS);
+
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        uint32_t sum = 0;
+        uint64_t start = bench_begin();
+        for (uint32_t i = 0; i < dat.root_count; ++i) {
+            DatRef found;
+            dat_expect(dat_root_find(&dat, &dat.symbols[dat.root_info[i].symbol_offset], &found));
+            sum += found;
+        }
+        times[run] = bench_end(start);
+        sink += sum;
+    }
+    report_per("dat_root_find (per root)", times, BENCH_RUNS, dat.root_count);
+
+    // The first lookup has to find the objects.
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        DatFile fresh;
+        DatSlice found;
+        dat_expect(dat_file_import(file, file_size, &fresh));
+        uint64_t start = bench_begin();
+        dat_expect(dat_file_find_objects(&fresh));
+        dat_expect(dat_obj_location(&fresh, fresh.root_info[0].data_offset, &found));
+        times[run] = bench_end(start);
+        sink += found.size;
+        dat_expect(dat_file_destroy(&fresh));
+    }
+    report("find_objects + first dat_obj_location", times, BENCH_RUNS);
+
+    // Every reference target, in file order.
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        uint32_t sum = 0;
+        uint64_t start = bench_begin();
+        for (uint32_t i = 0; i < dat.reloc_count; ++i) {
+            DatSlice found;
+            if (dat_obj_location(&dat, READ_U32(&dat.data[dat.reloc_targets[i]]), &found) == DAT_SUCCESS)
+                sum += found.size;
+        }
+        times[run] = bench_end(start);
+        sink += sum;
+    }
+    report_per("dat_obj_location (per reference)", times, BENCH_RUNS, dat.reloc_count);
+    (void)sink;
+
+    dat_expect(dat_file_destroy(&dat));
+}
+
+// PATCHING --------------------------------------------------------------
+
+static void bench_patching(const uint8_t *file, uint32_t file_size) {
+    const char *path = "build/bench_patch.dat";
+    FILE *f = fopen(path, "wb");
+    expect(f != NULL);
+    expect(fwrite(file, file_size, 1, f) == 1);
+    fclose(f);
+
+    uint64_t times[BENCH_RUNS];
+    section("patching one u32");
+
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        DatFile dat;
+        uint64_t start = bench_begin();
+        dat_expect(dat_file_import_mapped(path, 0, &dat));
+        dat_expect(dat_obj_write_u32(&dat, 0x40, run));
+        dat_expect(dat_file_export_path(&dat, path));
+        dat_expect(dat_file_destroy(&dat));
+        times[run] = bench_end(start);
+    }
+    report("import + export_path", times, BENCH_RUNS);
+
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        DatFile dat;
+        uint64_t start = bench_begin();
+        dat_expect(dat_file_open_patch(path, 0, &dat));
+        dat_expect(dat_obj_write_u32(&dat, 0x40, run));
+        dat_expect(dat_file_sync(&dat, NULL));
+        dat_expect(dat_file_destroy(&dat));
+        times[run] = bench_end(start);
+    }
+    report("open_patch + sync", times, BENCH_RUNS);
+
+    remove(path);
+}
+
+static void bench_validate(const uint8_t *file, uint32_t file_size) {
+    uint64_t times[BENCH_RUNS];
+    section("validation");
+
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        DatFile dat;
+        uint64_t start = bench_begin();
+        dat_expect(dat_file_import_flags(file, file_size, DAT_IMPORT_VALIDATE, &dat));
+        times[run] = bench_end(start);
+        dat_expect(dat_file_destroy(&dat));
+    }
+    report("dat_file_import (validate)", times, BENCH_RUNS);
+
+    DatFile dat;
+    dat_expect(dat_file_import(file, file_size, &dat));
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        uint64_t start = bench_begin();
+        dat_expect(dat_file_validate(&dat));
+        times[run] = bench_end(start);
+    }
+    report("dat_file_validate", times, BENCH_RUNS);
+
+    // Follows every reference and reads the first word it points to.
+    volatile uint32_t sink = 0;
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        uint32_t sum = 0;
+        uint64_t start = bench_begin();
+        for (uint32_t i = 0; i < dat.reloc_count; ++i) {
+            DatRef target;
+            uint32_t n = 0;
+            dat_expect(dat_obj_read_ref(&dat, dat.reloc_targets[i], &target));
+            if ((target & 3) == 0 && target + 4 <= dat.data_size)
+                dat_expect(dat_obj_read_u32(&dat, target, &n));
+            sum += n;
+        }
+        times[run] = bench_end(start);
+        sink += sum;
+    }
+    report("read every reference (checked)", times, BENCH_RUNS);
+
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        uint32_t sum = 0;
+        uint64_t start = bench_begin();
+        for (uint32_t i = 0; i < dat.reloc_count; ++i) {
+            DatRef target = dat_obj_read_ref_unchecked(&dat, dat.reloc_targets[i]);
+            if ((target & 3) == 0 && target + 4 <= dat.data_size)
+                sum += dat_obj_read_u32_unchecked(&dat, target);
+        }
+        times[run] = bench_end(start);
+        sink += sum;
+    }
+    report("read every reference (unchecked)", times, BENCH_RUNS);
+    (void)sink;
+
+    dat_expect(dat_file_destroy(&dat));
+}
+
+// Finds the references into every object, by scanning and through dat_obj_incoming.
+static void bench_incoming(const uint8_t *file, uint32_t file_size) {
+    uint64_t times[BENCH_RUNS];
+    section("incoming references of every object");
+
+    DatFile dat;
+    dat_expect(dat_file_import_flags(file, file_size, DAT_IMPORT_EAGER_OBJECTS, &dat));
+
+    volatile uint32_t sink = 0;
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        uint32_t found = 0;
+        uint64_t start = bench_begin();
+        for (uint32_t i = 0; i < dat.object_count; ++i) {
+            DatSlice object = dat.objects[i];
+            for (uint32_t reloc_i = 0; reloc_i < dat.reloc_count; ++reloc_i) {
+                DatRef target = READ_U32(&dat.data[dat.reloc_targets[reloc_i]]);
+                found += target - object.offset < object.size;
+            }
+        }
+        times[run] = bench_end(start);
+        sink += found;
+    }
+    report("scan reloc table per object", times, BENCH_RUNS);
+
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        uint32_t found = 0;
+        uint64_t start = bench_begin();
+        for (uint32_t i = 0; i < dat.object_count; ++i) {
+            const DatRef *incoming;
+            uint32_t count;
+            dat_expect(dat_obj_incoming(&dat, dat.objects[i].offset, &incoming, &count));
+            found += count;
+        }
+        times[run] = bench_end(start);
+        incoming_index_drop(&dat);
+        sink += found;
+    }
+    report("dat_obj_incoming (incl. index build)", times, BENCH_RUNS);
+    (void)sink;
+
+    dat_expect(dat_file_destroy(&dat));
+}
+
+static void bench_reloc_bitmap(const uint8_t *file, uint32_t file_size) {
+    uint64_t times[BENCH_RUNS];
+    section("is every word a reference slot");
+
+    DatFile dat;
+    dat_expect(dat_file_import(file, file_size, &dat));
+
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        uint64_t start = bench_begin();
+        dat_expect(dat_file_build_reloc_bitmap(&dat));
+        times[run] = bench_end(start);
+        reloc_bitmap_drop(&dat);
+    }
+    report("dat_file_build_reloc_bitmap", times, BENCH_RUNS);
+    dat_expect(dat_file_build_reloc_bitmap(&dat));
+
+    volatile uint32_t sink = 0;
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        uint32_t found = 0;
+        uint64_t start = bench_begin();
+        for (DatRef i = 0; i < dat.data_size; i += 4) {
+            uint32_t reloc_i = dat_file_reloc_idx(&dat, i);
+            found += reloc_i < dat.reloc_count && dat.reloc_targets[reloc_i] == i;
+        }
+        times[run] = bench_end(start);
+        sink += found;
+    }
+    report("dat_file_reloc_idx", times, BENCH_RUNS);
+
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        uint32_t found = 0;
+        uint64_t start = bench_begin();
+        for (DatRef i = 0; i < dat.data_size; i += 4)
+            found += dat_reloc_is_slot(&dat, i);
+        times[run] = bench_end(start);
+        sink += found;
+    }
+    report("dat_reloc_is_slot", times, BENCH_RUNS);
+
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        uint32_t sum = 0;
+        uint64_t start = bench_begin();
+        for (DatRef i = 0; i < dat.data_size; i += 4)
+            sum += dat_reloc_rank(&dat, i);
+        times[run] = bench_end(start);
+        sink += sum;
+    }
+    report("dat_reloc_rank", times, BENCH_RUNS);
+    (void)sink;
+
+    dat_expect(dat_file_destroy(&dat));
+}
+
+static void bench_graph(const uint8_t *file, uint32_t file_size) {
+    uint64_t times[BENCH_RUNS];
+    section("walking every root");
+
+    DatFile dat;
+    dat_expect(dat_file_import(file, file_size, &dat));
+    uint32_t visited_size, stack_count;
+    dat_expect(dat_graph_buffer_sizes(&dat, &visited_size, &stack_count));
+    uint8_t *visited = malloc(visited_size);
+    uint32_t *stack = malloc(stack_count * sizeof(uint32_t));
+
+    const char *names[2] = { "depth first + edges", "breadth first + edges" };
+    uint32_t flags[2] = { 0, DAT_GRAPH_BFS };
+    volatile uint32_t sink = 0;
+    for (uint32_t k = 0; k < 2; ++k) {
+        for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+            uint32_t sum = 0;
+            uint64_t start = bench_begin();
+            DatGraphIter it;
+            DatSlice object;
+            DatRef from, to;
+            dat_expect(dat_graph_begin(&it, &dat, NULL, 0, flags[k], visited, stack));
+            while (dat_graph_next(&it, &object)) {
+                sum += object.size;
+                while (dat_graph_next_edge(&it, &from, &to)) sum += to;
+            }
+            times[run] = bench_end(start);
+            sink += sum;
+        }
+        report(names[k], times, BENCH_RUNS);
+    }
+    (void)sink;
+
+    free(visited);
+    free(stack);
+    dat_expect(dat_file_destroy(&dat));
+}
+
+// EDITING ---------------------------------------------------------------
+
+// Builds a file with `count` references spread through one large object.
+static void build_reloc_file(DatFile *dat, uint32_t count, DatRef *obj) {
+    dat_expect(dat_file_new(dat));
+    dat_expect(dat_obj_alloc(dat, count * 8, obj));
+    dat_expect(dat_file_begin_build(dat));
+    for (uint32_t i = 0; i < count; ++i)
+        dat_expect(dat_obj_set_ref(dat, *obj + i*8, *obj));
+    dat_expect(dat_file_finalize(dat));
+}
+
+// Inserts a new reference then removes it again, at random offsets.
+static uint64_t time_edits(DatFile *dat, DatRef obj, uint32_t count, uint32_t edits) {
+    uint32_t seed = 0x7654321;
+    uint64_t start = bench_begin();
+    for (uint32_t i = 0; i < edits; ++i) {
+        DatRef at = obj + (xorshift32(&seed) % count) * 8 + 4;
+        dat_expect(dat_obj_set_ref(dat, at, obj));
+        dat_expect(dat_obj_remove_ref(dat, at));
+    }
+    return bench_end(start);
+}
+
+static void bench_editing(void) {
+    uint32_t count = 1u << 20;
+    uint32_t edits = 2000;
+    uint64_t times[BENCH_RUNS];
+    DatRef obj;
+    DatFile dat;
+
+    section("editing (%u relocs, %u insert + remove pairs)", count, edits);
+    build_reloc_file(&dat, count, &obj);
+
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run)
+        times[run] = time_edits(&dat, obj, count, edits);
+    report_per("flat reloc_targets (per edit)", times, BENCH_RUNS, edits);
+
+    dat_expect(dat_file_begin_edit(&dat));
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run)
+        times[run] = time_edits(&dat, obj, count, edits);
+    report_per("dat_file_begin_edit (per edit)", times, BENCH_RUNS, edits);
+
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run) {
+        uint64_t start = bench_begin();
+        dat_expect(dat_file_finalize(&dat));
+        dat_expect(dat_file_begin_edit(&dat));
+        times[run] = bench_end(start);
+    }
+    report("finalize + begin_edit", times, BENCH_RUNS);
+
+    dat_expect(dat_file_destroy(&dat));
+}
+
+// Times `count` dat_obj_set_ref calls into a fresh object, in random order, then finalizing.
+static uint64_t time_insert_storm(uint32_t count, uint32_t mode) {
+    DatFile dat;
+    DatRef obj;
+    dat_expect(dat_file_new(&dat));
+    dat_expect(dat_obj_alloc(&dat, count * 4, &obj));
+    if (mode == 1) dat_expect(dat_file_begin_edit(&dat));
+    if (mode == 2) dat_expect(dat_file_begin_build(&dat));
+
+    uint32_t *order = malloc(count * sizeof(uint32_t));
+    for (uint32_t i = 0; i < count; ++i) order[i] = i;
+    uint32_t seed = 0x1357913;
+    for (uint32_t i = count; i > 1; --i) {
+        uint32_t j = xorshift32(&seed) % i;
+        uint32_t t = order[i-1];
+        order[i-1] = order[j];
+        order[j] = t;
+    }
+
+    uint64_t start = bench_begin();
+    for (uint32_t i = 0; i < count; ++i)
+        dat_expect(dat_obj_set_ref(&dat, obj + order[i]*4, obj));
+    if (mode != 0) dat_expect(dat_file_finalize(&dat));
+    uint64_t t = bench_end(start);
+
+    free(order);
+    dat_expect(dat_file_destroy(&dat));
+    return t;
+}
+
+static void bench_insert_storm(void) {
+    uint32_t count = 1u << 14;
+    uint64_t times[BENCH_RUNS];
+    const char *names[3] = { "flat (per insert)", "dat_file_begin_edit (per insert)", "dat_file_begin_build (per insert)" };
+
+    section("insert storm (%u new references, random order)", count);
+    for (uint32_t mode = 0; mode < 3; ++mode) {
+        for (uint32_t run = 0; run < BENCH_RUNS; ++run)
+            times[run] = time_insert_storm(count, mode);
+        report_per(names[mode], times, BENCH_RUNS, count);
+    }
+}
+
+static void usage(void) {
+    fprintf(stderr, "USAGE: bench [--json <output.json>] [file.dat]\n");
+    exit(1);
+}
+
+int main(int argc, const char *argv[]) {
+    const char *path = "GrPs.dat";
+    const char *json_path = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0) {
+            if (++i == argc) usage();
+            json_path = argv[i];
+        } else if (argv[i][0] == '-') {
+            usage();
+        } else {
+            path = argv[i];
+        }
+    }
+
+    uint8_t *file;
+    uint64_t file_size;
+    if (read_file(path, &file, &file_size))
+        return 1;
+
+    counters_open();
+    if (counter_group < 0)
+        printf("hardware counters unavailable, reporting times only\n");
+
+    current_file = path;
+    printf("%s (%lu bytes)\n", path, (unsigned long)file_size);
+    bench_sorting(file, (uint32_t)file_size);
+    bench_import(file, (uint32_t)file_size);
+    bench_import_many(file, (uint32_t)file_size);
+    bench_export(file, (uint32_t)file_size);
+    bench_copy(file, (uint32_t)file_size);
+    bench_lookups(file, (uint32_t)file_size);
+    bench_patching(file, (uint32_t)file_size);
+    bench_validate(file, (uint32_t)file_size);
+    bench_incoming(file, (uint32_t)file_size);
+    bench_reloc_bitmap(file, (uint32_t)file_size);
+    bench_graph(file, (uint32_t)file_size);
+
+    uint8_t *gen;
+    uint32_t gen_size;
+    generate_file(&gen, &gen_size);
+    current_file = "generated";
+    printf("\n%s (%u bytes)\n", current_file, gen_size);
+    bench_import(gen, gen_size);
+    bench_export(gen, gen_size);
+    bench_copy(gen, gen_size);
+    bench_lookups(gen, gen_size);
+    bench_graph(gen, gen_size);
+    bench_insert_storm();
+    bench_editing();
+
+    if (json_path != NULL && !write_json(json_path)) {
+        fprintf(stderr, ERROR_STR "could not write %s\n", json_path);
+        return 1;
+    }
+
+    free(gen);
+    free(file);
+    return 0;
+}
@@ -4,30 +4,497 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+    #include <io.h>
+    #include <fcntl.h>
+    #include <sys/stat.h>
+#else
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <pthread.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <sys/uio.h>
+#endif
+
 static uint32_t binary_search_refs(const DatRef *refs, uint32_t count, DatRef ref);
 
-static inline int cmp32(uint32_t a, uint32_t b) { return (a > b) - (a < b); }
+// BYTE SWAPPING ----------------------------------------------------
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ \
+    && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64))
+    #define DAT_BSWAP_X86
+    #include <immintrin.h>
+    #if defined(_MSC_VER) && !defined(__clang__)
+        #include <intrin.h>
+        #define DAT_TARGET(isa)
+    #else
+        #define DAT_TARGET(isa) __attribute__((target(isa)))
+    #endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+    #define DAT_PREFETCH(ptr) __builtin_prefetch(ptr)
+#elif defined(DAT_BSWAP_X86)
+    #define DAT_PREFETCH(ptr) _mm_prefetch((const char*)(ptr), _MM_HINT_T0)
+#else
+    #define DAT_PREFETCH(ptr) ((void)(ptr))
+#endif
+
+// Tracy zones, recorded when built with TRACY_ENABLE (`build.sh profile`).
+// A zone must be ended on every path out of the scope that began it.
+#ifdef TRACY_ENABLE
+    #include "TracyC.h"
+    #define DAT_ZONE(ctx, name) TracyCZoneN(ctx, name, 1)
+    #define DAT_ZONE_END(ctx) TracyCZoneEnd(ctx)
+#else
+    #define DAT_ZONE(ctx, name)
+    #define DAT_ZONE_END(ctx)
+#endif
+
+// Operation counters, recorded when built with DAT_STATS. See DatStats in dat.h.
+#ifdef DAT_STATS
+    #ifndef _WIN32
+        #include <time.h>
+        #if !defined(_POSIX_C_SOURCE) || _POSIX_C_SOURCE < 199309L
+            #error "DAT_STATS needs _POSIX_C_SOURCE >= 199309L for clock_gettime"
+        #endif
+    #endif
+
+    static uint64_t stats_now(void) {
+        #ifdef _WIN32
+            LARGE_INTEGER count, freq;
+            QueryPerformanceCounter(&count);
+            QueryPerformanceFrequency(&freq);
+            return (uint64_t)((double)count.QuadPart * 1e9 / (double)freq.QuadPart);
+        #else
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+        #endif
+    }
+
+    // Const functions record too. A DatFile is never defined const, so this is fine.
+    static inline DatStats *stats_of(const DatFile *dat) {
+        return (DatStats*)(uintptr_t)&dat->stats;
+    }
+
+    static uint32_t stats_floor_log2(uint64_t n) {
+        uint32_t bit = 0;
+        while (n >>= 1) bit++;
+        return bit;
+    }
+
+    static void stats_record(const DatFile *dat, DatStatOp op, uint64_t start) {
+        DatStats *st = stats_of(dat);
+        uint64_t ns = stats_now() - start;
+        uint32_t bucket = stats_floor_log2(ns);
+        if (bucket >= DAT_STAT_BUCKETS) bucket = DAT_STAT_BUCKETS - 1;
+        st->calls[op]++;
+        st->time_ns[op] += ns;
+        st->latency[op][bucket]++;
+    }
+
+    static void stats_search(const DatFile *dat, uint32_t count, bool hit) {
+        DatStats *st = stats_of(dat);
+        uint32_t probes = count > 1 ? stats_floor_log2(count - 1) + 1 : 0;
+        st->search_count++;
+        st->search_misses += !hit;
+        st->search_depth[probes]++;
+    }
+
+    #define DAT_STAT_START(start) uint64_t start = stats_now()
+    #define DAT_STAT_END(dat, op, start) stats_record(dat, op, start)
+    #define DAT_STAT_CALL(dat, op) (stats_of(dat)->calls[op]++)
+    #define DAT_STAT_MOVE(dat, bytes) (stats_of(dat)->moved_bytes += (bytes))
+    #define DAT_STAT_GROW(dat, bytes) (stats_of(dat)->grow_count++, stats_of(dat)->grown_bytes += (bytes))
+    #define DAT_STAT_SEARCH(dat, count, hit) stats_search(dat, count, hit)
+    #define DAT_STAT_NAME_MISS(dat, miss) (stats_of(dat)->name_misses += (miss))
+#else
+    #define DAT_STAT_START(start)
+    #define DAT_STAT_END(dat, op, start) ((void)0)
+    #define DAT_STAT_CALL(dat, op) ((void)0)
+    #define DAT_STAT_MOVE(dat, bytes) ((void)0)
+    #define DAT_STAT_GROW(dat, bytes) ((void)0)
+    #define DAT_STAT_SEARCH(dat, count, hit) ((void)0)
+    #define DAT_STAT_NAME_MISS(dat, miss) ((void)0)
+#endif
 
-static int reloc_cmp(const void *a, const void *b) {
-    return cmp32(*(const DatRef*)a, *(const DatRef*)b);
+// Without a popcnt instruction, gcc calls into libgcc for __builtin_popcountll.
+static inline uint32_t popcount64(uint64_t x) {
+    #if defined(__POPCNT__)
+        return (uint32_t)__builtin_popcountll(x);
+    #else
+        x = x - ((x >> 1) & 0x5555555555555555ull);
+        x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+        x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+        return (uint32_t)((x * 0x0101010101010101ull) >> 56);
+    #endif
 }
-static int root_cmp(const void *a, const void *b) {
-    return cmp32(((const DatRootInfo*)a)->data_offset, ((const DatRootInfo*)b)->data_offset);
+
+// `x` must not be 0.
+static inline uint32_t ctz64(uint64_t x) {
+    #if defined(__GNUC__) || defined(__clang__)
+        return (uint32_t)__builtin_ctzll(x);
+    #else
+        uint32_t n = 0;
+        while ((x & 1) == 0) { x >>= 1; n++; }
+        return n;
+    #endif
 }
-static int extern_cmp(const void *a, const void *b) {
-    return cmp32(((const DatExternInfo*)a)->data_offset, ((const DatExternInfo*)b)->data_offset);
+
+#ifdef DAT_BSWAP_X86
+typedef struct CpuFeatures {
+    bool ssse3;
+    bool avx2;
+} CpuFeatures;
+
+static CpuFeatures cpu_features_value;
+
+static void cpu_features_detect(void) {
+    #if defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 0);
+        int max_leaf = info[0];
+        __cpuid(info, 1);
+        bool ssse3 = (info[2] & (1 << 9)) != 0;
+        bool avx2 = false;
+        if (max_leaf >= 7 && (info[2] & (1 << 27)) && (info[2] & (1 << 28))) {
+            bool os_avx = (_xgetbv(0) & 6) == 6;
+            __cpuidex(info, 7, 0);
+            avx2 = os_avx && (info[1] & (1 << 5)) != 0;
+        }
+    #else
+        __builtin_cpu_init();
+        bool ssse3 = __builtin_cpu_supports("ssse3");
+        bool avx2 = __builtin_cpu_supports("avx2");
+    #endif
+    cpu_features_value = (CpuFeatures) { ssse3, avx2 };
 }
 
-static inline uint32_t align_forward(uint32_t ptr, uint32_t align) {
-	uint32_t mod = ptr & (align-1);
-	if (mod) ptr += align - mod;
-	return ptr;
+#ifdef _WIN32
+static BOOL CALLBACK cpu_features_once(PINIT_ONCE once, PVOID param, PVOID *ctx) {
+    (void)once; (void)param; (void)ctx;
+    cpu_features_detect();
+    return TRUE;
+}
+#endif
+
+// Detected once, on first use. Every vectorized path dispatches on these, from any thread.
+static const CpuFeatures *cpu_features(void) {
+    #ifdef _WIN32
+        static INIT_ONCE once = INIT_ONCE_STATIC_INIT;
+        InitOnceExecuteOnce(&once, cpu_features_once, NULL, NULL);
+    #else
+        static pthread_once_t once = PTHREAD_ONCE_INIT;
+        pthread_once(&once, cpu_features_detect);
+    #endif
+    return &cpu_features_value;
+}
+#endif
+
+static void be32u_array_scalar(uint8_t *dst, const uint8_t *src, uint32_t count) {
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t n;
+        memcpy(&n, src + i*4, 4);
+        n = dat_be32u(n);
+        memcpy(dst + i*4, &n, 4);
+    }
+}
+
+#ifdef DAT_BSWAP_X86
+DAT_TARGET("ssse3")
+static void be32u_array_ssse3(uint8_t *dst, const uint8_t *src, uint32_t count) {
+    const __m128i shuf = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(const void*)(src + i*4));
+        _mm_storeu_si128((__m128i*)(void*)(dst + i*4), _mm_shuffle_epi8(v, shuf));
+    }
+    be32u_array_scalar(dst + i*4, src + i*4, count - i);
+}
+
+DAT_TARGET("avx2")
+static void be32u_array_avx2(uint8_t *dst, const uint8_t *src, uint32_t count) {
+    const __m256i shuf = _mm256_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+    );
+    uint32_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(const void*)(src + i*4));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(const void*)(src + i*4 + 32));
+        _mm256_storeu_si256((__m256i*)(void*)(dst + i*4), _mm256_shuffle_epi8(a, shuf));
+        _mm256_storeu_si256((__m256i*)(void*)(dst + i*4 + 32), _mm256_shuffle_epi8(b, shuf));
+    }
+    for (; i + 8 <= count; i += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(const void*)(src + i*4));
+        _mm256_storeu_si256((__m256i*)(void*)(dst + i*4), _mm256_shuffle_epi8(a, shuf));
+    }
+    be32u_array_scalar(dst + i*4, src + i*4, count - i);
+}
+
+#endif
+
+void dat_be32u_array(void *dst, const void *src, uint32_t count) {
+    DAT_ZONE(zone, "byte swap");
+    #if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        if (dst != src) memmove(dst, src, (size_t)count * 4);
+    #elif defined(DAT_BSWAP_X86)
+        const CpuFeatures *cpu = cpu_features();
+        if (cpu->avx2) be32u_array_avx2(dst, src, count);
+        else if (cpu->ssse3) be32u_array_ssse3(dst, src, count);
+        else be32u_array_scalar(dst, src, count);
+    #else
+        be32u_array_scalar(dst, src, count);
+    #endif
+    DAT_ZONE_END(zone);
+}
+
+// Elements smaller than this are insertion sorted instead of radix sorted.
+#define RADIX_SORT_MIN 64
+
+static inline uint32_t sort_key(const uint8_t *ele) {
+    uint32_t key;
+    memcpy(&key, ele, sizeof(key));
+    return key;
+}
+
+static bool is_sorted(const uint8_t *arr, uint32_t count, uint32_t ele_size) {
+    for (uint32_t i = 1; i < count; ++i) {
+        if (sort_key(arr + (i-1)*ele_size) > sort_key(arr + i*ele_size))
+            return false;
+    }
+    return true;
+}
+
+// Sorted arrays only.
+static uint32_t dedup_sorted_u32(uint32_t *arr, uint32_t count) {
+    if (count == 0) return 0;
+    uint32_t base_i = 1;
+    for (uint32_t head_i = 1; head_i < count; ++head_i) {
+        uint32_t n = arr[head_i];
+        if (n != arr[base_i-1])
+            arr[base_i++] = n;
+    }
+    return base_i;
+}
+
+static void insertion_sort(uint8_t *arr, uint32_t count, uint32_t ele_size) {
+    uint8_t ele[8];
+    for (uint32_t i = 1; i < count; ++i) {
+        memcpy(ele, arr + i*ele_size, ele_size);
+        uint32_t key = sort_key(ele);
+        uint32_t j = i;
+        while (j > 0 && sort_key(arr + (j-1)*ele_size) > key) {
+            memcpy(arr + j*ele_size, arr + (j-1)*ele_size, ele_size);
+            j--;
+        }
+        memcpy(arr + j*ele_size, ele, ele_size);
+    }
+}
+
+// Stable LSD radix sort on the u32 key at the start of each element.
+// `ele_size` must be 4 or 8. `tmp` must be able to hold `count` elements.
+// Passes over bytes that are the same in every key are skipped,
+// so offsets into small files only take two or three passes.
+//
+// If `dedup` is set, elements with equal keys are removed during the final pass.
+// Returns the number of elements left in `arr`.
+static uint32_t radix_sort(uint8_t *arr, uint8_t *tmp, uint32_t count, uint32_t ele_size, bool dedup) {
+    if (count < 2) return count;
+
+    uint32_t hist[4][256];
+    memset(hist, 0, sizeof(hist));
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t key = sort_key(arr + i*ele_size);
+        hist[0][key & 0xFF]++;
+        hist[1][(key >> 8) & 0xFF]++;
+        hist[2][(key >> 16) & 0xFF]++;
+        hist[3][key >> 24]++;
+    }
+
+    uint32_t first_key = sort_key(arr);
+    int last_pass = -1;
+    for (int pass = 0; pass < 4; ++pass) {
+        if (hist[pass][(first_key >> (pass*8)) & 0xFF] != count)
+            last_pass = pass;
+    }
+
+    // every key is the same
+    if (last_pass == -1)
+        return dedup ? 1 : count;
+
+    uint8_t *src = arr;
+    uint8_t *dst = tmp;
+    for (int pass = 0; pass <= last_pass; ++pass) {
+        uint32_t shift = (uint32_t)pass * 8;
+        if (hist[pass][(first_key >> shift) & 0xFF] == count)
+            continue;
+
+        uint32_t bucket_start[256];
+        uint32_t bucket_pos[256];
+        uint32_t sum = 0;
+        for (uint32_t b = 0; b < 256; ++b) {
+            bucket_start[b] = sum;
+            bucket_pos[b] = sum;
+            sum += hist[pass][b];
+        }
+
+        if (dedup && pass == last_pass) {
+            // All higher bytes are equal, so equal keys land next to each other in the same bucket.
+            // Skip repeats, then close the gaps they leave at the end of each bucket.
+            uint32_t *dst32 = (uint32_t*)dst;
+            for (uint32_t i = 0; i < count; ++i) {
+                uint32_t key = sort_key(src + i*4);
+                uint32_t b = (key >> shift) & 0xFF;
+                uint32_t pos = bucket_pos[b];
+                if (pos != bucket_start[b] && dst32[pos-1] == key) continue;
+                dst32[pos] = key;
+                bucket_pos[b] = pos + 1;
+            }
+
+            uint32_t out_i = 0;
+            for (uint32_t b = 0; b < 256; ++b) {
+                uint32_t n = bucket_pos[b] - bucket_start[b];
+                if (n != 0 && out_i != bucket_start[b])
+                    memmove(&dst32[out_i], &dst32[bucket_start[b]], n * sizeof(uint32_t));
+                out_i += n;
+            }
+            count = out_i;
+        } else if (ele_size == 4) {
+            for (uint32_t i = 0; i < count; ++i) {
+                uint32_t key = sort_key(src + i*4);
+                uint32_t b = (key >> shift) & 0xFF;
+                memcpy(dst + (bucket_pos[b]++)*4, &key, 4);
+            }
+        } else {
+            for (uint32_t i = 0; i < count; ++i) {
+                const uint8_t *ele = src + i*8;
+                uint32_t b = (sort_key(ele) >> shift) & 0xFF;
+                memcpy(dst + (bucket_pos[b]++)*8, ele, 8);
+            }
+        }
+
+        uint8_t *swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != arr)
+        memcpy(arr, src, (size_t)count * ele_size);
+    return count;
+}
+
+// Sorts by the u32 key at the start of each element, see radix_sort.
+// Already sorted arrays (the common case for reloc tables) are only scanned.
+// `tmp` may be NULL if `count` < RADIX_SORT_MIN.
+static uint32_t sort_by_key(uint8_t *arr, uint8_t *tmp, uint32_t count, uint32_t ele_size, bool dedup) {
+    DAT_ZONE(zone, "sort");
+    uint32_t sorted_count;
+    if (is_sorted(arr, count, ele_size)) {
+        sorted_count = dedup ? dedup_sorted_u32((uint32_t*)arr, count) : count;
+    } else if (count < RADIX_SORT_MIN) {
+        insertion_sort(arr, count, ele_size);
+        sorted_count = dedup ? dedup_sorted_u32((uint32_t*)arr, count) : count;
+    } else {
+        sorted_count = radix_sort(arr, tmp, count, ele_size, dedup);
+    }
+    DAT_ZONE_END(zone);
+    return sorted_count;
+}
+
+// ALLOCATION ------------------------------------------------------
+
+// A NULL or zeroed allocator uses the C allocator.
+static void *dat_alloc(const DatAllocator *a, size_t size) {
+    if (a == NULL || a->alloc == NULL) return malloc(size);
+    return a->alloc(a->ctx, size);
+}
+
+static void *dat_realloc(const DatAllocator *a, void *ptr, size_t old_size, size_t new_size) {
+    if (a == NULL || a->alloc == NULL) return realloc(ptr, new_size);
+    return a->realloc(a->ctx, ptr, old_size, new_size);
+}
+
+static void dat_free(const DatAllocator *a, void *ptr, size_t size) {
+    if (a == NULL || a->alloc == NULL) { free(ptr); return; }
+    a->free(a->ctx, ptr, size);
+}
+
+// Temporary buffers, freed before the call that made them returns, come from the C allocator.
+// Only what a DatFile keeps goes through its DatAllocator, so an arena holds nothing else.
+// realloc_arr(NULL, ...) grows them.
+static void *scratch_alloc(size_t size) {
+    return malloc(size);
+}
+
+static void *scratch_calloc(size_t count, size_t size) {
+    return calloc(count, size);
+}
+
+static void scratch_free(void *ptr) {
+    free(ptr);
+}
+
+#define ARENA_ALIGN 16
+
+static void *arena_alloc(void *ctx, size_t size) {
+    DatArena *arena = ctx;
+    size_t start = (arena->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (start > arena->capacity || size > arena->capacity - start) return NULL;
+    arena->last = start;
+    arena->used = start + size;
+    return arena->base + start;
+}
+
+static void *arena_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size) {
+    DatArena *arena = ctx;
+    if (ptr == NULL) return arena_alloc(ctx, new_size);
+
+    // the most recent allocation grows in place
+    if ((uint8_t*)ptr == arena->base + arena->last) {
+        if (new_size > arena->capacity - arena->last) return NULL;
+        arena->used = arena->last + new_size;
+        return ptr;
+    }
+
+    void *new_ptr = arena_alloc(ctx, new_size);
+    if (new_ptr == NULL) return NULL;
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    return new_ptr;
+}
+
+static void arena_free(void *ctx, void *ptr, size_t size) {
+    (void)size;
+    DatArena *arena = ctx;
+    if (ptr != NULL && (uint8_t*)ptr == arena->base + arena->last)
+        arena->used = arena->last;
+}
+
+void dat_arena_init(DatArena *arena, void *buffer, size_t capacity) {
+    *arena = (DatArena) { buffer, capacity, 0, 0 };
+}
+
+DatAllocator dat_arena_allocator(DatArena *arena) {
+    return (DatAllocator) { arena_alloc, arena_realloc, arena_free, arena };
 }
 
-static DAT_RET realloc_arr(void **arr, uint32_t *prev_cap, uint32_t ele_size) {
+void dat_arena_reset(DatArena *arena) {
+    arena->used = 0;
+    arena->last = 0;
+}
+
+// Doubles the capacity of an array, to at least 4 KB.
+static DAT_RET realloc_arr(const DatAllocator *a, void **arr, uint32_t *prev_cap, uint32_t ele_size) {
     uint32_t new_cap = *prev_cap * ele_size * 2;
     if (new_cap < 4096) new_cap = 4096;
-    void *new_arr = realloc(*arr, new_cap);
+    void *new_arr = dat_realloc(a, *arr, *prev_cap * ele_size, new_cap);
 
     if (new_arr == NULL)
         return DAT_ERR_ALLOCATION_FAILURE;
@@ -38,191 +505,2110 @@ static DAT_RET realloc_arr(void **arr, uint32_t *prev_cap, uint32_t ele_size) {
     return DAT_SUCCESS;
 }
 
-DAT_RET dat_file_import(const uint8_t *file, uint32_t buffer_size, DatFile *out) {
-    if (file == NULL) return DAT_ERR_NULL_PARAM;
-    if (out == NULL) return DAT_ERR_NULL_PARAM;
-    dat_file_new(out);
+// Like realloc_arr, but first moves the array out of the import buffer if it is borrowed.
+static DAT_RET grow_arr(DatFile *dat, uint32_t borrow_flag, void **arr, uint32_t *prev_cap, uint32_t ele_size) {
+    DAT_STAT_GROW(dat, (uint64_t)*prev_cap * ele_size);
+    if ((dat->flags & borrow_flag) == 0)
+        return realloc_arr(&dat->allocator, arr, prev_cap, ele_size);
 
-    // header ----------
+    uint32_t new_cap = *prev_cap * ele_size * 2;
+    if (new_cap < 4096) new_cap = 4096;
+    void *new_arr = dat_alloc(&dat->allocator, new_cap);
 
-    uint32_t file_size    = READ_U32(file + 0);
-    uint32_t data_size    = READ_U32(file + 4);
-    uint32_t reloc_count  = READ_U32(file + 8);
-    uint32_t root_count   = READ_U32(file + 12);
-    uint32_t extern_count = READ_U32(file + 16);
+    if (new_arr == NULL)
+        return DAT_ERR_ALLOCATION_FAILURE;
 
-    if (file_size > buffer_size)
-        return DAT_ERR_INVALID_SIZE;
+    if (*prev_cap != 0) memcpy(new_arr, *arr, *prev_cap * ele_size);
+    *prev_cap = new_cap / ele_size;
+    *arr = new_arr;
+    dat->flags &= ~borrow_flag;
 
-    // data  ---------------------
+    return DAT_SUCCESS;
+}
 
-    out->data_size = data_size;
-    // realloc would be expensive
-    if (data_size < 0x40000)
-        out->data_capacity = 0x40000; // 256 KB
-    else
-        out->data_capacity = data_size;
-    out->data = malloc(out->data_capacity);
-    if (out->data == NULL) { dat_file_destroy(out); return DAT_ERR_ALLOCATION_FAILURE; }
-    memcpy(out->data, file + 0x20, data_size);
+// RELOC BLOCKS ----------------------------------------------------
 
-    // relocation table ----------
+// Blocks are split when full. Flattened tables are split into blocks this full,
+// leaving room for inserts before the first split.
+#define RELOC_BLOCK_MAX 512
+#define RELOC_BLOCK_FILL 384
 
-    uint32_t reloc_offset = 0x20 + data_size;
-    uint32_t reloc_size = reloc_count * sizeof(DatRef);
-    out->reloc_count = reloc_count;
-    out->reloc_capacity = reloc_size * 2;
-    out->reloc_targets = malloc(out->reloc_capacity * sizeof(DatRef));
-    if (out->reloc_targets == NULL) { dat_file_destroy(out); return DAT_ERR_ALLOCATION_FAILURE; }
-    memcpy(out->reloc_targets, file + reloc_offset, reloc_size);
-    for (uint32_t i = 0; i < reloc_count; ++i)
-        out->reloc_targets[i] = dat_be32u(out->reloc_targets[i]);
-    qsort(out->reloc_targets, reloc_count, sizeof(DatRef), reloc_cmp);
+struct DatRelocBlocks {
+    DatRef **blocks;        // each holds up to RELOC_BLOCK_MAX sorted refs
+    uint32_t *counts;
+    DatRef *firsts;         // first ref in each block, searched to find a block
+    uint32_t block_count;
+    uint32_t block_capacity;
+};
 
-    // root table ----------
+static void reloc_blocks_free(DatRelocBlocks *rb, const DatAllocator *a) {
+    if (rb == NULL) return;
+    for (uint32_t i = 0; i < rb->block_count; ++i)
+        dat_free(a, rb->blocks[i], RELOC_BLOCK_MAX * sizeof(DatRef));
+    dat_free(a, rb->blocks, rb->block_capacity * sizeof(*rb->blocks));
+    dat_free(a, rb->counts, rb->block_capacity * sizeof(*rb->counts));
+    dat_free(a, rb->firsts, rb->block_capacity * sizeof(*rb->firsts));
+    dat_free(a, rb, sizeof(DatRelocBlocks));
+}
 
-    uint32_t root_offset = reloc_offset + reloc_size;
-    uint32_t root_size = root_count * sizeof(DatRootInfo);
-    out->root_count = root_count;
-    out->root_capacity = root_count * 4;
-    out->root_info = malloc(out->root_capacity * sizeof(DatRootInfo));
-    if (out->root_info == NULL) { dat_file_destroy(out); return DAT_ERR_ALLOCATION_FAILURE; }
-    memcpy(out->root_info, file + root_offset, root_size);
-    for (uint32_t i = 0; i < root_count; ++i) {
-        out->root_info[i].data_offset = dat_be32u(out->root_info[i].data_offset);
-        out->root_info[i].symbol_offset = dat_be32u(out->root_info[i].symbol_offset);
+// Inserts an empty block at `block_i`.
+static DAT_RET reloc_blocks_insert_block(DatRelocBlocks *rb, const DatAllocator *a, uint32_t block_i) {
+    if (rb->block_count == rb->block_capacity) {
+        // all three arrays are replaced together, so their capacity is always block_capacity
+        uint32_t old_cap = rb->block_capacity;
+        uint32_t new_cap = old_cap * 2;
+        if (new_cap < 16) new_cap = 16;
+        DatRef **blocks = dat_alloc(a, new_cap * sizeof(*rb->blocks));
+        uint32_t *counts = dat_alloc(a, new_cap * sizeof(*rb->counts));
+        DatRef *firsts = dat_alloc(a, new_cap * sizeof(*rb->firsts));
+        if (blocks == NULL || counts == NULL || firsts == NULL) {
+            dat_free(a, firsts, new_cap * sizeof(*rb->firsts));
+            dat_free(a, counts, new_cap * sizeof(*rb->counts));
+            dat_free(a, blocks, new_cap * sizeof(*rb->blocks));
+            return DAT_ERR_ALLOCATION_FAILURE;
+        }
+        if (old_cap != 0) {
+            memcpy(blocks, rb->blocks, old_cap * sizeof(*rb->blocks));
+            memcpy(counts, rb->counts, old_cap * sizeof(*rb->counts));
+            memcpy(firsts, rb->firsts, old_cap * sizeof(*rb->firsts));
+        }
+        dat_free(a, rb->firsts, old_cap * sizeof(*rb->firsts));
+        dat_free(a, rb->counts, old_cap * sizeof(*rb->counts));
+        dat_free(a, rb->blocks, old_cap * sizeof(*rb->blocks));
+        rb->blocks = blocks;
+        rb->counts = counts;
+        rb->firsts = firsts;
+        rb->block_capacity = new_cap;
+    }
+
+    DatRef *block = dat_alloc(a, RELOC_BLOCK_MAX * sizeof(DatRef));
+    if (block == NULL) return DAT_ERR_ALLOCATION_FAILURE;
+
+    uint32_t after = rb->block_count - block_i;
+    memmove(&rb->blocks[block_i+1], &rb->blocks[block_i], after * sizeof(*rb->blocks));
+    memmove(&rb->counts[block_i+1], &rb->counts[block_i], after * sizeof(*rb->counts));
+    memmove(&rb->firsts[block_i+1], &rb->firsts[block_i], after * sizeof(*rb->firsts));
+    rb->blocks[block_i] = block;
+    rb->counts[block_i] = 0;
+    rb->firsts[block_i] = 0;
+    rb->block_count++;
+
+    return DAT_SUCCESS;
+}
+
+static void reloc_blocks_remove_block(DatRelocBlocks *rb, const DatAllocator *a, uint32_t block_i) {
+    dat_free(a, rb->blocks[block_i], RELOC_BLOCK_MAX * sizeof(DatRef));
+    uint32_t after = rb->block_count - block_i - 1;
+    memmove(&rb->blocks[block_i], &rb->blocks[block_i+1], after * sizeof(*rb->blocks));
+    memmove(&rb->counts[block_i], &rb->counts[block_i+1], after * sizeof(*rb->counts));
+    memmove(&rb->firsts[block_i], &rb->firsts[block_i+1], after * sizeof(*rb->firsts));
+    rb->block_count--;
+}
+
+// Returns the block that would contain `ref`: the last block starting at or before it.
+static uint32_t reloc_blocks_find(const DatRelocBlocks *rb, DatRef ref) {
+    uint32_t idx = binary_search_refs(rb->firsts, rb->block_count, ref);
+    if (idx == rb->block_count || rb->firsts[idx] != ref)
+        idx = idx == 0 ? 0 : idx - 1;
+    return idx;
+}
+
+static bool reloc_blocks_contains(const DatRelocBlocks *rb, DatRef ref) {
+    if (rb->block_count == 0) return false;
+    uint32_t block_i = reloc_blocks_find(rb, ref);
+    uint32_t pos = binary_search_refs(rb->blocks[block_i], rb->counts[block_i], ref);
+    return pos < rb->counts[block_i] && rb->blocks[block_i][pos] == ref;
+}
+
+static DAT_RET reloc_blocks_from_sorted(const DatAllocator *a, const DatRef *refs, uint32_t count, DatRelocBlocks **out) {
+    DatRelocBlocks *rb = dat_alloc(a, sizeof(DatRelocBlocks));
+    if (rb == NULL) return DAT_ERR_ALLOCATION_FAILURE;
+    *rb = (DatRelocBlocks) {0};
+
+    DAT_ZONE(zone, "split reloc blocks");
+    for (uint32_t i = 0; i < count; i += RELOC_BLOCK_FILL) {
+        uint32_t n = count - i < RELOC_BLOCK_FILL ? count - i : RELOC_BLOCK_FILL;
+        DAT_RET err = reloc_blocks_insert_block(rb, a, rb->block_count);
+        if (err) { DAT_ZONE_END(zone); reloc_blocks_free(rb, a); return err; }
+        uint32_t block_i = rb->block_count - 1;
+        memcpy(rb->blocks[block_i], &refs[i], n * sizeof(DatRef));
+        rb->counts[block_i] = n;
+        rb->firsts[block_i] = refs[i];
+    }
+    DAT_ZONE_END(zone);
+
+    *out = rb;
+    return DAT_SUCCESS;
+}
+
+// Returns DAT_NOT_FOUND if `ref` was already present.
+static DAT_RET reloc_blocks_insert(DatFile *dat, DatRef ref) {
+    DatRelocBlocks *rb = dat->reloc_blocks;
+    if (rb->block_count == 0) {
+        DAT_RET err = reloc_blocks_insert_block(rb, &dat->allocator, 0);
+        if (err) return err;
+    }
+
+    uint32_t block_i = reloc_blocks_find(rb, ref);
+    uint32_t pos = binary_search_refs(rb->blocks[block_i], rb->counts[block_i], ref);
+    bool found = pos < rb->counts[block_i] && rb->blocks[block_i][pos] == ref;
+    DAT_STAT_SEARCH(dat, rb->block_count, true);
+    DAT_STAT_SEARCH(dat, rb->counts[block_i], found);
+    if (found) return DAT_NOT_FOUND;
+
+    if (rb->counts[block_i] == RELOC_BLOCK_MAX) {
+        // split in half
+        DAT_RET err = reloc_blocks_insert_block(rb, &dat->allocator, block_i+1);
+        if (err) return err;
+        uint32_t half = RELOC_BLOCK_MAX / 2;
+        DAT_STAT_GROW(dat, half * sizeof(DatRef));
+        memcpy(rb->blocks[block_i+1], &rb->blocks[block_i][half], half * sizeof(DatRef));
+        rb->counts[block_i] = half;
+        rb->counts[block_i+1] = half;
+        rb->firsts[block_i+1] = rb->blocks[block_i+1][0];
+
+        if (pos > half) {
+            block_i++;
+            pos -= half;
+        }
+    }
+
+    DatRef *block = rb->blocks[block_i];
+    uint32_t count = rb->counts[block_i];
+    memmove(&block[pos+1], &block[pos], (count-pos) * sizeof(DatRef));
+    DAT_STAT_MOVE(dat, (count-pos) * sizeof(DatRef));
+    block[pos] = ref;
+    rb->counts[block_i] = count + 1;
+    if (pos == 0) rb->firsts[block_i] = ref;
+
+    return DAT_SUCCESS;
+}
+
+static DAT_RET reloc_blocks_remove(DatFile *dat, DatRef ref) {
+    DatRelocBlocks *rb = dat->reloc_blocks;
+    if (rb->block_count == 0) return DAT_NOT_FOUND;
+
+    uint32_t block_i = reloc_blocks_find(rb, ref);
+    DatRef *block = rb->blocks[block_i];
+    uint32_t count = rb->counts[block_i];
+    uint32_t pos = binary_search_refs(block, count, ref);
+    bool found = pos != count && block[pos] == ref;
+    DAT_STAT_SEARCH(dat, rb->block_count, true);
+    DAT_STAT_SEARCH(dat, count, found);
+    if (!found) return DAT_NOT_FOUND;
+
+    memmove(&block[pos], &block[pos+1], (count-pos-1) * sizeof(DatRef));
+    DAT_STAT_MOVE(dat, (count-pos-1) * sizeof(DatRef));
+    count--;
+    rb->counts[block_i] = count;
+
+    if (count == 0) {
+        reloc_blocks_remove_block(rb, &dat->allocator, block_i);
+        return DAT_SUCCESS;
+    }
+    if (pos == 0) rb->firsts[block_i] = block[0];
+
+    // merge small neighbours so deletes don't leave lots of tiny blocks
+    if (block_i + 1 < rb->block_count) {
+        uint32_t next_count = rb->counts[block_i+1];
+        if (count + next_count <= RELOC_BLOCK_MAX / 2) {
+            memcpy(&block[count], rb->blocks[block_i+1], next_count * sizeof(DatRef));
+            rb->counts[block_i] = count + next_count;
+            reloc_blocks_remove_block(rb, &dat->allocator, block_i+1);
+        }
+    }
+
+    return DAT_SUCCESS;
+}
+
+// Iterates over every reference in increasing order, whatever mode the file is in.
+// In builder mode references are visited unsorted and seeking is not supported.
+typedef struct RelocIter {
+    const DatFile *dat;
+    uint32_t block_i;
+    uint32_t i;
+} RelocIter;
+
+// Positions the iterator at the first reference at or after `ref`.
+static RelocIter reloc_iter_seek(const DatFile *dat, DatRef ref) {
+    RelocIter it = { dat, 0, 0 };
+    if (dat->flags & DAT_FILE_EDITING) {
+        const DatRelocBlocks *rb = dat->reloc_blocks;
+        if (rb->block_count == 0) return it;
+        it.block_i = reloc_blocks_find(rb, ref);
+        it.i = binary_search_refs(rb->blocks[it.block_i], rb->counts[it.block_i], ref);
+    } else if (ref != 0) {
+        it.i = binary_search_refs(dat->reloc_targets, dat->reloc_count, ref);
+    }
+    return it;
+}
+
+static inline bool reloc_iter_next(RelocIter *it, DatRef *out) {
+    const DatFile *dat = it->dat;
+    if (dat->flags & DAT_FILE_EDITING) {
+        const DatRelocBlocks *rb = dat->reloc_blocks;
+        while (it->block_i < rb->block_count && it->i == rb->counts[it->block_i]) {
+            it->block_i++;
+            it->i = 0;
+        }
+        if (it->block_i == rb->block_count) return false;
+        *out = rb->blocks[it->block_i][it->i++];
+        return true;
+    }
+
+    if (it->i == dat->reloc_count) return false;
+    *out = dat->reloc_targets[it->i++];
+    return true;
+}
+
+// NAME INDEX ------------------------------------------------------
+
+// Open addressing map from symbol strings to root or extern indices.
+// Only stores indices, strings are compared through the file's symbol table.
+typedef struct DatNameSlot {
+    uint32_t hash;
+    uint32_t idx_plus_1; // 0 if unused
+} DatNameSlot;
+
+struct DatNameIndex {
+    DatNameSlot *slots;
+    uint32_t log_size;
+    uint32_t count;
+    bool has_duplicates;
+};
+
+#define NAME_INDEX_MIN_LOG_SIZE 5
+
+// FNV-1a
+static uint32_t hash_str(const char *str) {
+    uint32_t hash = 2166136261u;
+    for (const uint8_t *c = (const uint8_t*)str; *c; ++c)
+        hash = (hash ^ *c) * 16777619u;
+    return hash;
+}
+
+// Root and extern infos are both (data_offset, symbol_offset) pairs of u32s,
+// so one index implementation covers both.
+static const char *name_at(const DatFile *dat, const uint32_t *infos, uint32_t idx) {
+    return &dat->symbols[infos[idx*2+1]];
+}
+
+// Returns the slot holding `name`, or the empty slot it should be inserted into.
+static DatNameSlot *name_index_slot(
+    const DatNameIndex *ni, const DatFile *dat, const uint32_t *infos,
+    const char *name, uint32_t hash
+) {
+    uint32_t mask = (1u << ni->log_size) - 1;
+    uint32_t idx = hash & mask;
+    while (1) {
+        DatNameSlot *slot = &ni->slots[idx];
+        if (slot->idx_plus_1 == 0)
+            return slot;
+        if (slot->hash == hash && strcmp(name_at(dat, infos, slot->idx_plus_1 - 1), name) == 0)
+            return slot;
+        idx = (idx + 1) & mask;
+    }
+}
+
+static void name_index_free(DatNameIndex *ni, const DatAllocator *a) {
+    if (ni == NULL) return;
+    if (ni->slots != NULL) dat_free(a, ni->slots, (1u << ni->log_size) * sizeof(DatNameSlot));
+    dat_free(a, ni, sizeof(DatNameIndex));
+}
+
+static DAT_RET name_index_resize(DatNameIndex *ni, const DatAllocator *a, uint32_t log_size) {
+    DatNameSlot *old_slots = ni->slots;
+    uint32_t old_size = old_slots == NULL ? 0 : 1u << ni->log_size;
+
+    ni->slots = dat_alloc(a, (1u << log_size) * sizeof(DatNameSlot));
+    if (ni->slots == NULL) {
+        ni->slots = old_slots;
+        return DAT_ERR_ALLOCATION_FAILURE;
+    }
+    memset(ni->slots, 0, (1u << log_size) * sizeof(DatNameSlot));
+    ni->log_size = log_size;
+
+    uint32_t mask = (1u << log_size) - 1;
+    for (uint32_t i = 0; i < old_size; ++i) {
+        DatNameSlot slot = old_slots[i];
+        if (slot.idx_plus_1 == 0) continue;
+        uint32_t idx = slot.hash & mask;
+        while (ni->slots[idx].idx_plus_1 != 0)
+            idx = (idx + 1) & mask;
+        ni->slots[idx] = slot;
+    }
+
+    dat_free(a, old_slots, old_size * sizeof(DatNameSlot));
+    return DAT_SUCCESS;
+}
+
+// Indexes infos[info_i]. Existing entries keep priority unless they come later in the table.
+static DAT_RET name_index_insert(DatNameIndex *ni, const DatFile *dat, const uint32_t *infos, uint32_t info_i) {
+    const char *name = name_at(dat, infos, info_i);
+    uint32_t hash = hash_str(name);
+    DatNameSlot *slot = name_index_slot(ni, dat, infos, name, hash);
+
+    if (slot->idx_plus_1 != 0) {
+        ni->has_duplicates = true;
+        if (info_i < slot->idx_plus_1 - 1)
+            slot->idx_plus_1 = info_i + 1;
+        return DAT_SUCCESS;
+    }
+
+    *slot = (DatNameSlot) { hash, info_i + 1 };
+    ni->count++;
+
+    // keep the load factor at or below 1/2
+    if (ni->count * 2 > (1u << ni->log_size))
+        return name_index_resize(ni, &dat->allocator, ni->log_size + 1);
+    return DAT_SUCCESS;
+}
+
+static DAT_RET name_index_build(const DatFile *dat, const uint32_t *infos, uint32_t count, DatNameIndex **out) {
+    DatNameIndex *ni = dat_alloc(&dat->allocator, sizeof(DatNameIndex));
+    if (ni == NULL) return DAT_ERR_ALLOCATION_FAILURE;
+    *ni = (DatNameIndex) {0};
+
+    uint32_t log_size = NAME_INDEX_MIN_LOG_SIZE;
+    while ((1u << log_size) < count * 2) log_size++;
+    DAT_RET err = name_index_resize(ni, &dat->allocator, log_size);
+
+    for (uint32_t i = 0; i < count && err == DAT_SUCCESS; ++i)
+        err = name_index_insert(ni, dat, infos, i);
+
+    if (err) {
+        name_index_free(ni, &dat->allocator);
+        return err;
+    }
+    *out = ni;
+    return DAT_SUCCESS;
+}
+
+// Shifts indexed entries at or after `from` by `delta`, after an insert or removal in the table.
+static void name_index_shift(DatNameIndex *ni, uint32_t from, int32_t delta) {
+    uint32_t size = 1u << ni->log_size;
+    for (uint32_t i = 0; i < size; ++i) {
+        uint32_t idx_plus_1 = ni->slots[i].idx_plus_1;
+        if (idx_plus_1 > from)
+            ni->slots[i].idx_plus_1 = (uint32_t)((int32_t)idx_plus_1 + delta);
+    }
+}
+
+// Removes the entry for infos[info_i] with backward shift deletion.
+static void name_index_remove(DatNameIndex *ni, const DatFile *dat, const uint32_t *infos, uint32_t info_i) {
+    const char *name = name_at(dat, infos, info_i);
+    DatNameSlot *slot = name_index_slot(ni, dat, infos, name, hash_str(name));
+    if (slot->idx_plus_1 != info_i + 1) return;
+
+    uint32_t mask = (1u << ni->log_size) - 1;
+    uint32_t hole = (uint32_t)(slot - ni->slots);
+    uint32_t i = hole;
+    while (1) {
+        i = (i + 1) & mask;
+        DatNameSlot next = ni->slots[i];
+        if (next.idx_plus_1 == 0) break;
+
+        // move `next` into the hole unless its home slot lies cyclically in (hole, i]
+        uint32_t home = next.hash & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            ni->slots[hole] = next;
+            hole = i;
+        }
+    }
+    ni->slots[hole] = (DatNameSlot) {0};
+    ni->count--;
+}
+
+static DAT_RET name_index_find(
+    DatNameIndex **index, const DatFile *dat, const uint32_t *infos, uint32_t count,
+    const char *name, uint32_t *out
+) {
+    if (*index == NULL) {
+        DAT_RET err = name_index_build(dat, infos, count, index);
+        if (err) return err;
+    }
+
+    DatNameSlot *slot = name_index_slot(*index, dat, infos, name, hash_str(name));
+    if (slot->idx_plus_1 == 0) return DAT_NOT_FOUND;
+    *out = slot->idx_plus_1 - 1;
+    return DAT_SUCCESS;
+}
+
+// The symbol set reuses DatNameIndex, with idx_plus_1 holding a symbol_offset + 1.
+static DatNameSlot *symbol_set_slot(const DatNameIndex *set, const char *symbols, const char *symbol, uint32_t hash) {
+    uint32_t mask = (1u << set->log_size) - 1;
+    uint32_t idx = hash & mask;
+    while (1) {
+        DatNameSlot *slot = &set->slots[idx];
+        if (slot->idx_plus_1 == 0)
+            return slot;
+        if (slot->hash == hash && strcmp(&symbols[slot->idx_plus_1 - 1], symbol) == 0)
+            return slot;
+        idx = (idx + 1) & mask;
     }
-    qsort(out->root_info, root_count, sizeof(DatRootInfo), root_cmp);
+}
+
+static DAT_RET symbol_set_insert(DatNameIndex *set, const DatAllocator *a, const char *symbols, SymbolRef symbol_offset) {
+    const char *symbol = &symbols[symbol_offset];
+    uint32_t hash = hash_str(symbol);
+    DatNameSlot *slot = symbol_set_slot(set, symbols, symbol, hash);
+    if (slot->idx_plus_1 != 0) return DAT_SUCCESS;
+
+    *slot = (DatNameSlot) { hash, symbol_offset + 1 };
+    set->count++;
+
+    // keep the load factor at or below 1/2
+    if (set->count * 2 > (1u << set->log_size))
+        return name_index_resize(set, a, set->log_size + 1);
+    return DAT_SUCCESS;
+}
+
+// Only symbols referenced by roots and externs are interned,
+// since those are the only offsets known to start a string.
+static DAT_RET symbol_set_build(const DatFile *dat, DatNameIndex **out) {
+    const DatAllocator *a = &dat->allocator;
+    DatNameIndex *set = dat_alloc(a, sizeof(DatNameIndex));
+    if (set == NULL) return DAT_ERR_ALLOCATION_FAILURE;
+    *set = (DatNameIndex) {0};
+
+    uint32_t count = dat->root_count + dat->extern_count;
+    uint32_t log_size = NAME_INDEX_MIN_LOG_SIZE;
+    while ((1u << log_size) < count * 2) log_size++;
+    DAT_RET err = name_index_resize(set, a, log_size);
+
+    for (uint32_t i = 0; i < dat->root_count && err == DAT_SUCCESS; ++i)
+        err = symbol_set_insert(set, a, dat->symbols, dat->root_info[i].symbol_offset);
+    for (uint32_t i = 0; i < dat->extern_count && err == DAT_SUCCESS; ++i)
+        err = symbol_set_insert(set, a, dat->symbols, dat->extern_info[i].symbol_offset);
+
+    if (err) {
+        name_index_free(set, a);
+        return err;
+    }
+    *out = set;
+    return DAT_SUCCESS;
+}
+
+static inline uint32_t align_forward(uint32_t ptr, uint32_t align) {
+	uint32_t mod = ptr & (align-1);
+	if (mod) ptr += align - mod;
+	return ptr;
+}
+
+// Tables are converted in place and point into `file` where alignment allows.
+// Destroys `out` on failure, releasing the buffer the caller attached to it.
+static DAT_RET dat_file_import_inner(uint8_t *file, uint32_t buffer_size, uint32_t flags, DatFile *out) {
+    if (buffer_size < 0x20) { dat_file_destroy(out); return DAT_ERR_INVALID_SIZE; }
+
+    // header ----------
+
+    uint32_t file_size    = READ_U32(file + 0);
+    uint32_t data_size    = READ_U32(file + 4);
+    uint32_t reloc_count  = READ_U32(file + 8);
+    uint32_t root_count   = READ_U32(file + 12);
+    uint32_t extern_count = READ_U32(file + 16);
+
+    if (file_size > buffer_size) { dat_file_destroy(out); return DAT_ERR_INVALID_SIZE; }
+
+    uint64_t tables_end = 0x20 + (uint64_t)data_size
+        + (uint64_t)reloc_count * sizeof(DatRef)
+        + (uint64_t)root_count * sizeof(DatRootInfo)
+        + (uint64_t)extern_count * sizeof(DatExternInfo);
+    if (tables_end > file_size) { dat_file_destroy(out); return DAT_ERR_INVALID_SIZE; }
+
+    // Scratch space for sorting the tables.
+    uint32_t sort_tmp_count = reloc_count;
+    if (sort_tmp_count < root_count * 2) sort_tmp_count = root_count * 2;
+    if (sort_tmp_count < extern_count * 2) sort_tmp_count = extern_count * 2;
+    uint8_t *sort_tmp = NULL;
+    if (sort_tmp_count >= RADIX_SORT_MIN) {
+        sort_tmp = scratch_alloc(sort_tmp_count * sizeof(uint32_t));
+        if (sort_tmp == NULL) { dat_file_destroy(out); return DAT_ERR_ALLOCATION_FAILURE; }
+    }
+
+    // data  ---------------------
+
+    out->data_size = data_size;
+    out->data_capacity = data_size;
+    out->data = file + 0x20;
+    out->flags |= DAT_FILE_BORROWED_DATA;
+
+    // relocation table ----------
+
+    uint32_t reloc_offset = 0x20 + data_size;
+    uint32_t reloc_size = reloc_count * sizeof(DatRef);
+    out->reloc_count = reloc_count;
+    out->reloc_capacity = reloc_count;
+    if ((reloc_offset & 3) == 0) {
+        out->reloc_targets = (DatRef*)(file + reloc_offset);
+        out->flags |= DAT_FILE_BORROWED_RELOCS;
+    } else if (reloc_count != 0) {
+        // Empty tables stay NULL, allocators may fail zero sized allocations.
+        out->reloc_targets = dat_alloc(&out->allocator, reloc_size);
+        if (out->reloc_targets == NULL) { scratch_free(sort_tmp); dat_file_destroy(out); return DAT_ERR_ALLOCATION_FAILURE; }
+    }
+    dat_be32u_array(out->reloc_targets, file + reloc_offset, reloc_count);
+    sort_by_key((uint8_t*)out->reloc_targets, sort_tmp, reloc_count, sizeof(DatRef), false);
+
+    // root table ----------
+
+    uint32_t root_offset = reloc_offset + reloc_size;
+    uint32_t root_size = root_count * sizeof(DatRootInfo);
+    out->root_count = root_count;
+    out->root_capacity = root_count;
+    if ((root_offset & 3) == 0) {
+        out->root_info = (DatRootInfo*)(file + root_offset);
+        out->flags |= DAT_FILE_BORROWED_ROOTS;
+    } else if (root_count != 0) {
+        out->root_info = dat_alloc(&out->allocator, root_size);
+        if (out->root_info == NULL) { scratch_free(sort_tmp); dat_file_destroy(out); return DAT_ERR_ALLOCATION_FAILURE; }
+    }
+    dat_be32u_array(out->root_info, file + root_offset, root_count * 2);
+    sort_by_key((uint8_t*)out->root_info, sort_tmp, root_count, sizeof(DatRootInfo), false);
+
+    // external ref table ----------
+
+    uint32_t extern_offset = root_offset + root_size;
+    uint32_t extern_size = extern_count * sizeof(DatExternInfo);
+    out->extern_count = extern_count;
+    out->extern_capacity = extern_count;
+    if ((extern_offset & 3) == 0) {
+        out->extern_info = (DatExternInfo*)(file + extern_offset);
+        out->flags |= DAT_FILE_BORROWED_EXTERNS;
+    } else if (extern_count != 0) {
+        out->extern_info = dat_alloc(&out->allocator, extern_size);
+        if (out->extern_info == NULL) { scratch_free(sort_tmp); dat_file_destroy(out); return DAT_ERR_ALLOCATION_FAILURE; }
+    }
+    dat_be32u_array(out->extern_info, file + extern_offset, extern_count * 2);
+    sort_by_key((uint8_t*)out->extern_info, sort_tmp, extern_count, sizeof(DatExternInfo), false);
+    scratch_free(sort_tmp);
+
+    // symbol table -----------------
+
+    uint32_t symbol_offset = extern_offset + extern_size;
+    uint32_t symbol_size = file_size - symbol_offset;
+    out->symbol_size = symbol_size;
+    out->symbol_capacity = symbol_size;
+    out->symbols = (char*)(file + symbol_offset);
+    out->flags |= DAT_FILE_BORROWED_SYMBOLS;
+    
+    out->flags |= DAT_FILE_OBJECTS_PENDING;
+    if (flags & DAT_IMPORT_VALIDATE) {
+        DAT_RET err = dat_file_validate(out);
+        if (err) { dat_file_destroy(out); return err; }
+    }
+    if (flags & DAT_IMPORT_EAGER_OBJECTS) {
+        DAT_RET err = dat_file_find_objects(out);
+        if (err) { dat_file_destroy(out); return err; }
+    }
+    if (flags & DAT_IMPORT_RELOC_BITMAP) {
+        DAT_RET err = dat_file_build_reloc_bitmap(out);
+        if (err) { dat_file_destroy(out); return err; }
+    }
+
+    return DAT_SUCCESS;
+}
+
+DAT_RET dat_file_import(const uint8_t *file, uint32_t buffer_size, DatFile *out) {
+    return dat_file_import_with_allocator(file, buffer_size, 0, NULL, out);
+}
+
+DAT_RET dat_file_import_flags(const uint8_t *file, uint32_t buffer_size, uint32_t flags, DatFile *out) {
+    return dat_file_import_with_allocator(file, buffer_size, flags, NULL, out);
+}
+
+static DAT_RET dat_file_import_with_allocator_inner(
+    const uint8_t *file, uint32_t buffer_size, uint32_t flags,
+    const DatAllocator *allocator, DatFile *out
+) {
+    if (file == NULL) return DAT_ERR_NULL_PARAM;
+    if (out == NULL) return DAT_ERR_NULL_PARAM;
+    dat_file_new_with_allocator(out, allocator);
+
+    if (buffer_size < 0x20) return DAT_ERR_INVALID_SIZE;
+    uint32_t file_size = READ_U32(file);
+    if (file_size < 0x20 || file_size > buffer_size) return DAT_ERR_INVALID_SIZE;
+
+    // One right sized allocation that the tables borrow from, the same as a mapped import.
+    uint8_t *copy = dat_alloc(&out->allocator, file_size);
+    if (copy == NULL) return DAT_ERR_ALLOCATION_FAILURE;
+    DAT_ZONE(zone, "dat_file_import");
+    DAT_ZONE(copy_zone, "copy file");
+    memcpy(copy, file, file_size);
+    DAT_ZONE_END(copy_zone);
+
+    out->mapping = copy;
+    out->mapping_size = file_size;
+    out->flags |= DAT_FILE_ALLOCATED_MAPPING;
+
+    // dat_file_destroy frees the copy on failure.
+    DAT_RET err = dat_file_import_inner(copy, file_size, flags, out);
+    DAT_ZONE_END(zone);
+    return err;
+}
+
+DAT_RET dat_file_import_with_allocator(
+    const uint8_t *file, uint32_t buffer_size, uint32_t flags,
+    const DatAllocator *allocator, DatFile *out
+) {
+    if (file == NULL) return DAT_ERR_NULL_PARAM;
+    if (out == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_STAT_START(start);
+    DAT_RET err = dat_file_import_with_allocator_inner(file, buffer_size, flags, allocator, out);
+    DAT_STAT_END(out, DatStat_Import, start);
+    return err;
+}
+
+static DAT_RET dat_file_import_mapped_inner(const char *path, uint32_t flags, DatFile *out) {
+    if (path == NULL) return DAT_ERR_NULL_PARAM;
+    if (out == NULL) return DAT_ERR_NULL_PARAM;
+    dat_file_new(out);
+
+    uint64_t size;
+    uint8_t *mapping;
+
+    #ifdef _WIN32
+        // No mmap - read the file once into a buffer owned by the DatFile and borrow from that.
+        FILE *f = fopen(path, "rb");
+        if (f == NULL) return DAT_ERR_IO;
+        if (fseek(f, 0, SEEK_END) != 0) { fclose(f); return DAT_ERR_IO; }
+        long ftell_ret = ftell(f);
+        if (ftell_ret < 0 || fseek(f, 0, SEEK_SET) != 0) { fclose(f); return DAT_ERR_IO; }
+        size = (uint64_t)ftell_ret;
+        if (size > UINT32_MAX) { fclose(f); return DAT_ERR_INVALID_SIZE; }
+
+        mapping = dat_alloc(&out->allocator, size ? size : 1);
+        if (mapping == NULL) { fclose(f); return DAT_ERR_ALLOCATION_FAILURE; }
+        if (size != 0 && fread(mapping, size, 1, f) != 1) {
+            dat_free(&out->allocator, mapping, size ? size : 1);
+            fclose(f);
+            return DAT_ERR_IO;
+        }
+        fclose(f);
+        out->flags |= DAT_FILE_ALLOCATED_MAPPING;
+    #else
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) return DAT_ERR_IO;
+
+        struct stat stats;
+        if (fstat(fd, &stats) != 0) { close(fd); return DAT_ERR_IO; }
+        size = (uint64_t)stats.st_size;
+        if (size < 0x20 || size > UINT32_MAX) { close(fd); return DAT_ERR_INVALID_SIZE; }
+
+        // Private and writable, so tables can be byte swapped and sorted in place.
+        // Only the touched pages are copied by the kernel.
+        void *map = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) return DAT_ERR_IO;
+        mapping = map;
+    #endif
+
+    out->mapping = mapping;
+    out->mapping_size = size;
+
+    // dat_file_destroy releases the mapping on failure.
+    DAT_ZONE(zone, "dat_file_import_mapped");
+    DAT_RET err = dat_file_import_inner(mapping, (uint32_t)size, flags, out);
+    DAT_ZONE_END(zone);
+    return err;
+}
+
+DAT_RET dat_file_import_mapped(const char *path, uint32_t flags, DatFile *out) {
+    if (path == NULL) return DAT_ERR_NULL_PARAM;
+    if (out == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_STAT_START(start);
+    DAT_RET err = dat_file_import_mapped_inner(path, flags, out);
+    DAT_STAT_END(out, DatStat_Import, start);
+    return err;
+}
+
+DAT_RET dat_file_open_patch(const char *path, uint32_t flags, DatFile *out) {
+    if (path == NULL) return DAT_ERR_NULL_PARAM;
+    if (out == NULL) return DAT_ERR_NULL_PARAM;
+
+    // Tables are byte swapped and sorted in place, so they must come from a private mapping.
+    DAT_RET err = dat_file_import_mapped(path, flags, out);
+    if (err) return err;
+
+    size_t path_len = strlen(path);
+    out->patch_path = dat_alloc(&out->allocator, path_len + 1);
+    if (out->patch_path == NULL) {
+        dat_file_destroy(out);
+        return DAT_ERR_ALLOCATION_FAILURE;
+    }
+    memcpy(out->patch_path, path, path_len + 1);
+    out->flags |= DAT_FILE_PATCHING;
+
+    #ifndef _WIN32
+        // The data section is never modified by importing, so it can be shared with the file.
+        int fd = open(path, O_RDWR);
+        if (fd < 0) { dat_file_destroy(out); return DAT_ERR_IO; }
+        void *map = mmap(NULL, (size_t)out->mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) { dat_file_destroy(out); return DAT_ERR_IO; }
+        out->patch_mapping = map;
+        if (out->flags & DAT_FILE_BORROWED_DATA)
+            out->data = out->patch_mapping + 0x20;
+    #endif
+
+    return DAT_SUCCESS;
+}
+
+DAT_RET dat_file_sync(DatFile *dat, bool *exported) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    if ((dat->flags & DAT_FILE_PATCHING) == 0) return DAT_ERR_NOT_PATCHING;
+    if (dat->flags & DAT_FILE_BUILDING) return DAT_ERR_NOT_FINALIZED;
+
+    bool in_place = dat->patch_mapping != NULL
+        && dat->data == dat->patch_mapping + 0x20
+        && (dat->flags & DAT_FILE_LAYOUT_CHANGED) == 0;
+    if (exported != NULL) *exported = !in_place;
+
+    if (!in_place)
+        return dat_file_export_path(dat, dat->patch_path);
+
+    #ifndef _WIN32
+        // The kernel only writes back dirty pages.
+        if (msync(dat->patch_mapping, (size_t)dat->mapping_size, MS_SYNC) != 0)
+            return DAT_ERR_IO;
+    #endif
+    return DAT_SUCCESS;
+}
+
+// Copies data out of the patch mapping, so rewriting it in place doesn't reach the file
+// before dat_file_sync exports it.
+static DAT_RET detach_patch_data(DatFile *dat) {
+    if (dat->patch_mapping == NULL || dat->data != dat->patch_mapping + 0x20) return DAT_SUCCESS;
+    if (dat->data_size == 0) return DAT_SUCCESS;
+
+    uint8_t *data = dat_alloc(&dat->allocator, dat->data_size);
+    if (data == NULL) return DAT_ERR_ALLOCATION_FAILURE;
+    memcpy(data, dat->data, dat->data_size);
+    dat->data = data;
+    dat->data_capacity = dat->data_size;
+    dat->flags &= ~(uint32_t)DAT_FILE_BORROWED_DATA;
+    return DAT_SUCCESS;
+}
+
+// THREADS ---------------------------------------------------------
+
+static uint32_t cpu_count(void) {
+    #ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwNumberOfProcessors > 0 ? (uint32_t)info.dwNumberOfProcessors : 1;
+    #else
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        return n > 0 ? (uint32_t)n : 1;
+    #endif
+}
+
+// Returns the value before adding one.
+static inline uint32_t atomic_next(volatile uint32_t *n) {
+    #if defined(_MSC_VER) && !defined(__clang__)
+        return (uint32_t)InterlockedIncrement((volatile LONG*)n) - 1;
+    #else
+        return __atomic_fetch_add(n, 1, __ATOMIC_RELAXED);
+    #endif
+}
+
+// Returns true for the first thread to claim `flag`.
+static inline bool atomic_claim(volatile uint8_t *flag) {
+    #if defined(_MSC_VER) && !defined(__clang__)
+        return *flag == 0 && _InterlockedExchange8((volatile char*)flag, 1) == 0;
+    #else
+        return __atomic_load_n(flag, __ATOMIC_RELAXED) == 0
+            && __atomic_exchange_n(flag, 1, __ATOMIC_RELAXED) == 0;
+    #endif
+}
+
+// Keeps the first error set by any thread.
+static inline void atomic_set_error(volatile DAT_RET *err, DAT_RET value) {
+    #if defined(_MSC_VER) && !defined(__clang__)
+        InterlockedCompareExchange((volatile LONG*)err, (LONG)value, 0);
+    #else
+        DAT_RET expected = DAT_SUCCESS;
+        __atomic_compare_exchange_n(err, &expected, value, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    #endif
+}
+
+static inline DAT_RET atomic_get_error(volatile DAT_RET *err) {
+    #if defined(_MSC_VER) && !defined(__clang__)
+        return *err;
+    #else
+        return __atomic_load_n(err, __ATOMIC_RELAXED);
+    #endif
+}
+
+typedef void (*WorkerFn)(void *ctx, uint32_t worker_i);
+
+typedef struct Worker {
+    WorkerFn fn;
+    void *ctx;
+    uint32_t worker_i;
+} Worker;
+
+#ifdef _WIN32
+    typedef HANDLE WorkerThread;
+    static DWORD WINAPI worker_thread(LPVOID arg) {
+        Worker *w = arg;
+        w->fn(w->ctx, w->worker_i);
+        return 0;
+    }
+#else
+    typedef pthread_t WorkerThread;
+    static void *worker_thread(void *arg) {
+        Worker *w = arg;
+        w->fn(w->ctx, w->worker_i);
+        return NULL;
+    }
+#endif
+
+// Calls `fn` with worker indices 0 to worker_count-1, each on its own thread.
+// Worker 0 runs on the calling thread. Returns once every worker has finished.
+// Workers whose thread fails to start run on the calling thread afterwards.
+static void run_workers(uint32_t worker_count, WorkerFn fn, void *ctx) {
+    // Pick the byte swap implementation before any thread can race to do it.
+    uint32_t prime = 0;
+    dat_be32u_array(&prime, &prime, 0);
+
+    Worker *workers = NULL;
+    WorkerThread *threads = NULL;
+    uint32_t started = 0;
+    if (worker_count > 1) {
+        workers = scratch_alloc(worker_count * sizeof(Worker));
+        threads = scratch_alloc(worker_count * sizeof(WorkerThread));
+    }
+    if (workers != NULL && threads != NULL) {
+        for (; started + 1 < worker_count; ++started) {
+            Worker *w = &workers[started + 1];
+            *w = (Worker) { fn, ctx, started + 1 };
+            #ifdef _WIN32
+                threads[started] = CreateThread(NULL, 0, worker_thread, w, 0, NULL);
+                if (threads[started] == NULL) break;
+            #else
+                if (pthread_create(&threads[started], NULL, worker_thread, w) != 0) break;
+            #endif
+        }
+    }
+
+    fn(ctx, 0);
+    for (uint32_t i = started + 1; i < worker_count; ++i)
+        fn(ctx, i);
+
+    for (uint32_t i = 0; i < started; ++i) {
+        #ifdef _WIN32
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
+        #else
+            pthread_join(threads[i], NULL);
+        #endif
+    }
+    scratch_free(workers);
+    scratch_free(threads);
+}
+
+// PARALLEL IMPORT ---------------------------------------------------
+
+typedef struct ImportManyState {
+    const DatImportSource *sources;
+    DatFile *out;
+    DAT_RET *errors;
+    uint32_t count;
+    uint32_t flags;
+    volatile uint32_t next; // next source to claim
+} ImportManyState;
+
+// Files vary a lot in size, so workers claim one at a time rather than taking fixed ranges.
+static void import_many_worker(void *ctx, uint32_t worker_i) {
+    (void)worker_i;
+    ImportManyState *st = ctx;
+    while (1) {
+        uint32_t i = atomic_next(&st->next);
+        if (i >= st->count) return;
+
+        const DatImportSource *src = &st->sources[i];
+        DatFile *out = &st->out[i];
+        dat_file_new(out);
+        DAT_RET err;
+        if (src->path != NULL)
+            err = dat_file_import_mapped(src->path, st->flags, out);
+        else
+            err = dat_file_import_flags(src->buffer, src->buffer_size, st->flags, out);
+        if (err) dat_file_destroy(out);
+        st->errors[i] = err;
+    }
+}
+
+DAT_RET dat_file_import_many(
+    const DatImportSource *sources, uint32_t count, uint32_t flags, uint32_t thread_count,
+    DatFile *out, DAT_RET *errors
+) {
+    if (count == 0) return DAT_SUCCESS;
+    if (sources == NULL) return DAT_ERR_NULL_PARAM;
+    if (out == NULL) return DAT_ERR_NULL_PARAM;
+    if (errors == NULL) return DAT_ERR_NULL_PARAM;
+
+    if (thread_count == 0) thread_count = cpu_count();
+    if (thread_count > count) thread_count = count;
+
+    ImportManyState st = { sources, out, errors, count, flags, 0 };
+    run_workers(thread_count, import_many_worker, &st);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        if (errors[i]) return errors[i];
+    }
+    return DAT_SUCCESS;
+}
+
+// OBJECT TABLE ----------------------------------------------------
+
+// `objects` and `object_relocs` share one allocation, with object_relocs after every slice.
+static DAT_RET reserve_objects(DatFile *dat, uint32_t count) {
+    uint32_t old_capacity = dat->object_capacity;
+    if (count <= old_capacity) return DAT_SUCCESS;
+    uint32_t capacity = old_capacity * 2;
+    if (capacity < count) capacity = count;
+
+    const size_t ele_size = sizeof(DatSlice) + sizeof(uint32_t);
+    DAT_STAT_GROW(dat, (uint64_t)old_capacity * ele_size);
+    uint8_t *buf = dat_realloc(
+        &dat->allocator, dat->objects,
+        old_capacity * ele_size, capacity * ele_size
+    );
+    if (buf == NULL) return DAT_ERR_ALLOCATION_FAILURE;
+
+    uint32_t *object_relocs = (uint32_t*)(buf + capacity * sizeof(DatSlice));
+    memmove(object_relocs, buf + old_capacity * sizeof(DatSlice), old_capacity * sizeof(uint32_t));
+    dat->objects = (DatSlice*)buf;
+    dat->object_relocs = object_relocs;
+    dat->object_capacity = capacity;
+    return DAT_SUCCESS;
+}
+
+// Recomputes the sizes of objects from `first` on, and of the object before it, whose end moved.
+// Outside builder and edit mode, their first references are recomputed too.
+static void objects_refresh(DatFile *dat, uint32_t first) {
+    uint32_t count = dat->object_count;
+    if (first != 0) first--;
+    if (first >= count) return;
+
+    DatSlice *objects = dat->objects;
+    for (uint32_t i = first; i+1 < count; ++i)
+        objects[i].size = objects[i+1].offset - objects[i].offset;
+    objects[count-1].size = dat->data_size - objects[count-1].offset;
+
+    if (dat->flags & (DAT_FILE_BUILDING | DAT_FILE_EDITING)) return;
+
+    // Relocs and objects are both sorted, so walk them together.
+    uint32_t reloc_i = dat_file_reloc_idx(dat, objects[first].offset);
+    for (uint32_t i = first; i < count; ++i) {
+        while (reloc_i < dat->reloc_count && dat->reloc_targets[reloc_i] < objects[i].offset) reloc_i++;
+        dat->object_relocs[i] = reloc_i;
+    }
+}
+
+static uint32_t binary_search_objects(const DatSlice *objects, uint32_t count, DatRef ref) {
+    if (count == 0) return 0;
+
+    // Branchless, the same as binary_search_refs.
+    const DatSlice *base = objects;
+    while (count > 1) {
+        uint32_t half = count / 2;
+        base = base[half].offset < ref ? base + half : base;
+        count -= half;
+    }
+    return (uint32_t)(base - objects) + (base->offset < ref);
+}
+
+// Returns the index of the object containing `ptr`, or UINT32_MAX if it is before every object.
+// `objects` must be built.
+static uint32_t object_idx_of(const DatFile *dat, DatRef ptr) {
+    uint32_t idx = binary_search_objects(dat->objects, dat->object_count, ptr);
+    if (idx == dat->object_count || dat->objects[idx].offset != ptr) {
+        if (idx == 0) return UINT32_MAX;
+        idx--;
+    }
+    return idx;
+}
+
+static inline uint32_t object_end(const DatFile *dat, uint32_t object_idx) {
+    return dat->objects[object_idx].offset + dat->objects[object_idx].size;
+}
+
+// Positions the iterator at the object's first reference, without searching outside builder and edit mode.
+static inline RelocIter reloc_iter_object(const DatFile *dat, uint32_t object_idx) {
+    if (dat->flags & (DAT_FILE_BUILDING | DAT_FILE_EDITING))
+        return reloc_iter_seek(dat, dat->objects[object_idx].offset);
+    RelocIter it = { dat, 0, dat->object_relocs[object_idx] };
+    return it;
+}
+
+// INCOMING INDEX --------------------------------------------------
+
+// Compressed sparse rows: the slots pointing into object i are slots[firsts[i]..firsts[i+1]],
+// sorted by offset. References pointing before every object are left out.
+struct DatIncomingIndex {
+    uint32_t *firsts;
+    DatRef *slots;
+    uint32_t object_count;
+    uint32_t firsts_capacity;
+    uint32_t slot_count;
+    uint32_t slot_capacity;
+};
+
+static void incoming_index_free(DatIncomingIndex *ix, const DatAllocator *a) {
+    if (ix == NULL) return;
+    dat_free(a, ix->firsts, ix->firsts_capacity * sizeof(uint32_t));
+    dat_free(a, ix->slots, ix->slot_capacity * sizeof(DatRef));
+    dat_free(a, ix, sizeof(DatIncomingIndex));
+}
+
+static void incoming_index_drop(DatFile *dat) {
+    incoming_index_free(dat->incoming_index, &dat->allocator);
+    dat->incoming_index = NULL;
+}
+
+// Counts references per target object, then places each slot by counting sort.
+// Visiting references in order leaves every row sorted. `objects` must be built.
+static DAT_RET incoming_index_build(const DatFile *dat, DatIncomingIndex **out) {
+    uint32_t object_count = dat->object_count;
+    uint32_t reloc_count = dat->reloc_count;
+
+    const DatAllocator *a = &dat->allocator;
+    DatIncomingIndex *ix = dat_alloc(a, sizeof(DatIncomingIndex));
+    uint32_t *target_of = scratch_alloc((reloc_count + 1) * sizeof(uint32_t));
+    if (ix != NULL) {
+        *ix = (DatIncomingIndex) {0};
+        ix->firsts = dat_alloc(a, (object_count + 1) * sizeof(uint32_t));
+        if (ix->firsts != NULL) ix->firsts_capacity = object_count + 1;
+        ix->slots = dat_alloc(a, (reloc_count + 1) * sizeof(DatRef));
+        if (ix->slots != NULL) ix->slot_capacity = reloc_count + 1;
+    }
+    if (ix == NULL || target_of == NULL || ix->firsts == NULL || ix->slots == NULL) {
+        incoming_index_free(ix, a);
+        scratch_free(target_of);
+        return DAT_ERR_ALLOCATION_FAILURE;
+    }
+    memset(ix->firsts, 0, (object_count + 1) * sizeof(uint32_t));
+    ix->object_count = object_count;
+    DAT_ZONE(zone, "build incoming index");
+
+    uint32_t *firsts = ix->firsts;
+    uint32_t reloc_i = 0;
+    RelocIter reloc_iter = reloc_iter_seek(dat, 0);
+    DatRef reloc;
+    while (reloc_iter_next(&reloc_iter, &reloc)) {
+        uint32_t target_i = object_idx_of(dat, READ_U32(&dat->data[reloc]));
+        target_of[reloc_i++] = target_i;
+        if (target_i != UINT32_MAX) firsts[target_i+1]++;
+    }
+    for (uint32_t i = 0; i < object_count; ++i)
+        firsts[i+1] += firsts[i];
+    ix->slot_count = firsts[object_count];
+
+    // firsts[i] is used as row i's cursor, leaving it at the start of row i+1
+    reloc_i = 0;
+    reloc_iter = reloc_iter_seek(dat, 0);
+    while (reloc_iter_next(&reloc_iter, &reloc)) {
+        uint32_t target_i = target_of[reloc_i++];
+        if (target_i != UINT32_MAX) ix->slots[firsts[target_i]++] = reloc;
+    }
+    memmove(&firsts[1], &firsts[0], object_count * sizeof(uint32_t));
+    firsts[0] = 0;
+    DAT_ZONE_END(zone);
+
+    scratch_free(target_of);
+    *out = ix;
+    return DAT_SUCCESS;
+}
+
+// Adds empty rows for objects allocated since the index was built.
+static DAT_RET incoming_index_extend(DatFile *dat, uint32_t object_count) {
+    DatIncomingIndex *ix = dat->incoming_index;
+    while (object_count + 1 > ix->firsts_capacity) {
+        DAT_STAT_GROW(dat, ix->firsts_capacity * sizeof(uint32_t));
+        DAT_RET err = realloc_arr(&dat->allocator, (void **)&ix->firsts, &ix->firsts_capacity, sizeof(uint32_t));
+        if (err) return err;
+    }
+    for (uint32_t i = ix->object_count + 1; i <= object_count; ++i)
+        ix->firsts[i] = ix->slot_count;
+    if (object_count > ix->object_count) ix->object_count = object_count;
+    return DAT_SUCCESS;
+}
+
+static DAT_RET incoming_index_insert(DatFile *dat, uint32_t object_i, DatRef slot) {
+    DatIncomingIndex *ix = dat->incoming_index;
+    if (ix->slot_count == ix->slot_capacity) {
+        DAT_STAT_GROW(dat, ix->slot_capacity * sizeof(DatRef));
+        DAT_RET err = realloc_arr(&dat->allocator, (void **)&ix->slots, &ix->slot_capacity, sizeof(DatRef));
+        if (err) return err;
+    }
+
+    uint32_t first = ix->firsts[object_i];
+    uint32_t pos = first + binary_search_refs(&ix->slots[first], ix->firsts[object_i+1] - first, slot);
+    memmove(&ix->slots[pos+1], &ix->slots[pos], (ix->slot_count - pos) * sizeof(DatRef));
+    DAT_STAT_MOVE(dat, (ix->slot_count - pos) * sizeof(DatRef));
+    ix->slots[pos] = slot;
+    ix->slot_count++;
+    for (uint32_t i = object_i+1; i <= ix->object_count; ++i)
+        ix->firsts[i]++;
+    return DAT_SUCCESS;
+}
+
+static void incoming_index_remove(DatFile *dat, uint32_t object_i, DatRef slot) {
+    DatIncomingIndex *ix = dat->incoming_index;
+    uint32_t first = ix->firsts[object_i];
+    uint32_t pos = first + binary_search_refs(&ix->slots[first], ix->firsts[object_i+1] - first, slot);
+    if (pos == ix->firsts[object_i+1] || ix->slots[pos] != slot) return;
+
+    memmove(&ix->slots[pos], &ix->slots[pos+1], (ix->slot_count - pos - 1) * sizeof(DatRef));
+    DAT_STAT_MOVE(dat, (ix->slot_count - pos - 1) * sizeof(DatRef));
+    ix->slot_count--;
+    for (uint32_t i = object_i+1; i <= ix->object_count; ++i)
+        ix->firsts[i]--;
+}
+
+// Moves `from` to the row of the object containing `to`, before `from` is overwritten.
+// `was_ref` says whether `from` already held a reference. Drops the index if it can't be updated.
+static void incoming_index_retarget(DatFile *dat, DatRef from, bool was_ref, DatRef to) {
+    DatIncomingIndex *ix = dat->incoming_index;
+    if (ix == NULL) return;
+
+    DAT_RET err = incoming_index_extend(dat, dat->object_count);
+    if (err) { incoming_index_drop(dat); return; }
+
+    if (was_ref) {
+        uint32_t old_i = object_idx_of(dat, READ_U32(&dat->data[from]));
+        if (old_i != UINT32_MAX) incoming_index_remove(dat, old_i, from);
+    }
+    uint32_t new_i = object_idx_of(dat, to);
+    if (new_i != UINT32_MAX) {
+        err = incoming_index_insert(dat, new_i, from);
+        if (err) incoming_index_drop(dat);
+    }
+}
+
+// Removes `from` from its row after dat_obj_remove_ref.
+static void incoming_index_unlink(DatFile *dat, DatRef from) {
+    DatIncomingIndex *ix = dat->incoming_index;
+    if (ix == NULL) return;
+    if (incoming_index_extend(dat, dat->object_count)) { incoming_index_drop(dat); return; }
+
+    uint32_t old_i = object_idx_of(dat, READ_U32(&dat->data[from]));
+    if (old_i != UINT32_MAX) incoming_index_remove(dat, old_i, from);
+}
+
+// RELOC BITMAP ----------------------------------------------------
+
+// Words per rank entry. Rank and select popcount at most this many words past a rank entry.
+#define RELOC_RANK_WORDS 4
+
+// Bit i of words[w] is set if the aligned word at (w*64 + i) * 4 is a reference slot.
+struct DatRelocBitmap {
+    uint64_t *words;
+    uint32_t *ranks;        // per RELOC_RANK_WORDS words, set bits in every word before them
+    uint32_t word_count;
+    uint32_t word_capacity;
+    uint32_t slot_count;
+    uint32_t rank_dirty;    // first stale rank entry, RELOC_RANKS_CLEAN if none
+};
+
+#define RELOC_RANKS_CLEAN UINT32_MAX
+
+// Sets ranks[first..rank_count) from ranks[first-1] and the full rank blocks before each.
+static void reloc_ranks_scalar(const uint64_t *words, uint32_t *ranks, uint32_t first, uint32_t rank_count) {
+    uint32_t rank = ranks[first-1];
+    for (uint32_t i = first; i < rank_count; ++i) {
+        const uint64_t *block = &words[(i-1) * RELOC_RANK_WORDS];
+        rank += popcount64(block[0]) + popcount64(block[1]) + popcount64(block[2]) + popcount64(block[3]);
+        ranks[i] = rank;
+    }
+}
+
+#ifdef DAT_BSWAP_X86
+// Counts a rank block per iteration, with a nibble lookup summed by _mm256_sad_epu8.
+DAT_TARGET("avx2")
+static void reloc_ranks_avx2(const uint64_t *words, uint32_t *ranks, uint32_t first, uint32_t rank_count) {
+    const __m256i lut = _mm256_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+    );
+    const __m256i low = _mm256_set1_epi8(0x0F);
+    uint32_t rank = ranks[first-1];
+    for (uint32_t i = first; i < rank_count; ++i) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(const void*)&words[(i-1) * RELOC_RANK_WORDS]);
+        __m256i lo = _mm256_and_si256(v, low);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low);
+        __m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo), _mm256_shuffle_epi8(lut, hi));
+        __m256i sums = _mm256_sad_epu8(bytes, _mm256_setzero_si256());
+        __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+        rank += (uint32_t)_mm_cvtsi128_si32(sum);
+        ranks[i] = rank;
+    }
+}
+#endif
+
+// Recomputes rank entries from the first stale one.
+static void reloc_bitmap_refresh(DatRelocBitmap *bm) {
+    if (bm->rank_dirty == RELOC_RANKS_CLEAN) return;
+    uint32_t rank_count = (bm->word_count + RELOC_RANK_WORDS - 1) / RELOC_RANK_WORDS;
+    uint32_t first = bm->rank_dirty;
+    if (first == 0) {
+        if (rank_count != 0) bm->ranks[0] = 0;
+        first = 1;
+    }
+    if (first < rank_count) {
+        DAT_ZONE(zone, "refresh reloc ranks");
+        #ifdef DAT_BSWAP_X86
+            if (cpu_features()->avx2) reloc_ranks_avx2(bm->words, bm->ranks, first, rank_count);
+            else reloc_ranks_scalar(bm->words, bm->ranks, first, rank_count);
+        #else
+            reloc_ranks_scalar(bm->words, bm->ranks, first, rank_count);
+        #endif
+        DAT_ZONE_END(zone);
+    }
+    bm->rank_dirty = RELOC_RANKS_CLEAN;
+}
+
+static void reloc_bitmap_free(DatRelocBitmap *bm, const DatAllocator *a) {
+    if (bm == NULL) return;
+    dat_free(a, bm->words, bm->word_capacity * sizeof(uint64_t));
+    dat_free(a, bm->ranks, (bm->word_capacity / RELOC_RANK_WORDS) * sizeof(uint32_t));
+    dat_free(a, bm, sizeof(DatRelocBitmap));
+}
+
+static void reloc_bitmap_drop(DatFile *dat) {
+    reloc_bitmap_free(dat->reloc_bitmap, &dat->allocator);
+    dat->reloc_bitmap = NULL;
+}
+
+// Grows the bitmap to cover `data_size` bytes. New words are zero.
+static DAT_RET reloc_bitmap_extend(DatRelocBitmap *bm, const DatAllocator *a, uint32_t data_size) {
+    uint32_t word_count = (uint32_t)(((uint64_t)data_size / 4 + 63) / 64);
+    if (word_count <= bm->word_count) return DAT_SUCCESS;
+
+    if (word_count > bm->word_capacity) {
+        uint32_t capacity = bm->word_capacity * 2;
+        if (capacity < word_count) capacity = word_count;
+        capacity = align_forward(capacity, RELOC_RANK_WORDS);
+
+        // both arrays keep sizes derived from word_capacity, so neither changes unless both grow
+        uint32_t old_capacity = bm->word_capacity;
+        uint64_t *words = dat_alloc(a, capacity * sizeof(uint64_t));
+        uint32_t *ranks = dat_alloc(a, (capacity / RELOC_RANK_WORDS) * sizeof(uint32_t));
+        if (words == NULL || ranks == NULL) {
+            dat_free(a, ranks, (capacity / RELOC_RANK_WORDS) * sizeof(uint32_t));
+            dat_free(a, words, capacity * sizeof(uint64_t));
+            return DAT_ERR_ALLOCATION_FAILURE;
+        }
+        if (old_capacity != 0) {
+            memcpy(words, bm->words, bm->word_count * sizeof(uint64_t));
+            memcpy(ranks, bm->ranks, ((bm->word_count + RELOC_RANK_WORDS - 1) / RELOC_RANK_WORDS) * sizeof(uint32_t));
+        }
+        dat_free(a, bm->ranks, (old_capacity / RELOC_RANK_WORDS) * sizeof(uint32_t));
+        dat_free(a, bm->words, old_capacity * sizeof(uint64_t));
+        bm->words = words;
+        bm->ranks = ranks;
+        bm->word_capacity = capacity;
+    }
+
+    memset(&bm->words[bm->word_count], 0, (word_count - bm->word_count) * sizeof(uint64_t));
+    uint32_t first_rank = (bm->word_count + RELOC_RANK_WORDS - 1) / RELOC_RANK_WORDS;
+    uint32_t rank_count = (word_count + RELOC_RANK_WORDS - 1) / RELOC_RANK_WORDS;
+    for (uint32_t i = first_rank; i < rank_count; ++i)
+        bm->ranks[i] = bm->slot_count;
+    bm->word_count = word_count;
+    return DAT_SUCCESS;
+}
+
+// Sets or clears the bit for `slot`, which must be 4 byte aligned and covered by the bitmap.
+static void reloc_bitmap_set(DatRelocBitmap *bm, DatRef slot, bool set) {
+    uint32_t bit = slot >> 2;
+    uint64_t mask = 1ull << (bit & 63);
+    uint64_t *word = &bm->words[bit >> 6];
+    if (((*word & mask) != 0) == set) return;
+
+    *word ^= mask;
+    // Rank entries after this block are recomputed by the next rank or select.
+    uint32_t first_stale = (bit >> 6) / RELOC_RANK_WORDS + 1;
+    if (first_stale < bm->rank_dirty) bm->rank_dirty = first_stale;
+    bm->slot_count += set ? 1u : (uint32_t)-1;
+}
+
+// Keeps the bitmap in step with dat_obj_set_ref and dat_obj_remove_ref. Drops it if it can't grow.
+static void reloc_bitmap_update(DatFile *dat, DatRef slot, bool set) {
+    DatRelocBitmap *bm = dat->reloc_bitmap;
+    if (bm == NULL) return;
+    if (reloc_bitmap_extend(bm, &dat->allocator, dat->data_size)) { reloc_bitmap_drop(dat); return; }
+    reloc_bitmap_set(bm, slot, set);
+}
+
+DAT_RET dat_file_build_reloc_bitmap(DatFile *dat) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    if (dat->reloc_bitmap != NULL) {
+        DAT_RET err = reloc_bitmap_extend(dat->reloc_bitmap, &dat->allocator, dat->data_size);
+        if (err) return err;
+        reloc_bitmap_refresh(dat->reloc_bitmap);
+        return DAT_SUCCESS;
+    }
+
+    DatRelocBitmap *bm = dat_alloc(&dat->allocator, sizeof(DatRelocBitmap));
+    if (bm == NULL) return DAT_ERR_ALLOCATION_FAILURE;
+    *bm = (DatRelocBitmap) {0};
+    bm->rank_dirty = RELOC_RANKS_CLEAN;
+    DAT_RET err = reloc_bitmap_extend(bm, &dat->allocator, dat->data_size);
+    if (err) { reloc_bitmap_free(bm, &dat->allocator); return err; }
+
+    // Builder mode may hold duplicates, which set the same bit.
+    DAT_ZONE(zone, "build reloc bitmap");
+    RelocIter reloc_iter = reloc_iter_seek(dat, 0);
+    DatRef reloc;
+    while (reloc_iter_next(&reloc_iter, &reloc)) {
+        // import only checks reference slots with DAT_IMPORT_VALIDATE
+        if ((uint64_t)reloc + 4 > dat->data_size) {
+            DAT_ZONE_END(zone);
+            reloc_bitmap_free(bm, &dat->allocator);
+            return DAT_ERR_OUT_OF_BOUNDS;
+        }
+        bm->words[reloc >> 8] |= 1ull << ((reloc >> 2) & 63);
+    }
+
+    // The scatter stays scalar, see reloc_bitmap_refresh for the vectorized count.
+    bm->rank_dirty = 0;
+    reloc_bitmap_refresh(bm);
+    uint32_t rank = 0;
+    uint32_t last_block = bm->word_count == 0 ? 0 : (bm->word_count - 1) / RELOC_RANK_WORDS;
+    if (bm->word_count != 0) rank = bm->ranks[last_block];
+    for (uint32_t w = last_block * RELOC_RANK_WORDS; w < bm->word_count; ++w)
+        rank += popcount64(bm->words[w]);
+    bm->slot_count = rank;
+    DAT_ZONE_END(zone);
+
+    dat->reloc_bitmap = bm;
+    return DAT_SUCCESS;
+}
+
+bool dat_reloc_is_slot(const DatFile *dat, DatRef ptr) {
+    const DatRelocBitmap *bm = dat->reloc_bitmap;
+    uint32_t bit = ptr >> 2;
+    if ((bit >> 6) >= bm->word_count) return false;
+    return (bm->words[bit >> 6] >> (bit & 63)) & 1;
+}
+
+uint32_t dat_reloc_rank(const DatFile *dat, DatRef ptr) {
+    const DatRelocBitmap *bm = dat->reloc_bitmap;
+    if (bm->rank_dirty != RELOC_RANKS_CLEAN) reloc_bitmap_refresh((DatRelocBitmap*)(uintptr_t)bm);
+    uint32_t bit = (uint32_t)(((uint64_t)ptr + 3) >> 2);
+    uint32_t word_i = bit >> 6;
+    if (word_i >= bm->word_count) return bm->slot_count;
+
+    uint32_t rank_i = word_i / RELOC_RANK_WORDS;
+    uint32_t rank = bm->ranks[rank_i];
+    for (uint32_t w = rank_i * RELOC_RANK_WORDS; w < word_i; ++w)
+        rank += popcount64(bm->words[w]);
+    return rank + popcount64(bm->words[word_i] & ((1ull << (bit & 63)) - 1));
+}
+
+DatRef dat_reloc_select(const DatFile *dat, uint32_t rank) {
+    const DatRelocBitmap *bm = dat->reloc_bitmap;
+    if (bm->rank_dirty != RELOC_RANKS_CLEAN) reloc_bitmap_refresh((DatRelocBitmap*)(uintptr_t)bm);
+
+    // last rank entry at or below `rank`
+    uint32_t lo = 0;
+    uint32_t hi = (bm->word_count + RELOC_RANK_WORDS - 1) / RELOC_RANK_WORDS;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (bm->ranks[mid] <= rank) lo = mid; else hi = mid;
+    }
+
+    uint32_t remaining = rank - bm->ranks[lo];
+    uint32_t w = lo * RELOC_RANK_WORDS;
+    uint32_t count;
+    while ((count = popcount64(bm->words[w])) <= remaining) {
+        remaining -= count;
+        w++;
+    }
+
+    uint64_t word = bm->words[w];
+    for (; remaining != 0; --remaining) word &= word - 1;
+    return (w * 64 + ctz64(word)) * 4;
+}
+
+DatRef dat_reloc_next(const DatFile *dat, DatRef ptr) {
+    const DatRelocBitmap *bm = dat->reloc_bitmap;
+    uint32_t bit = (uint32_t)(((uint64_t)ptr + 3) >> 2);
+    uint32_t w = bit >> 6;
+    if (w >= bm->word_count) return UINT32_MAX;
+
+    uint64_t word = bm->words[w] & (~0ull << (bit & 63));
+    while (word == 0) {
+        if (++w == bm->word_count) return UINT32_MAX;
+        word = bm->words[w];
+    }
+    return (w * 64 + ctz64(word)) * 4;
+}
+
+// GRAPH WALKING ---------------------------------------------------
+
+static inline bool graph_visited(const uint8_t *visited, uint32_t object_i) {
+    return (visited[object_i >> 3] >> (object_i & 7)) & 1;
+}
+
+// Marks the object as visited when pushed, so it is pushed at most once.
+static inline void graph_push(DatGraphIter *it, uint32_t object_i) {
+    it->visited[object_i >> 3] |= (uint8_t)(1u << (object_i & 7));
+    it->stack[it->count++] = object_i;
+    // a depth first walk pops this next
+    DAT_PREFETCH(&it->dat->data[it->dat->objects[object_i].offset]);
+}
+
+DAT_RET dat_graph_buffer_sizes(DatFile *dat, uint32_t *visited_size, uint32_t *stack_count) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_RET err = DAT_SUCCESS;
+    if (dat->flags & DAT_FILE_BUILDING)
+        err = dat_file_finalize(dat);
+    if (err) return err;
+    err = dat_file_find_objects(dat);
+    if (err) return err;
+
+    if (visited_size != NULL) *visited_size = (dat->object_count + 7) / 8;
+    if (stack_count != NULL) *stack_count = dat->object_count;
+    return DAT_SUCCESS;
+}
+
+DAT_RET dat_graph_begin(
+    DatGraphIter *it, DatFile *dat, const DatRef *starts, uint32_t start_count, uint32_t flags,
+    uint8_t *visited, uint32_t *stack
+) {
+    if (it == NULL) return DAT_ERR_NULL_PARAM;
+    if (visited == NULL) return DAT_ERR_NULL_PARAM;
+    if (stack == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_RET err = dat_graph_buffer_sizes(dat, NULL, NULL);
+    if (err) return err;
+
+    *it = (DatGraphIter) {
+        .dat = dat,
+        .visited = visited,
+        .stack = stack,
+        .flags = flags,
+        .object_idx = UINT32_MAX,
+    };
+    if ((flags & DAT_GRAPH_KEEP_VISITED) == 0)
+        memset(visited, 0, (dat->object_count + 7) / 8);
+
+    if (starts != NULL) {
+        for (uint32_t i = 0; i < start_count; ++i) {
+            if (starts[i] >= dat->data_size) return DAT_ERR_OUT_OF_BOUNDS;
+            uint32_t object_i = object_idx_of(dat, starts[i]);
+            if (object_i == UINT32_MAX) return DAT_NOT_FOUND;
+            if (!graph_visited(visited, object_i)) graph_push(it, object_i);
+        }
+    } else {
+        // roots and externs pointing before every object are skipped
+        for (uint32_t i = 0; i < dat->root_count + dat->extern_count; ++i) {
+            DatRef ref = i < dat->root_count
+                ? dat->root_info[i].data_offset
+                : dat->extern_info[i - dat->root_count].data_offset;
+            uint32_t object_i = object_idx_of(dat, ref);
+            if (object_i != UINT32_MAX && !graph_visited(visited, object_i)) graph_push(it, object_i);
+        }
+    }
+
+    // A depth first walk pops from the end, so flip the starts to visit them in order.
+    if ((flags & DAT_GRAPH_BFS) == 0) {
+        for (uint32_t i = 0, j = it->count; i + 1 < j; ++i, --j) {
+            uint32_t tmp = stack[i];
+            stack[i] = stack[j-1];
+            stack[j-1] = tmp;
+        }
+    }
+    return DAT_SUCCESS;
+}
+
+bool dat_graph_next_edge(DatGraphIter *it, DatRef *from, DatRef *to) {
+    if (it->object_idx == UINT32_MAX) return false;
+    const DatFile *dat = it->dat;
+
+    RelocIter reloc_iter = { dat, it->reloc_block, it->reloc_i };
+    DatRef reloc;
+    if (!reloc_iter_next(&reloc_iter, &reloc) || reloc >= it->object_end) return false;
+    it->reloc_block = reloc_iter.block_i;
+    it->reloc_i = reloc_iter.i;
+
+    DatRef target = READ_U32(&dat->data[reloc]);
+    uint32_t target_i = object_idx_of(dat, target);
+    if (target_i != UINT32_MAX && !graph_visited(it->visited, target_i))
+        graph_push(it, target_i);
+
+    if (from != NULL) *from = reloc;
+    if (to != NULL) *to = target;
+    return true;
+}
+
+bool dat_graph_next(DatGraphIter *it, DatSlice *out) {
+    // queue whatever the caller didn't follow out of the last object
+    while (dat_graph_next_edge(it, NULL, NULL));
+
+    if (it->head == it->count) {
+        it->object_idx = UINT32_MAX;
+        return false;
+    }
+
+    uint32_t object_i;
+    if (it->flags & DAT_GRAPH_BFS) {
+        object_i = it->stack[it->head++];
+        if (it->head != it->count)
+            DAT_PREFETCH(&it->dat->data[it->dat->objects[it->stack[it->head]].offset]);
+    } else {
+        object_i = it->stack[--it->count];
+    }
+
+    const DatFile *dat = it->dat;
+    RelocIter reloc_iter = reloc_iter_object(dat, object_i);
+    it->object_idx = object_i;
+    it->object_end = object_end(dat, object_i);
+    it->reloc_block = reloc_iter.block_i;
+    it->reloc_i = reloc_iter.i;
+    if (out != NULL) *out = dat->objects[object_i];
+    return true;
+}
+
+// VALIDATION ------------------------------------------------------
+
+// Checks are folded into bitwise ORs and maximums rather than branching per element,
+// so the loops vectorize.
+
+static DAT_RET validate_relocs(const uint8_t *data, uint32_t data_size, const DatRef *relocs, uint32_t count) {
+    if (count == 0) return DAT_SUCCESS;
+
+    uint32_t misaligned = 0;
+    uint32_t max_slot = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        misaligned |= relocs[i];
+        max_slot = relocs[i] > max_slot ? relocs[i] : max_slot;
+    }
+    if (misaligned & 3) return DAT_ERR_INVALID_ALIGNMENT;
+    if ((uint64_t)max_slot + 4 > data_size) return DAT_ERR_OUT_OF_BOUNDS;
+
+    // Slots are known to be in bounds now.
+    uint32_t max_target = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t target = READ_U32(&data[relocs[i]]);
+        max_target = target > max_target ? target : max_target;
+    }
+    if (max_target >= data_size) return DAT_ERR_OUT_OF_BOUNDS;
+    return DAT_SUCCESS;
+}
+
+// `infos` are DatRootInfo or DatExternInfo pairs.
+static DAT_RET validate_infos(
+    const uint32_t *infos, uint32_t count, uint32_t data_size, uint32_t symbol_size,
+    uint32_t *max_symbol
+) {
+    if (count == 0) return DAT_SUCCESS;
+
+    uint32_t misaligned = 0;
+    uint32_t max_offset = 0;
+    uint32_t max_sym = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t offset = infos[i*2];
+        uint32_t sym = infos[i*2+1];
+        misaligned |= offset;
+        max_offset = offset > max_offset ? offset : max_offset;
+        max_sym = sym > max_sym ? sym : max_sym;
+    }
+    if (misaligned & 3) return DAT_ERR_INVALID_ALIGNMENT;
+    if (max_offset >= data_size) return DAT_ERR_OUT_OF_BOUNDS;
+    if (max_sym >= symbol_size) return DAT_ERR_OUT_OF_BOUNDS;
+    if (max_sym > *max_symbol) *max_symbol = max_sym;
+    return DAT_SUCCESS;
+}
+
+static DAT_RET validate(DatFile *dat) {
+    DAT_RET err;
+    if (dat->flags & DAT_FILE_EDITING) {
+        const DatRelocBlocks *rb = dat->reloc_blocks;
+        for (uint32_t i = 0; i < rb->block_count; ++i) {
+            err = validate_relocs(dat->data, dat->data_size, rb->blocks[i], rb->counts[i]);
+            if (err) return err;
+        }
+    } else {
+        err = validate_relocs(dat->data, dat->data_size, dat->reloc_targets, dat->reloc_count);
+        if (err) return err;
+    }
+
+    uint32_t max_symbol = 0;
+    err = validate_infos((const uint32_t*)dat->root_info, dat->root_count, dat->data_size, dat->symbol_size, &max_symbol);
+    if (err) return err;
+    err = validate_infos((const uint32_t*)dat->extern_info, dat->extern_count, dat->data_size, dat->symbol_size, &max_symbol);
+    if (err) return err;
+
+    // A NUL at or after the furthest symbol terminates every symbol before it too.
+    if (dat->root_count + dat->extern_count != 0) {
+        if (memchr(&dat->symbols[max_symbol], 0, dat->symbol_size - max_symbol) == NULL)
+            return DAT_ERR_OUT_OF_BOUNDS;
+    }
+    return DAT_SUCCESS;
+}
+
+DAT_RET dat_file_validate(DatFile *dat) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_ZONE(zone, "dat_file_validate");
+    DAT_STAT_START(start);
+    DAT_RET err = validate(dat);
+    if (err == DAT_SUCCESS)
+        dat->flags |= DAT_FILE_VALIDATED;
+    else
+        dat->flags &= ~(uint32_t)DAT_FILE_VALIDATED;
+    DAT_STAT_END(dat, DatStat_Validate, start);
+    DAT_ZONE_END(zone);
+    return err;
+}
+
+static DAT_RET dat_file_find_objects_inner(DatFile *dat) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    if ((dat->flags & DAT_FILE_OBJECTS_PENDING) == 0) return DAT_SUCCESS;
+
+    // Objects allocated since import are already in the list and are kept.
+    uint32_t allocated_count = dat->object_count;
+    DAT_RET err = reserve_objects(dat, allocated_count + dat->reloc_count + dat->root_count + dat->extern_count);
+    if (err) return err;
+    DAT_ZONE(zone, "dat_file_find_objects");
+
+    // Offsets are gathered and sorted in object_relocs, which is filled in last.
+    DatRef *offsets = dat->object_relocs;
+    for (uint32_t i = 0; i < allocated_count; ++i)
+        offsets[i] = dat->objects[i].offset;
+
+    // find all refs
+    uint32_t object_i = allocated_count;
+    RelocIter reloc_iter = reloc_iter_seek(dat, 0);
+    DatRef reloc;
+    while (reloc_iter_next(&reloc_iter, &reloc))
+        offsets[object_i++] = READ_U32(&dat->data[reloc]);
+    for (uint32_t i = 0; i < dat->root_count; ++i)
+        offsets[object_i++] = dat->root_info[i].data_offset;
+    for (uint32_t i = 0; i < dat->extern_count; ++i)
+        offsets[object_i++] = dat->extern_info[i].data_offset;
+    
+    // sort and deduplicate refs
+    uint8_t *sort_tmp = NULL;
+    if (object_i >= RADIX_SORT_MIN) {
+        sort_tmp = scratch_alloc(object_i * sizeof(DatRef));
+        if (sort_tmp == NULL) { DAT_ZONE_END(zone); return DAT_ERR_ALLOCATION_FAILURE; }
+    }
+    uint32_t object_count = sort_by_key((uint8_t*)offsets, sort_tmp, object_i, sizeof(DatRef), true);
+    scratch_free(sort_tmp);
+
+    for (uint32_t i = 0; i < object_count; ++i)
+        dat->objects[i].offset = offsets[i];
+    dat->object_count = object_count;
+    objects_refresh(dat, 0);
+    dat->flags &= ~(uint32_t)DAT_FILE_OBJECTS_PENDING;
+    DAT_ZONE_END(zone);
+
+    return DAT_SUCCESS;
+}
+
+DAT_RET dat_file_find_objects(DatFile *dat) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    if ((dat->flags & DAT_FILE_OBJECTS_PENDING) == 0) return DAT_SUCCESS;
+    DAT_STAT_START(start);
+    DAT_RET err = dat_file_find_objects_inner(dat);
+    DAT_STAT_END(dat, DatStat_FindObjects, start);
+    return err;
+}
+
+uint32_t dat_file_export_max_size(const DatFile *dat) {
+    uint32_t size = 0x20;
+    size += dat->data_size;
+    size += (uint32_t)(dat->reloc_count * sizeof(DatRef));
+    size += (uint32_t)(dat->root_count * sizeof(DatRootInfo));
+    size += (uint32_t)(dat->extern_count * sizeof(DatExternInfo));
+    size += dat->symbol_size;
+    return size;
+}
+
+// Root, extern and symbol tables as they will be exported.
+typedef struct ExportSymbols {
+    const DatRootInfo *root_info;
+    const DatExternInfo *extern_info;
+    const char *symbols;
+    uint32_t symbol_size;
+    void *alloc; // NULL if these point into `dat`
+} ExportSymbols;
+
+// Drops symbol strings that no root or extern refers to, such as the names of removed roots.
+// Points straight at the file's tables if nothing would be dropped.
+static DAT_RET export_symbols_prepare(const DatFile *dat, ExportSymbols *out) {
+    *out = (ExportSymbols) { dat->root_info, dat->extern_info, dat->symbols, dat->symbol_size, NULL };
+
+    uint32_t root_count = dat->root_count;
+    uint32_t extern_count = dat->extern_count;
+    uint32_t count = root_count + extern_count;
+    if (count == 0 && dat->symbol_size == 0) return DAT_SUCCESS;
+
+    // sorted unique offsets of used symbols
+    DatRef *used = scratch_alloc((count + 1) * sizeof(DatRef) * 2);
+    if (used == NULL) return DAT_ERR_ALLOCATION_FAILURE;
+    for (uint32_t i = 0; i < root_count; ++i)
+        used[i] = dat->root_info[i].symbol_offset;
+    for (uint32_t i = 0; i < extern_count; ++i)
+        used[root_count + i] = dat->extern_info[i].symbol_offset;
+    uint32_t used_count = sort_by_key((uint8_t*)used, (uint8_t*)&used[count + 1], count, sizeof(DatRef), true);
+
+    uint32_t used_size = 0;
+    for (uint32_t i = 0; i < used_count; ++i)
+        used_size += (uint32_t)strlen(&dat->symbols[used[i]]) + 1;
+
+    // Strings sharing a suffix can overlap, so only compact when it actually shrinks the table.
+    if (used_size >= dat->symbol_size) {
+        scratch_free(used);
+        return DAT_SUCCESS;
+    }
+
+    uint32_t root_bytes = root_count * (uint32_t)sizeof(DatRootInfo);
+    uint32_t extern_bytes = extern_count * (uint32_t)sizeof(DatExternInfo);
+    uint8_t *alloc = scratch_alloc(root_bytes + extern_bytes + used_size + (used_count + 1) * sizeof(SymbolRef));
+    if (alloc == NULL) {
+        scratch_free(used);
+        return DAT_ERR_ALLOCATION_FAILURE;
+    }
+    DatRootInfo *root_info = (DatRootInfo*)alloc;
+    DatExternInfo *extern_info = (DatExternInfo*)(alloc + root_bytes);
+    SymbolRef *new_offsets = (SymbolRef*)(alloc + root_bytes + extern_bytes);
+    char *symbols = (char*)&new_offsets[used_count + 1];
+
+    uint32_t symbol_size = 0;
+    for (uint32_t i = 0; i < used_count; ++i) {
+        const char *symbol = &dat->symbols[used[i]];
+        uint32_t len = (uint32_t)strlen(symbol) + 1;
+        memcpy(&symbols[symbol_size], symbol, len);
+        new_offsets[i] = symbol_size;
+        symbol_size += len;
+    }
+
+    for (uint32_t i = 0; i < root_count; ++i) {
+        uint32_t used_i = binary_search_refs(used, used_count, dat->root_info[i].symbol_offset);
+        root_info[i] = (DatRootInfo) { dat->root_info[i].data_offset, new_offsets[used_i] };
+    }
+    for (uint32_t i = 0; i < extern_count; ++i) {
+        uint32_t used_i = binary_search_refs(used, used_count, dat->extern_info[i].symbol_offset);
+        extern_info[i] = (DatExternInfo) { dat->extern_info[i].data_offset, new_offsets[used_i] };
+    }
+
+    scratch_free(used);
+    *out = (ExportSymbols) { root_info, extern_info, symbols, symbol_size, alloc };
+    return DAT_SUCCESS;
+}
+
+static DAT_RET dat_file_export_inner(const DatFile *dat, uint8_t *out, uint32_t *size) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    if (out == NULL) return DAT_ERR_NULL_PARAM;
+    if (size == NULL) return DAT_ERR_NULL_PARAM;
+    if (dat->flags & DAT_FILE_BUILDING) return DAT_ERR_NOT_FINALIZED;
+    DAT_ZONE(zone, "dat_file_export");
+
+    WRITE_U32(out+4,  dat->data_size);
+    WRITE_U32(out+8,  dat->reloc_count);
+    WRITE_U32(out+12, dat->root_count);
+    WRITE_U32(out+16, dat->extern_count);
+    memset(out+20, 0, 12); // hsdraw zeroes version and padding
+
+    ExportSymbols sym;
+    DAT_RET err = export_symbols_prepare(dat, &sym);
+    if (err) { DAT_ZONE_END(zone); return err; }
+
+    uint8_t *cursor = out + 0x20;
+
+    uint32_t data_size = dat->data_size;
+    if (dat->data != NULL) memcpy(cursor, dat->data, data_size);
+    cursor += data_size;
+
+    if (dat->flags & DAT_FILE_EDITING) {
+        const DatRelocBlocks *rb = dat->reloc_blocks;
+        for (uint32_t i = 0; i < rb->block_count; ++i) {
+            dat_be32u_array(cursor, rb->blocks[i], rb->counts[i]);
+            cursor += rb->counts[i] * sizeof(DatRef);
+        }
+    } else {
+        dat_be32u_array(cursor, dat->reloc_targets, dat->reloc_count);
+        cursor += dat->reloc_count * sizeof(DatRef);
+    }
+
+    dat_be32u_array(cursor, sym.root_info, dat->root_count * 2);
+    cursor += dat->root_count * sizeof(DatRootInfo);
+
+    dat_be32u_array(cursor, sym.extern_info, dat->extern_count * 2);
+    cursor += dat->extern_count * sizeof(DatExternInfo);
+
+    uint32_t symbol_size = sym.symbol_size;
+    if (sym.symbols != NULL) memcpy(cursor, sym.symbols, symbol_size);
+    cursor += symbol_size;
+    scratch_free(sym.alloc);
+
+    uint32_t file_size = (uint32_t)(cursor - out);
+    WRITE_U32(out, file_size);
+
+    *size = (size_t)file_size;
+    DAT_ZONE_END(zone);
+    return DAT_SUCCESS;
+}
+
+DAT_RET dat_file_export(const DatFile *dat, uint8_t *out, uint32_t *size) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_STAT_START(start);
+    DAT_RET err = dat_file_export_inner(dat, out, size);
+    DAT_STAT_END(dat, DatStat_Export, start);
+    return err;
+}
+
+// Byte swapped tables are staged through a buffer of this size when streaming.
+#define EXPORT_STAGING_SIZE 0x10000
+
+typedef struct ExportChunk {
+    const void *base;
+    size_t len;
+} ExportChunk;
+
+// Writes every chunk in order, retrying partial writes.
+static DAT_RET write_chunks(int fd, ExportChunk *chunks, uint32_t chunk_count) {
+    #ifdef _WIN32
+        for (uint32_t i = 0; i < chunk_count; ++i) {
+            const uint8_t *base = chunks[i].base;
+            size_t len = chunks[i].len;
+            while (len != 0) {
+                unsigned int to_write = len > 0x40000000 ? 0x40000000 : (unsigned int)len;
+                int written = _write(fd, base, to_write);
+                if (written <= 0) return DAT_ERR_IO;
+                base += written;
+                len -= (size_t)written;
+            }
+        }
+    #else
+        struct iovec iov[8];
+        uint32_t iov_count = 0;
+        for (uint32_t i = 0; i < chunk_count; ++i) {
+            if (chunks[i].len == 0) continue;
+            iov[iov_count].iov_base = (void*)(uintptr_t)chunks[i].base;
+            iov[iov_count].iov_len = chunks[i].len;
+            iov_count++;
+        }
+
+        struct iovec *cur = iov;
+        while (iov_count != 0) {
+            ssize_t written = writev(fd, cur, (int)iov_count);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return DAT_ERR_IO;
+            }
+
+            size_t remaining = (size_t)written;
+            while (iov_count != 0 && remaining >= cur->iov_len) {
+                remaining -= cur->iov_len;
+                cur++;
+                iov_count--;
+            }
+            if (iov_count != 0) {
+                cur->iov_base = (uint8_t*)cur->iov_base + remaining;
+                cur->iov_len -= remaining;
+            }
+        }
+    #endif
+
+    return DAT_SUCCESS;
+}
+
+typedef struct ExportStaging {
+    int fd;
+    uint8_t *buffer;
+    uint32_t staged;    // u32s in buffer
+} ExportStaging;
+
+// Swaps `count` u32s into the staging buffer, writing it out whenever it fills.
+static DAT_RET stage_u32s(ExportStaging *st, const uint32_t *src, uint32_t count) {
+    const uint32_t staging_count = EXPORT_STAGING_SIZE / sizeof(uint32_t);
+    while (count != 0) {
+        uint32_t n = staging_count - st->staged;
+        if (n > count) n = count;
+        dat_be32u_array(st->buffer + st->staged * sizeof(uint32_t), src, n);
+        st->staged += n;
+        src += n;
+        count -= n;
+
+        if (st->staged == staging_count) {
+            ExportChunk chunk = { st->buffer, EXPORT_STAGING_SIZE };
+            DAT_RET err = write_chunks(st->fd, &chunk, 1);
+            st->staged = 0;
+            if (err) return err;
+        }
+    }
+    return DAT_SUCCESS;
+}
+
+static DAT_RET dat_file_export_fd_inner(const DatFile *dat, int fd) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    if (dat->flags & DAT_FILE_BUILDING) return DAT_ERR_NOT_FINALIZED;
 
-    // external ref table ----------
+    ExportSymbols sym;
+    DAT_RET err = export_symbols_prepare(dat, &sym);
+    if (err) return err;
 
-    uint32_t extern_offset = root_offset + root_size;
-    uint32_t extern_size = extern_count * sizeof(DatExternInfo);
-    out->extern_count = extern_count;
-    out->extern_capacity = extern_count; // unlikely to increase
-    out->extern_info = malloc(out->extern_capacity * sizeof(DatExternInfo));
-    if (out->extern_info == NULL) { dat_file_destroy(out); return DAT_ERR_ALLOCATION_FAILURE; }
-    memcpy(out->extern_info, file + extern_offset, extern_size);
-    for (uint32_t i = 0; i < extern_count; ++i) {
-        out->extern_info[i].data_offset = dat_be32u(out->extern_info[i].data_offset);
-        out->extern_info[i].symbol_offset = dat_be32u(out->extern_info[i].symbol_offset);
+    uint32_t file_size = dat_file_export_max_size(dat) - dat->symbol_size + sym.symbol_size;
+    uint32_t header[8] = {
+        dat_be32u(file_size),
+        dat_be32u(dat->data_size),
+        dat_be32u(dat->reloc_count),
+        dat_be32u(dat->root_count),
+        dat_be32u(dat->extern_count),
+        0, 0, 0, // hsdraw zeroes version and padding
+    };
+
+    uint8_t *staging = scratch_alloc(EXPORT_STAGING_SIZE);
+    if (staging == NULL) {
+        scratch_free(sym.alloc);
+        return DAT_ERR_ALLOCATION_FAILURE;
     }
-    qsort(out->extern_info, extern_count, sizeof(DatExternInfo), extern_cmp);
 
-    // symbol table -----------------
+    // header and data go out together
+    ExportChunk chunks[2] = {
+        { header, sizeof(header) },
+        { dat->data, dat->data_size },
+    };
+    err = write_chunks(fd, chunks, 2);
 
-    uint32_t symbol_offset = extern_offset + extern_size;
-    uint32_t symbol_size = file_size - symbol_offset;
-    out->symbol_size = symbol_size;
-    out->symbol_capacity = symbol_size * 2;
-    out->symbols = malloc(out->symbol_capacity);
-    if (out->symbols == NULL) { dat_file_destroy(out); return DAT_ERR_ALLOCATION_FAILURE; }
-    memcpy(out->symbols, file + symbol_offset, symbol_size);
-    
-    // find objects -----------------
+    // The tables are contiguous in the file, so treat them as one stream of u32s.
+    ExportStaging st = { fd, staging, 0 };
+    if (dat->flags & DAT_FILE_EDITING) {
+        const DatRelocBlocks *rb = dat->reloc_blocks;
+        for (uint32_t i = 0; i < rb->block_count && err == DAT_SUCCESS; ++i)
+            err = stage_u32s(&st, rb->blocks[i], rb->counts[i]);
+    } else if (err == DAT_SUCCESS) {
+        err = stage_u32s(&st, dat->reloc_targets, dat->reloc_count);
+    }
+    if (err == DAT_SUCCESS)
+        err = stage_u32s(&st, (const uint32_t*)sym.root_info, dat->root_count * 2);
+    if (err == DAT_SUCCESS)
+        err = stage_u32s(&st, (const uint32_t*)sym.extern_info, dat->extern_count * 2);
+    uint32_t staged = st.staged;
 
-    // find all refs
-    out->object_capacity = out->reloc_count + out->root_count + out->extern_count;  
-    out->objects = malloc(sizeof(DatRef) * out->object_capacity);
-    
-    uint32_t object_i = 0;
-    for (uint32_t i = 0; i < out->reloc_count; ++i)
-        out->objects[object_i++] = READ_U32(&out->data[out->reloc_targets[i]]);
-    for (uint32_t i = 0; i < out->root_count; ++i)
-        out->objects[object_i++] = out->root_info[i].data_offset;
-    for (uint32_t i = 0; i < out->extern_count; ++i)
-        out->objects[object_i++] = out->extern_info[i].data_offset;
-    qsort(out->objects, object_i, sizeof(DatRef), reloc_cmp);
-    
-    // deduplicate refs
-    DatRef last_ref = 0xFFFFFFFF;
-    uint32_t head_i = 0; 
-    uint32_t base_i = 0;
-    while (head_i < object_i) {
-        DatRef obj = out->objects[head_i];
-        if (obj != last_ref) {
-            out->objects[base_i++] = obj;
-            last_ref = obj;
-        }
-        head_i++; 
+    // last staged tables and symbols go out together
+    if (err == DAT_SUCCESS) {
+        ExportChunk tail[2] = {
+            { staging, staged * sizeof(uint32_t) },
+            { sym.symbols, sym.symbol_size },
+        };
+        err = write_chunks(fd, tail, 2);
     }
-    out->object_count = base_i; 
 
-    return DAT_SUCCESS;
+    scratch_free(staging);
+    scratch_free(sym.alloc);
+    return err;
 }
 
-uint32_t dat_file_export_max_size(const DatFile *dat) {
-    uint32_t size = 0x20;
-    size += dat->data_size;
-    size += (uint32_t)(dat->reloc_count * sizeof(DatRef));
-    size += (uint32_t)(dat->root_count * sizeof(DatRootInfo));
-    size += (uint32_t)(dat->extern_count * sizeof(DatExternInfo));
-    size += dat->symbol_size;
-    return size;
+DAT_RET dat_file_export_fd(const DatFile *dat, int fd) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_STAT_START(start);
+    DAT_RET err = dat_file_export_fd_inner(dat, fd);
+    DAT_STAT_END(dat, DatStat_Export, start);
+    return err;
 }
 
-DAT_RET dat_file_export(const DatFile *dat, uint8_t *out, uint32_t *size) {
+DAT_RET dat_file_export_path(const DatFile *dat, const char *path) {
     if (dat == NULL) return DAT_ERR_NULL_PARAM;
-    if (out == NULL) return DAT_ERR_NULL_PARAM;
-    if (size == NULL) return DAT_ERR_NULL_PARAM;
-
-    WRITE_U32(out+4,  dat->data_size);
-    WRITE_U32(out+8,  dat->reloc_count);
-    WRITE_U32(out+12, dat->root_count);
-    WRITE_U32(out+16, dat->extern_count);
-    memset(out+20, 0, 12); // hsdraw zeroes version and padding
-
-    uint8_t *cursor = out + 0x20;
+    if (path == NULL) return DAT_ERR_NULL_PARAM;
+    if (dat->flags & DAT_FILE_BUILDING) return DAT_ERR_NOT_FINALIZED;
 
-    uint32_t data_size = dat->data_size;
-    if (dat->data != NULL) memcpy(cursor, dat->data, data_size);
-    cursor += data_size;
+    // Write next to the destination and rename over it, so exporting
+    // a file imported with dat_file_import_mapped back to its own path is safe.
+    size_t path_len = strlen(path);
+    char *tmp_path = scratch_alloc(path_len + 5);
+    if (tmp_path == NULL) return DAT_ERR_ALLOCATION_FAILURE;
+    memcpy(tmp_path, path, path_len);
+    memcpy(tmp_path + path_len, ".tmp", 5);
 
-    for (uint32_t i = 0; i < dat->reloc_count; ++i) {
-        WRITE_U32(cursor, dat->reloc_targets[i]);
-        cursor += sizeof(DatRef);
-    }
+    #ifdef _WIN32
+        int fd = _open(tmp_path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+    #else
+        int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    #endif
+    if (fd < 0) { scratch_free(tmp_path); return DAT_ERR_IO; }
 
-    for (uint32_t i = 0; i < dat->root_count; ++i) {
-        WRITE_U32(cursor, dat->root_info[i].data_offset);
-        cursor += sizeof(uint32_t);
-        WRITE_U32(cursor, dat->root_info[i].symbol_offset);
-        cursor += sizeof(uint32_t);
-    }
+    DAT_ZONE(zone, "dat_file_export_path");
+    DAT_RET err = dat_file_export_fd(dat, fd);
 
-    for (uint32_t i = 0; i < dat->extern_count; ++i) {
-        WRITE_U32(cursor, dat->extern_info[i].data_offset);
-        cursor += sizeof(uint32_t);
-        WRITE_U32(cursor, dat->extern_info[i].symbol_offset);
-        cursor += sizeof(uint32_t);
-    }
+    // The old file is only replaced once the new one is complete.
+    #ifdef _WIN32
+        if (_close(fd) != 0 && err == DAT_SUCCESS) err = DAT_ERR_IO;
+        // rename doesn't replace existing files here
+        if (err == DAT_SUCCESS && !MoveFileExA(tmp_path, path, MOVEFILE_REPLACE_EXISTING))
+            err = DAT_ERR_IO;
+    #else
+        if (close(fd) != 0 && err == DAT_SUCCESS) err = DAT_ERR_IO;
+        if (err == DAT_SUCCESS && rename(tmp_path, path) != 0)
+            err = DAT_ERR_IO;
+    #endif
 
-    uint32_t symbol_size = dat->symbol_size;
-    if (dat->symbols != NULL) memcpy(cursor, dat->symbols, symbol_size);
-    cursor += symbol_size;
+    if (err != DAT_SUCCESS)
+        remove(tmp_path);
+    DAT_ZONE_END(zone);
 
-    uint32_t file_size = (uint32_t)(cursor - out);
-    WRITE_U32(out, file_size);
+    scratch_free(tmp_path);
+    return err;
+}
 
-    *size = (size_t)file_size;
+DAT_RET dat_file_new(DatFile *dat) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    *dat = (DatFile) {0};
     return DAT_SUCCESS;
 }
 
-DAT_RET dat_file_new(DatFile *dat) {
+DAT_RET dat_file_new_with_allocator(DatFile *dat, const DatAllocator *allocator) {
     if (dat == NULL) return DAT_ERR_NULL_PARAM;
     *dat = (DatFile) {0};
+    if (allocator != NULL) dat->allocator = *allocator;
     return DAT_SUCCESS;
 }
 
 DAT_RET dat_file_destroy(DatFile *dat) {
     if (dat == NULL) return DAT_ERR_NULL_PARAM;
 
-    free(dat->data);
-    free(dat->reloc_targets);
-    free(dat->root_info);
-    free(dat->extern_info);
-    free(dat->symbols);
-    free(dat->objects);
+    uint32_t flags = dat->flags;
+    const DatAllocator *a = &dat->allocator;
+    if ((flags & DAT_FILE_BORROWED_DATA) == 0)
+        dat_free(a, dat->data, dat->data_capacity);
+    if ((flags & DAT_FILE_BORROWED_RELOCS) == 0)
+        dat_free(a, dat->reloc_targets, dat->reloc_capacity * sizeof(DatRef));
+    if ((flags & DAT_FILE_BORROWED_ROOTS) == 0)
+        dat_free(a, dat->root_info, dat->root_capacity * sizeof(DatRootInfo));
+    if ((flags & DAT_FILE_BORROWED_EXTERNS) == 0)
+        dat_free(a, dat->extern_info, dat->extern_capacity * sizeof(DatExternInfo));
+    if ((flags & DAT_FILE_BORROWED_SYMBOLS) == 0)
+        dat_free(a, dat->symbols, dat->symbol_capacity);
+    dat_free(a, dat->objects, dat->object_capacity * (sizeof(DatSlice) + sizeof(uint32_t)));
+    reloc_blocks_free(dat->reloc_blocks, a);
+    name_index_free(dat->root_index, a);
+    name_index_free(dat->extern_index, a);
+    name_index_free(dat->symbol_set, a);
+    incoming_index_free(dat->incoming_index, a);
+    reloc_bitmap_free(dat->reloc_bitmap, a);
+
+    if (flags & DAT_FILE_ALLOCATED_MAPPING) {
+        dat_free(a, dat->mapping, (size_t)dat->mapping_size);
+    } else if (dat->mapping != NULL) {
+        #ifndef _WIN32
+            munmap(dat->mapping, (size_t)dat->mapping_size);
+        #endif
+    }
+    #ifndef _WIN32
+        if (dat->patch_mapping != NULL)
+            munmap(dat->patch_mapping, (size_t)dat->mapping_size);
+    #endif
+    if (dat->patch_path != NULL)
+        dat_free(a, dat->patch_path, strlen(dat->patch_path) + 1);
+
     dat_file_new(dat);
 
     return DAT_SUCCESS;
@@ -230,6 +2616,8 @@ DAT_RET dat_file_destroy(DatFile *dat) {
 
 DAT_RET dat_file_debug_print(DatFile *dat) {
     if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_RET err = dat_file_find_objects(dat);
+    if (err) return err;
 
     printf("DEBUG DAT @ %p:\n", (void*)dat);
     printf("MEMBER data          %p\n", (void*)dat->data         );
@@ -238,6 +2626,7 @@ DAT_RET dat_file_debug_print(DatFile *dat) {
     printf("MEMBER extern_info   %p\n", (void*)dat->extern_info  );
     printf("MEMBER symbols       %p\n", (void*)dat->symbols      );
     printf("MEMBER objects       %p\n", (void*)dat->objects      );
+    printf("MEMBER object_relocs %p\n", (void*)dat->object_relocs);
 
     printf("MEMBER data_size       %u\n", dat->data_size      );
     printf("MEMBER reloc_count     %u\n", dat->reloc_count    );
@@ -253,6 +2642,10 @@ DAT_RET dat_file_debug_print(DatFile *dat) {
     printf("MEMBER symbol_capacity %u\n", dat->symbol_capacity);
     printf("MEMBER object_capacity %u\n", dat->object_capacity);
 
+    printf("MEMBER mapping         %p\n", dat->mapping        );
+    printf("MEMBER mapping_size    %lu\n", (unsigned long)dat->mapping_size);
+    printf("MEMBER flags           %x\n", dat->flags          );
+
     for (uint32_t i = 0; i < dat->root_count; ++i) {
         DatRootInfo info = dat->root_info[i];
         printf("ROOT %06x %s\n", info.data_offset, &dat->symbols[info.symbol_offset]);
@@ -264,58 +2657,665 @@ DAT_RET dat_file_debug_print(DatFile *dat) {
     }
     
     for (uint32_t i = 0; i < dat->object_count; ++i) {
-        DatRef object = dat->objects[i];
-        DatRef end;
-        if (i+1 < dat->object_count) 
-            end = dat->objects[i+1];
-        else
-            end = dat->data_size;
-        printf("OBJECT %06x (%u)\n", object, end-object);
+        DatSlice object = dat->objects[i];
+        printf("OBJECT %06x (%u)\n", object.offset, object.size);
+    }
+
+    #ifdef DAT_STATS
+        dat_file_print_stats(dat);
+    #endif
+
+    return DAT_SUCCESS;
+}
+
+#ifdef DAT_STATS
+static const char *const stat_op_names[DatStat_Count] = {
+    [DatStat_Import]      = "import",
+    [DatStat_Export]      = "export",
+    [DatStat_FindObjects] = "find_objects",
+    [DatStat_Validate]    = "validate",
+    [DatStat_Finalize]    = "finalize",
+    [DatStat_BeginEdit]   = "begin_edit",
+    [DatStat_Compact]     = "compact",
+    [DatStat_Dedup]       = "dedup",
+    [DatStat_ObjAlloc]    = "obj_alloc",
+    [DatStat_SetRef]      = "set_ref",
+    [DatStat_RemoveRef]   = "remove_ref",
+    [DatStat_Incoming]    = "incoming",
+    [DatStat_RootAdd]     = "root_add",
+    [DatStat_RootRemove]  = "root_remove",
+    [DatStat_Copy]        = "copy",
+    [DatStat_CopyMany]    = "copy_many",
+    [DatStat_Read]        = "read",
+    [DatStat_Write]       = "write",
+    [DatStat_ObjLookup]   = "obj_lookup",
+    [DatStat_NameLookup]  = "name_lookup",
+};
+
+void dat_file_print_stats(const DatFile *dat) {
+    const DatStats *st = &dat->stats;
+
+    for (uint32_t op = 0; op < DatStat_Count; ++op) {
+        if (st->calls[op] == 0) continue;
+        printf("STAT %-12s %10llu calls", stat_op_names[op], (unsigned long long)st->calls[op]);
+        if (op >= DatStat_Read) {
+            printf("\n");
+            continue;
+        }
+        printf(" %12.3f ms total %10.3f us mean\n",
+            (double)st->time_ns[op] / 1e6,
+            (double)st->time_ns[op] / 1e3 / (double)st->calls[op]);
+
+        // Only the buckets that were hit, each labelled by its upper bound.
+        printf("     latency <");
+        for (uint32_t b = 0; b < DAT_STAT_BUCKETS; ++b) {
+            if (st->latency[op][b] == 0) continue;
+            uint64_t bound = 2ull << b;
+            if (bound < 1000)
+                printf(" %lluns:%llu", (unsigned long long)bound, (unsigned long long)st->latency[op][b]);
+            else if (bound < 1000000)
+                printf(" %lluus:%llu", (unsigned long long)(bound / 1000), (unsigned long long)st->latency[op][b]);
+            else
+                printf(" %llums:%llu", (unsigned long long)(bound / 1000000), (unsigned long long)st->latency[op][b]);
+        }
+        printf("\n");
+    }
+
+    printf("STAT moved bytes   %llu\n", (unsigned long long)st->moved_bytes);
+    printf("STAT grows         %llu (%llu bytes copied)\n",
+        (unsigned long long)st->grow_count, (unsigned long long)st->grown_bytes);
+    printf("STAT searches      %llu (%llu missed)\n",
+        (unsigned long long)st->search_count, (unsigned long long)st->search_misses);
+    if (st->search_count) {
+        printf("     probes");
+        for (uint32_t d = 0; d < sizeof(st->search_depth) / sizeof(st->search_depth[0]); ++d) {
+            if (st->search_depth[d])
+                printf(" %u:%llu", d, (unsigned long long)st->search_depth[d]);
+        }
+        printf("\n");
+    }
+    printf("STAT name misses   %llu\n", (unsigned long long)st->name_misses);
+}
+
+void dat_file_reset_stats(DatFile *dat) {
+    memset(&dat->stats, 0, sizeof(dat->stats));
+}
+#endif
+
+DAT_RET dat_file_begin_build(DatFile *dat) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    if (dat->flags & DAT_FILE_EDITING) {
+        DAT_RET err = dat_file_finalize(dat);
+        if (err) return err;
+    }
+    // Builder mode doesn't look up existing references, so can't keep it up to date.
+    incoming_index_drop(dat);
+    dat->flags |= DAT_FILE_BUILDING;
+    return DAT_SUCCESS;
+}
+
+static DAT_RET dat_file_begin_edit_inner(DatFile *dat) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    if (dat->flags & DAT_FILE_EDITING) return DAT_SUCCESS;
+    DAT_RET err = dat_file_finalize(dat);
+    if (err) return err;
+
+    err = reloc_blocks_from_sorted(&dat->allocator, dat->reloc_targets, dat->reloc_count, &dat->reloc_blocks);
+    if (err) return err;
+
+    dat->flags |= DAT_FILE_EDITING;
+    return DAT_SUCCESS;
+}
+
+DAT_RET dat_file_begin_edit(DatFile *dat) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_STAT_START(start);
+    DAT_RET err = dat_file_begin_edit_inner(dat);
+    DAT_STAT_END(dat, DatStat_BeginEdit, start);
+    return err;
+}
+
+// Copies the blocks back into reloc_targets and leaves edit mode.
+static DAT_RET reloc_blocks_flatten(DatFile *dat) {
+    while (dat->reloc_count > dat->reloc_capacity) {
+        DAT_RET err = grow_arr(dat, DAT_FILE_BORROWED_RELOCS, (void **)&dat->reloc_targets, &dat->reloc_capacity, sizeof(DatRef));
+        if (err) return err;
+    }
+
+    DAT_ZONE(zone, "flatten reloc blocks");
+    DatRelocBlocks *rb = dat->reloc_blocks;
+    uint32_t reloc_i = 0;
+    for (uint32_t i = 0; i < rb->block_count; ++i) {
+        memcpy(&dat->reloc_targets[reloc_i], rb->blocks[i], rb->counts[i] * sizeof(DatRef));
+        reloc_i += rb->counts[i];
+    }
+    DAT_ZONE_END(zone);
+
+    reloc_blocks_free(rb, &dat->allocator);
+    dat->reloc_blocks = NULL;
+    dat->flags &= ~(uint32_t)DAT_FILE_EDITING;
+    return DAT_SUCCESS;
+}
+
+static DAT_RET dat_file_finalize_inner(DatFile *dat) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    if (dat->flags & DAT_FILE_EDITING) {
+        DAT_RET err = reloc_blocks_flatten(dat);
+        if (err) return err;
+        objects_refresh(dat, 0);
+        return DAT_SUCCESS;
+    }
+    if ((dat->flags & DAT_FILE_BUILDING) == 0) return DAT_SUCCESS;
+
+    uint8_t *sort_tmp = NULL;
+    if (dat->reloc_count >= RADIX_SORT_MIN) {
+        sort_tmp = scratch_alloc(dat->reloc_count * sizeof(DatRef));
+        if (sort_tmp == NULL) return DAT_ERR_ALLOCATION_FAILURE;
+    }
+    dat->reloc_count = sort_by_key((uint8_t*)dat->reloc_targets, sort_tmp, dat->reloc_count, sizeof(DatRef), true);
+    scratch_free(sort_tmp);
+
+    dat->flags &= ~(uint32_t)DAT_FILE_BUILDING;
+    objects_refresh(dat, 0);
+    return DAT_SUCCESS;
+}
+
+DAT_RET dat_file_finalize(DatFile *dat) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_STAT_START(start);
+    DAT_RET err = dat_file_finalize_inner(dat);
+    DAT_STAT_END(dat, DatStat_Finalize, start);
+    return err;
+}
+
+// Alignment of an offset, up to 32 bytes.
+static inline uint32_t offset_alignment(DatRef offset) {
+    uint32_t align = offset == 0 ? 32 : offset & (~offset + 1);
+    return align > 32 ? 32 : align;
+}
+
+static DAT_RET dat_file_compact_inner(DatFile *dat, uint32_t *freed) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_RET err = dat_file_finalize(dat);
+    if (err) return err;
+    err = dat_file_find_objects(dat);
+    if (err) return err;
+
+    uint32_t object_count = dat->object_count;
+    uint8_t *live = scratch_alloc((object_count + 7) / 8 + 1);
+    uint32_t *stack = scratch_alloc((object_count + 1) * sizeof(uint32_t));
+    if (live == NULL || stack == NULL) {
+        scratch_free(live);
+        scratch_free(stack);
+        return DAT_ERR_ALLOCATION_FAILURE;
+    }
+
+    // mark ----------------------
+
+    DAT_ZONE(mark_zone, "compact mark");
+    DatGraphIter it;
+    err = dat_graph_begin(&it, dat, NULL, 0, 0, live, stack);
+    uint32_t live_count = 0;
+    while (err == DAT_SUCCESS && dat_graph_next(&it, NULL))
+        live_count++;
+    DAT_ZONE_END(mark_zone);
+    scratch_free(stack);
+    if (err) {
+        scratch_free(live);
+        return err;
+    }
+
+    if (live_count == object_count) {
+        scratch_free(live);
+        if (freed != NULL) *freed = 0;
+        return DAT_SUCCESS;
+    }
+
+    err = detach_patch_data(dat);
+    if (err) {
+        scratch_free(live);
+        return err;
+    }
+    incoming_index_drop(dat);
+    reloc_bitmap_drop(dat);
+
+    // slide ----------------------
+
+    // New offsets are written over `objects`, keeping the old ones alongside until references are rewritten.
+    uint32_t *old_objects = scratch_alloc((object_count + 1) * sizeof(uint32_t));
+    if (old_objects == NULL) {
+        scratch_free(live);
+        return DAT_ERR_ALLOCATION_FAILURE;
+    }
+    for (uint32_t i = 0; i < object_count; ++i)
+        old_objects[i] = dat->objects[i].offset;
+    old_objects[object_count] = dat->data_size;
+
+    // Borrowed data is private to this DatFile once detached from a patch mapping,
+    // so it can be moved in place.
+    DAT_ZONE(slide_zone, "compact slide");
+    uint32_t cursor = 0;
+    for (uint32_t i = 0; i < object_count; ++i) {
+        if (!graph_visited(live, i)) continue;
+        DatRef old_offset = old_objects[i];
+        uint32_t size = dat->objects[i].size;
+
+        // keep alignment for data that needs it, such as textures
+        cursor = align_forward(cursor, offset_alignment(old_offset));
+
+        memmove(&dat->data[cursor], &dat->data[old_offset], size);
+        DAT_STAT_MOVE(dat, cursor != old_offset ? size : 0);
+        dat->objects[i].offset = cursor;
+        cursor += size;
     }
+    DAT_ZONE_END(slide_zone);
 
+    // rewrite references ----------------------
+
+    DAT_ZONE(rewrite_zone, "compact rewrite references");
+    // Relocs and objects are both sorted, so walk them together.
+    uint32_t new_reloc_count = 0;
+    uint32_t object_i = 0;
+    for (uint32_t reloc_i = 0; reloc_i < dat->reloc_count; ++reloc_i) {
+        DatRef reloc = dat->reloc_targets[reloc_i];
+        while (object_i+1 < object_count && old_objects[object_i+1] <= reloc) object_i++;
+        if (reloc < old_objects[object_i] || !graph_visited(live, object_i)) continue;
+
+        DatRef new_reloc = dat->objects[object_i].offset + (reloc - old_objects[object_i]);
+        DatRef target = READ_U32(&dat->data[new_reloc]);
+
+        uint32_t target_i = binary_search_refs(old_objects, object_count, target);
+        if (target_i == object_count || old_objects[target_i] != target) target_i--;
+        WRITE_U32(&dat->data[new_reloc], dat->objects[target_i].offset + (target - old_objects[target_i]));
+
+        dat->reloc_targets[new_reloc_count++] = new_reloc;
+    }
+    dat->reloc_count = new_reloc_count;
+
+    for (uint32_t i = 0; i < dat->root_count + dat->extern_count; ++i) {
+        DatRef *ref = i < dat->root_count
+            ? &dat->root_info[i].data_offset
+            : &dat->extern_info[i - dat->root_count].data_offset;
+        uint32_t target_i = binary_search_refs(old_objects, object_count, *ref);
+        if (target_i == object_count || old_objects[target_i] != *ref) {
+            if (target_i == 0) continue;
+            target_i--;
+        }
+        *ref = dat->objects[target_i].offset + (*ref - old_objects[target_i]);
+    }
+    DAT_ZONE_END(rewrite_zone);
+
+    // rebuild objects ----------------------
+
+    live_count = 0;
+    for (uint32_t i = 0; i < object_count; ++i) {
+        if (graph_visited(live, i)) dat->objects[live_count++] = dat->objects[i];
+    }
+    dat->object_count = live_count;
+
+    if (freed != NULL) *freed = dat->data_size - cursor;
+    dat->data_size = cursor;
+    dat->flags |= DAT_FILE_LAYOUT_CHANGED;
+    objects_refresh(dat, 0);
+
+    scratch_free(old_objects);
+    scratch_free(live);
     return DAT_SUCCESS;
 }
 
+DAT_RET dat_file_compact(DatFile *dat, uint32_t *freed) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_STAT_START(start);
+    DAT_RET err = dat_file_compact_inner(dat, freed);
+    DAT_STAT_END(dat, DatStat_Compact, start);
+    return err;
+}
+
+// Objects are grouped into classes of identical objects by partition refinement:
+// first by their own bytes, then repeatedly by the classes of the objects they point to,
+// until no class splits. This finds identical subgraphs even when they contain cycles.
+typedef struct DedupState {
+    const DatFile *dat;
+    uint32_t object_count;
+    uint32_t *reloc_counts;     // per object, from its object_relocs entry
+    uint32_t *target_objects;   // per reloc, object index it points into
+    uint32_t *target_inner;     // per reloc, offset into that object
+    uint8_t *pinned;            // per object, never folded
+    uint32_t *classes;          // per object
+    uint32_t *hashes;           // per object
+    uint32_t *reps;             // per class, first object in it
+    uint32_t *class_hashes;     // per class
+    uint32_t *table;            // hash table of class + 1
+    uint32_t table_log_size;
+} DedupState;
+
+typedef bool (*DedupEqualFn)(const DedupState *st, uint32_t a, uint32_t b);
+
+static inline uint32_t hash_u32(uint32_t hash, uint32_t x) {
+    return (hash ^ x) * 16777619u;
+}
+
+static uint32_t dedup_hash_bytes(const DedupState *st, uint32_t object_i) {
+    const DatFile *dat = st->dat;
+    DatRef start = dat->objects[object_i].offset;
+    DatRef end = object_end(dat, object_i);
+    uint32_t hash = hash_u32(2166136261u, end - start);
+
+    // pointer slots hash as their position and inner target offset
+    DatRef cursor = start;
+    uint32_t reloc_i = st->dat->object_relocs[object_i];
+    for (uint32_t k = 0; k < st->reloc_counts[object_i]; ++k, ++reloc_i) {
+        DatRef reloc = dat->reloc_targets[reloc_i];
+        for (; cursor < reloc; ++cursor) hash = hash_u32(hash, dat->data[cursor]);
+        hash = hash_u32(hash, reloc - start);
+        hash = hash_u32(hash, st->target_inner[reloc_i]);
+        cursor = reloc + 4;
+    }
+    for (; cursor < end; ++cursor) hash = hash_u32(hash, dat->data[cursor]);
+    return hash;
+}
+
+static bool dedup_equal_bytes(const DedupState *st, uint32_t a, uint32_t b) {
+    const DatFile *dat = st->dat;
+    DatRef start_a = dat->objects[a].offset;
+    DatRef start_b = dat->objects[b].offset;
+    uint32_t size = dat->objects[a].size;
+    if (dat->objects[b].size != size) return false;
+    uint32_t reloc_count = st->reloc_counts[a];
+    if (st->reloc_counts[b] != reloc_count) return false;
+
+    uint32_t offset = 0;
+    uint32_t reloc_a = st->dat->object_relocs[a];
+    uint32_t reloc_b = st->dat->object_relocs[b];
+    for (uint32_t k = 0; k < reloc_count; ++k, ++reloc_a, ++reloc_b) {
+        uint32_t slot = dat->reloc_targets[reloc_a] - start_a;
+        if (dat->reloc_targets[reloc_b] - start_b != slot) return false;
+        if (st->target_inner[reloc_a] != st->target_inner[reloc_b]) return false;
+        if (memcmp(&dat->data[start_a + offset], &dat->data[start_b + offset], slot - offset) != 0) return false;
+        offset = slot + 4;
+    }
+    return memcmp(&dat->data[start_a + offset], &dat->data[start_b + offset], size - offset) == 0;
+}
+
+static uint32_t dedup_hash_targets(const DedupState *st, uint32_t object_i) {
+    uint32_t hash = hash_u32(2166136261u, st->classes[object_i]);
+    uint32_t reloc_i = st->dat->object_relocs[object_i];
+    for (uint32_t k = 0; k < st->reloc_counts[object_i]; ++k, ++reloc_i)
+        hash = hash_u32(hash, st->classes[st->target_objects[reloc_i]]);
+    return hash;
+}
+
+static bool dedup_equal_targets(const DedupState *st, uint32_t a, uint32_t b) {
+    if (st->classes[a] != st->classes[b]) return false;
+    // same class, so same reloc count
+    uint32_t reloc_a = st->dat->object_relocs[a];
+    uint32_t reloc_b = st->dat->object_relocs[b];
+    for (uint32_t k = 0; k < st->reloc_counts[a]; ++k) {
+        if (st->classes[st->target_objects[reloc_a + k]] != st->classes[st->target_objects[reloc_b + k]])
+            return false;
+    }
+    return true;
+}
+
+// Assigns each object to a class of equal objects in `new_classes`, using st->hashes.
+// Returns the number of classes.
+static uint32_t dedup_group(DedupState *st, DedupEqualFn equal, uint32_t *new_classes) {
+    uint32_t mask = (1u << st->table_log_size) - 1;
+    memset(st->table, 0, (mask + 1) * sizeof(uint32_t));
+
+    uint32_t class_count = 0;
+    for (uint32_t i = 0; i < st->object_count; ++i) {
+        uint32_t hash = st->hashes[i];
+        if (st->pinned[i]) {
+            st->reps[class_count] = i;
+            st->class_hashes[class_count] = hash;
+            new_classes[i] = class_count++;
+            continue;
+        }
+
+        uint32_t idx = hash & mask;
+        while (1) {
+            uint32_t c = st->table[idx];
+            if (c == 0) {
+                st->table[idx] = class_count + 1;
+                st->reps[class_count] = i;
+                st->class_hashes[class_count] = hash;
+                new_classes[i] = class_count++;
+                break;
+            }
+            c--;
+            if (st->class_hashes[c] == hash && equal(st, st->reps[c], i)) {
+                new_classes[i] = c;
+                break;
+            }
+            idx = (idx + 1) & mask;
+        }
+    }
+    return class_count;
+}
+
+static DAT_RET dat_file_dedup_inner(DatFile *dat, uint32_t *saved) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_RET err = dat_file_finalize(dat);
+    if (err) return err;
+    err = dat_file_find_objects(dat);
+    if (err) return err;
+
+    uint32_t object_count = dat->object_count;
+    uint32_t reloc_count = dat->reloc_count;
+    DedupState st = { dat, object_count, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0 };
+    st.table_log_size = 4;
+    while ((1u << st.table_log_size) < object_count * 2) st.table_log_size++;
+
+    // one allocation for every per object and per reloc array
+    size_t n = (size_t)object_count + 1;
+    size_t r = (size_t)reloc_count + 1;
+    uint32_t *buf = scratch_alloc((n * 6 + r * 2 + ((size_t)1 << st.table_log_size)) * sizeof(uint32_t) + n);
+    if (buf == NULL) return DAT_ERR_ALLOCATION_FAILURE;
+    st.reloc_counts   = buf;
+    st.classes        = st.reloc_counts + n;
+    st.hashes         = st.classes + n;
+    st.reps           = st.hashes + n;
+    st.class_hashes   = st.reps + n;
+    uint32_t *new_classes = st.class_hashes + n;
+    st.target_objects = new_classes + n;
+    st.target_inner   = st.target_objects + r;
+    st.table          = st.target_inner + r;
+    st.pinned         = (uint8_t*)(st.table + ((size_t)1 << st.table_log_size));
+    memset(st.pinned, 0, n);
+
+    // Objects and relocs are both sorted, so walk them together.
+    DAT_ZONE(gather_zone, "dedup gather");
+    uint32_t reloc_i = 0;
+    for (uint32_t i = 0; i < object_count; ++i) {
+        DatRef end = object_end(dat, i);
+        while (reloc_i < reloc_count && dat->reloc_targets[reloc_i] < end) {
+            DatRef target = READ_U32(&dat->data[dat->reloc_targets[reloc_i]]);
+            uint32_t target_i = object_idx_of(dat, target);
+            if (target_i == UINT32_MAX) {
+                // points before every object, leave this one alone
+                st.pinned[i] = 1;
+                target_i = i;
+            }
+            st.target_objects[reloc_i] = target_i;
+            st.target_inner[reloc_i] = target - dat->objects[target_i].offset;
+            reloc_i++;
+        }
+        st.reloc_counts[i] = reloc_i - dat->object_relocs[i];
+    }
+
+    // Externs are patched at load time, so each extern location must stay unique.
+    for (uint32_t i = 0; i < dat->extern_count; ++i) {
+        uint32_t object_i = object_idx_of(dat, dat->extern_info[i].data_offset);
+        if (object_i != UINT32_MAX) st.pinned[object_i] = 1;
+    }
+    DAT_ZONE_END(gather_zone);
+
+    // group by bytes, then refine by targets until stable
+    DAT_ZONE(group_zone, "dedup group");
+    for (uint32_t i = 0; i < object_count; ++i)
+        st.hashes[i] = dedup_hash_bytes(&st, i);
+    uint32_t class_count = dedup_group(&st, dedup_equal_bytes, st.classes);
+    while (1) {
+        for (uint32_t i = 0; i < object_count; ++i)
+            st.hashes[i] = dedup_hash_targets(&st, i);
+        uint32_t new_class_count = dedup_group(&st, dedup_equal_targets, new_classes);
+
+        uint32_t *swap = st.classes;
+        st.classes = new_classes;
+        new_classes = swap;
+        if (new_class_count == class_count) break;
+        class_count = new_class_count;
+    }
+    DAT_ZONE_END(group_zone);
+
+    // Point every reference into a class at its most aligned object, so textures stay aligned.
+    // Duplicates become unreachable and are removed by dat_file_compact.
+    if (class_count != object_count) {
+        err = detach_patch_data(dat);
+        if (err) {
+            scratch_free(buf);
+            return err;
+        }
+        incoming_index_drop(dat);
+        dat->flags |= DAT_FILE_LAYOUT_CHANGED;
+
+        for (uint32_t i = 0; i < object_count; ++i) {
+            uint32_t *rep = &st.reps[st.classes[i]];
+            if (offset_alignment(dat->objects[i].offset) > offset_alignment(dat->objects[*rep].offset))
+                *rep = i;
+        }
+
+        for (uint32_t i = 0; i < reloc_count; ++i) {
+            uint32_t rep = st.reps[st.classes[st.target_objects[i]]];
+            WRITE_U32(&dat->data[dat->reloc_targets[i]], dat->objects[rep].offset + st.target_inner[i]);
+        }
+        for (uint32_t i = 0; i < dat->root_count; ++i) {
+            DatRef offset = dat->root_info[i].data_offset;
+            uint32_t object_i = object_idx_of(dat, offset);
+            if (object_i == UINT32_MAX) continue;
+            uint32_t rep = st.reps[st.classes[object_i]];
+            dat->root_info[i].data_offset = dat->objects[rep].offset + (offset - dat->objects[object_i].offset);
+        }
+    }
+
+    scratch_free(buf);
+
+    uint32_t freed = 0;
+    if (class_count != object_count)
+        err = dat_file_compact(dat, &freed);
+    if (saved != NULL) *saved = freed;
+    return err;
+}
+
+DAT_RET dat_file_dedup(DatFile *dat, uint32_t *saved) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_STAT_START(start);
+    DAT_RET err = dat_file_dedup_inner(dat, saved);
+    DAT_STAT_END(dat, DatStat_Dedup, start);
+    return err;
+}
+
 uint32_t dat_file_reloc_idx(const DatFile *dat, DatRef ref) {
     return binary_search_refs(dat->reloc_targets, dat->reloc_count, ref);
 }
 
-DAT_RET dat_obj_alloc(DatFile *dat, uint32_t size, DatRef *out) {
+// Keeps object_relocs in step with a reference inserted or removed at `from` outside builder and edit mode.
+static void objects_shift_relocs(DatFile *dat, DatRef from, int32_t delta) {
+    uint32_t object_i = object_idx_of(dat, from);
+    uint32_t first = object_i == UINT32_MAX ? 0 : object_i + 1;
+    for (uint32_t i = first; i < dat->object_count; ++i)
+        dat->object_relocs[i] += (uint32_t)delta;
+}
+
+static DAT_RET dat_obj_alloc_inner(DatFile *dat, uint32_t size, DatRef *out) {
     if (dat == NULL) return DAT_ERR_NULL_PARAM;
     if (out == NULL) return DAT_ERR_NULL_PARAM;
 
     uint32_t obj_offset = align_forward(dat->data_size, 4);
     uint32_t new_data_size = obj_offset + size;
 
+    DAT_RET err = detach_patch_data(dat);
+    if (err) return err;
+
     while (new_data_size > dat->data_capacity) {
-        DAT_RET err = realloc_arr((void **)&dat->data, &dat->data_capacity, 1);
+        err = grow_arr(dat, DAT_FILE_BORROWED_DATA, (void **)&dat->data, &dat->data_capacity, 1);
         if (err) return err;
     }
     
-    while (dat->object_count >= dat->object_capacity) {
-        DAT_RET err = realloc_arr((void **)&dat->objects, &dat->object_capacity, 1);
-        if (err) return err;
-    }
-    dat->objects[dat->object_count++] = obj_offset;
+    err = reserve_objects(dat, dat->object_count + 1);
+    if (err) return err;
+    dat->objects[dat->object_count++].offset = obj_offset;
 
     dat->data_size = new_data_size;
+    objects_refresh(dat, dat->object_count - 1);
+    dat->flags |= DAT_FILE_LAYOUT_CHANGED;
     *out = obj_offset;
 
     return DAT_SUCCESS;
 }
 
-DAT_RET dat_obj_set_ref(DatFile *dat, DatRef from, DatRef to) {
+DAT_RET dat_obj_alloc(DatFile *dat, uint32_t size, DatRef *out) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_STAT_START(start);
+    DAT_RET err = dat_obj_alloc_inner(dat, size, out);
+    DAT_STAT_END(dat, DatStat_ObjAlloc, start);
+    return err;
+}
+
+static DAT_RET dat_obj_set_ref_inner(DatFile *dat, DatRef from, DatRef to) {
     if (dat == NULL) return DAT_ERR_NULL_PARAM;
     if (from & 3) return DAT_ERR_INVALID_ALIGNMENT;
     if (from+4 > dat->data_size) return DAT_ERR_OUT_OF_BOUNDS;
     if (to >= dat->data_size) return DAT_ERR_OUT_OF_BOUNDS;
 
+    if (dat->flags & DAT_FILE_BUILDING) {
+        DAT_RET err = detach_patch_data(dat);
+        if (err) return err;
+
+        // append now, sort and deduplicate in dat_file_finalize
+        if (dat->reloc_count >= dat->reloc_capacity) {
+            err = grow_arr(dat, DAT_FILE_BORROWED_RELOCS, (void **)&dat->reloc_targets, &dat->reloc_capacity, sizeof(DatRef));
+            if (err) return err;
+        }
+        dat->reloc_targets[dat->reloc_count++] = from;
+        dat->flags |= DAT_FILE_LAYOUT_CHANGED;
+        reloc_bitmap_update(dat, from, true);
+        WRITE_U32(&dat->data[from], to);
+        return DAT_SUCCESS;
+    }
+
+    if (dat->flags & DAT_FILE_EDITING) {
+        // Rewriting an existing reference can stay in the patch mapping, a new one changes the layout.
+        if (!reloc_blocks_contains(dat->reloc_blocks, from)) {
+            DAT_RET err = detach_patch_data(dat);
+            if (err) return err;
+        }
+
+        DAT_RET err = reloc_blocks_insert(dat, from);
+        if (err == DAT_SUCCESS) {
+            dat->reloc_count++;
+            dat->flags |= DAT_FILE_LAYOUT_CHANGED;
+            reloc_bitmap_update(dat, from, true);
+        } else if (err != DAT_NOT_FOUND) {
+            return err;
+        }
+        incoming_index_retarget(dat, from, err == DAT_NOT_FOUND, to);
+        WRITE_U32(&dat->data[from], to);
+        return DAT_SUCCESS;
+    }
+
     uint32_t reloc_idx = dat_file_reloc_idx(dat, from);
+    bool was_ref = reloc_idx != dat->reloc_count && dat->reloc_targets[reloc_idx] == from;
+    DAT_STAT_SEARCH(dat, dat->reloc_count, was_ref);
+
+    if (!was_ref) {
+        DAT_RET err = detach_patch_data(dat);
+        if (err) return err;
 
-    if (reloc_idx == dat->reloc_count || dat->reloc_targets[reloc_idx] != from) {
         uint32_t count = dat->reloc_count;
         if (count >= dat->reloc_capacity) {
-            DAT_RET err = realloc_arr((void **)&dat->reloc_targets, &dat->reloc_capacity, sizeof(DatRef));
+            err = grow_arr(dat, DAT_FILE_BORROWED_RELOCS, (void **)&dat->reloc_targets, &dat->reloc_capacity, sizeof(DatRef));
             if (err) return err;
         }
 
@@ -324,37 +3324,87 @@ DAT_RET dat_obj_set_ref(DatFile *dat, DatRef from, DatRef to) {
             &dat->reloc_targets[reloc_idx],
             (count-reloc_idx) * sizeof(*dat->reloc_targets)
         );
+        DAT_STAT_MOVE(dat, (count-reloc_idx) * sizeof(*dat->reloc_targets));
 
         dat->reloc_targets[reloc_idx] = from;
         dat->reloc_count++;
+        dat->flags |= DAT_FILE_LAYOUT_CHANGED;
+        objects_shift_relocs(dat, from, 1);
+        reloc_bitmap_update(dat, from, true);
     }
     
+    incoming_index_retarget(dat, from, was_ref, to);
     WRITE_U32(&dat->data[from], to);
 
     return DAT_SUCCESS;
 }
 
-DAT_RET dat_obj_remove_ref(DatFile *dat, DatRef from) {
+DAT_RET dat_obj_set_ref(DatFile *dat, DatRef from, DatRef to) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_STAT_START(start);
+    DAT_RET err = dat_obj_set_ref_inner(dat, from, to);
+    DAT_STAT_END(dat, DatStat_SetRef, start);
+    return err;
+}
+
+static DAT_RET dat_obj_remove_ref_inner(DatFile *dat, DatRef from) {
     if (dat == NULL) return DAT_ERR_NULL_PARAM;
     if (from & 3) return DAT_ERR_INVALID_ALIGNMENT;
 
+    if (dat->flags & DAT_FILE_EDITING) {
+        if (!reloc_blocks_contains(dat->reloc_blocks, from)) return DAT_NOT_FOUND;
+        DAT_RET err = detach_patch_data(dat);
+        if (err) return err;
+        err = reloc_blocks_remove(dat, from);
+        if (err) return err;
+        dat->reloc_count--;
+        dat->flags |= DAT_FILE_LAYOUT_CHANGED;
+        incoming_index_unlink(dat, from);
+        reloc_bitmap_update(dat, from, false);
+        return DAT_SUCCESS;
+    }
+
+    DAT_RET err = dat_file_finalize(dat);
+    if (err) return err;
+
     uint32_t reloc_idx = dat_file_reloc_idx(dat, from);
+    bool found = reloc_idx != dat->reloc_count && dat->reloc_targets[reloc_idx] == from;
+    DAT_STAT_SEARCH(dat, dat->reloc_count, found);
+    if (!found) return DAT_NOT_FOUND;
+
+    err = detach_patch_data(dat);
+    if (err) return err;
+
     memmove(
         &dat->reloc_targets[reloc_idx],
         &dat->reloc_targets[reloc_idx+1],
         (dat->reloc_count-reloc_idx-1) * sizeof(*dat->reloc_targets)
     );
+    DAT_STAT_MOVE(dat, (dat->reloc_count-reloc_idx-1) * sizeof(*dat->reloc_targets));
     dat->reloc_count--;
+    dat->flags |= DAT_FILE_LAYOUT_CHANGED;
+    objects_shift_relocs(dat, from, -1);
+    incoming_index_unlink(dat, from);
+    reloc_bitmap_update(dat, from, false);
 
     return DAT_SUCCESS;
 }
 
+DAT_RET dat_obj_remove_ref(DatFile *dat, DatRef from) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_STAT_START(start);
+    DAT_RET err = dat_obj_remove_ref_inner(dat, from);
+    DAT_STAT_END(dat, DatStat_RemoveRef, start);
+    return err;
+}
+
 DAT_RET dat_obj_read_ref(DatFile *dat, DatRef ptr, DatRef *out) {
     return dat_obj_read_u32(dat, ptr, out);
 }
 
 DAT_RET dat_obj_read_u32(DatFile *dat, DatRef ptr, uint32_t *out) {
     if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_STAT_CALL(dat, DatStat_Read);
     if (ptr & 3) return DAT_ERR_INVALID_ALIGNMENT;
     if (ptr + 4 > dat->data_size) return DAT_ERR_OUT_OF_BOUNDS;
 
@@ -364,6 +3414,7 @@ DAT_RET dat_obj_read_u32(DatFile *dat, DatRef ptr, uint32_t *out) {
 
 DAT_RET dat_obj_read_u16(DatFile *dat, DatRef ptr, uint16_t *out) {
     if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_STAT_CALL(dat, DatStat_Read);
     if (ptr & 1) return DAT_ERR_INVALID_ALIGNMENT;
     if (ptr + 2 > dat->data_size) return DAT_ERR_OUT_OF_BOUNDS;
 
@@ -373,56 +3424,126 @@ DAT_RET dat_obj_read_u16(DatFile *dat, DatRef ptr, uint16_t *out) {
 
 DAT_RET dat_obj_read_u8(DatFile *dat, DatRef ptr, uint8_t *out) {
     if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_STAT_CALL(dat, DatStat_Read);
     if (ptr + 1 > dat->data_size) return DAT_ERR_OUT_OF_BOUNDS;
 
     *out = dat->data[ptr];
     return DAT_SUCCESS;
 }
 
+// Whether `slot` holds a reference. Always true in builder mode, where references aren't sorted.
+static bool is_reloc_slot(const DatFile *dat, DatRef slot) {
+    if (dat->flags & DAT_FILE_BUILDING) return true;
+    if (dat->flags & DAT_FILE_EDITING) {
+        const DatRelocBlocks *rb = dat->reloc_blocks;
+        if (rb->block_count == 0) return false;
+        uint32_t block_i = reloc_blocks_find(rb, slot);
+        uint32_t i = binary_search_refs(rb->blocks[block_i], rb->counts[block_i], slot);
+        return i < rb->counts[block_i] && rb->blocks[block_i][i] == slot;
+    }
+    uint32_t i = dat_file_reloc_idx(dat, slot);
+    return i < dat->reloc_count && dat->reloc_targets[i] == slot;
+}
+
+// A checked write into a reference slot may leave an out of bounds target, clearing DAT_FILE_VALIDATED,
+// and moves the slot to another object, so the incoming index is dropped.
+static inline void after_write(DatFile *dat, DatRef ptr) {
+    DatRef slot = ptr & ~3u;
+    if (slot + 4 > dat->data_size) return;
+    bool invalid = (dat->flags & DAT_FILE_VALIDATED) && READ_U32(&dat->data[slot]) >= dat->data_size;
+    if (!invalid && dat->incoming_index == NULL) return;
+    if (!is_reloc_slot(dat, slot)) return;
+
+    if (invalid) dat->flags &= ~(uint32_t)DAT_FILE_VALIDATED;
+    incoming_index_drop(dat);
+}
+
 DAT_RET dat_obj_write_u32(DatFile *dat, DatRef ptr, uint32_t num) {
     if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_STAT_CALL(dat, DatStat_Write);
     if (ptr & 3) return DAT_ERR_INVALID_ALIGNMENT;
     if (ptr + 4 > dat->data_size) return DAT_ERR_OUT_OF_BOUNDS;
     
     WRITE_U32(&dat->data[ptr], num);
+    after_write(dat, ptr);
     return DAT_SUCCESS;
 }
 
 DAT_RET dat_obj_write_u16(DatFile *dat, DatRef ptr, uint16_t num) {
     if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_STAT_CALL(dat, DatStat_Write);
     if (ptr & 1) return DAT_ERR_INVALID_ALIGNMENT;
     if (ptr + 2 > dat->data_size) return DAT_ERR_OUT_OF_BOUNDS;
 
     WRITE_U16(&dat->data[ptr], num);
+    after_write(dat, ptr);
     return DAT_SUCCESS;
 }
 
 DAT_RET dat_obj_write_u8(DatFile *dat, DatRef ptr, uint8_t num) {
     if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_STAT_CALL(dat, DatStat_Write);
     if (ptr + 1 > dat->data_size) return DAT_ERR_OUT_OF_BOUNDS;
 
     dat->data[ptr] = num;
+    after_write(dat, ptr);
     return DAT_SUCCESS;
 }
 
-DAT_RET dat_root_add(DatFile *dat, uint32_t index, DatRef root_obj, const char *symbol) {
-    if (dat == NULL) return DAT_ERR_NULL_PARAM;
-    if (symbol == NULL) return DAT_ERR_NULL_PARAM;
-    if (root_obj & 3) return DAT_ERR_INVALID_ALIGNMENT;
-    uint32_t root_count = dat->root_count;
-    if (index > root_count) return DAT_ERR_OUT_OF_BOUNDS;
+// Puts the offset of `symbol` in `out`, appending it to the symbol table if it is not already there.
+static DAT_RET intern_symbol(DatFile *dat, const char *symbol, SymbolRef *out) {
+    if (dat->symbol_set == NULL) {
+        DAT_RET err = symbol_set_build(dat, &dat->symbol_set);
+        if (err) return err;
+    }
+
+    uint32_t hash = hash_str(symbol);
+    DatNameSlot *slot = symbol_set_slot(dat->symbol_set, dat->symbols, symbol, hash);
+    if (slot->idx_plus_1 != 0) {
+        *out = slot->idx_plus_1 - 1;
+        return DAT_SUCCESS;
+    }
 
     uint32_t symbol_start = dat->symbol_size;
     uint32_t symbol_end = symbol_start + (uint32_t)strlen(symbol) + 1;
     while (symbol_end >= dat->symbol_capacity) {
-        DAT_RET err = realloc_arr((void **)&dat->symbols, &dat->symbol_capacity, 1);
+        DAT_RET err = grow_arr(dat, DAT_FILE_BORROWED_SYMBOLS, (void **)&dat->symbols, &dat->symbol_capacity, 1);
         if (err) return err;
     }
     strcpy(&dat->symbols[symbol_start], symbol);
     dat->symbol_size = symbol_end;
 
+    *slot = (DatNameSlot) { hash, symbol_start + 1 };
+    dat->symbol_set->count++;
+    if (dat->symbol_set->count * 2 > (1u << dat->symbol_set->log_size)) {
+        DAT_RET err = name_index_resize(dat->symbol_set, &dat->allocator, dat->symbol_set->log_size + 1);
+        if (err) {
+            name_index_free(dat->symbol_set, &dat->allocator);
+            dat->symbol_set = NULL;
+        }
+    }
+
+    *out = symbol_start;
+    return DAT_SUCCESS;
+}
+
+static DAT_RET dat_root_add_inner(DatFile *dat, uint32_t index, DatRef root_obj, const char *symbol) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    if (symbol == NULL) return DAT_ERR_NULL_PARAM;
+    if (root_obj & 3) return DAT_ERR_INVALID_ALIGNMENT;
+    uint32_t root_count = dat->root_count;
+    if (index > root_count) return DAT_ERR_OUT_OF_BOUNDS;
+    if (root_obj >= dat->data_size) dat->flags &= ~(uint32_t)DAT_FILE_VALIDATED;
+
+    DAT_RET err = detach_patch_data(dat);
+    if (err) return err;
+
+    SymbolRef symbol_offset;
+    err = intern_symbol(dat, symbol, &symbol_offset);
+    if (err) return err;
+
     if (root_count == dat->root_capacity) {
-        DAT_RET err = realloc_arr((void **)&dat->root_info, &dat->root_capacity, sizeof(DatRootInfo));
+        err = grow_arr(dat, DAT_FILE_BORROWED_ROOTS, (void **)&dat->root_info, &dat->root_capacity, sizeof(DatRootInfo));
         if (err) return err;
     }
 
@@ -431,167 +3552,700 @@ DAT_RET dat_root_add(DatFile *dat, uint32_t index, DatRef root_obj, const char *
         &dat->root_info[index],
         (root_count-index) * sizeof(*dat->root_info)
     );
+    DAT_STAT_MOVE(dat, (root_count-index) * sizeof(*dat->root_info));
 
     dat->root_info[index] = (DatRootInfo) {
         .data_offset = root_obj,
-        .symbol_offset = symbol_start,
+        .symbol_offset = symbol_offset,
     };
     dat->root_count++;
+    dat->flags |= DAT_FILE_LAYOUT_CHANGED;
+
+    if (dat->root_index != NULL) {
+        if (index != root_count)
+            name_index_shift(dat->root_index, index, 1);
+        err = name_index_insert(dat->root_index, dat, (const uint32_t*)dat->root_info, index);
+        if (err) {
+            name_index_free(dat->root_index, &dat->allocator);
+            dat->root_index = NULL;
+        }
+    }
 
     return DAT_SUCCESS;
 }
 
-DAT_RET dat_root_remove(DatFile *dat, uint32_t index) {
+DAT_RET dat_root_add(DatFile *dat, uint32_t index, DatRef root_obj, const char *symbol) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_STAT_START(start);
+    DAT_RET err = dat_root_add_inner(dat, index, root_obj, symbol);
+    DAT_STAT_END(dat, DatStat_RootAdd, start);
+    return err;
+}
+
+static DAT_RET dat_root_remove_inner(DatFile *dat, uint32_t index) {
     if (dat == NULL) return DAT_ERR_NULL_PARAM;
     uint32_t root_count = dat->root_count;
     if (index >= root_count) return DAT_ERR_OUT_OF_BOUNDS;
 
+    DAT_RET err = detach_patch_data(dat);
+    if (err) return err;
+
+    if (dat->root_index != NULL) {
+        if (dat->root_index->has_duplicates) {
+            // another root may need to take over this name, rebuild on next lookup
+            name_index_free(dat->root_index, &dat->allocator);
+            dat->root_index = NULL;
+        } else {
+            name_index_remove(dat->root_index, dat, (const uint32_t*)dat->root_info, index);
+            if (index+1 != root_count)
+                name_index_shift(dat->root_index, index+1, -1);
+        }
+    }
+
     memmove(
         &dat->root_info[index],
         &dat->root_info[index+1],
         (root_count-index-1) * sizeof(*dat->root_info)
     );
+    DAT_STAT_MOVE(dat, (root_count-index-1) * sizeof(*dat->root_info));
     dat->root_count--;
+    dat->flags |= DAT_FILE_LAYOUT_CHANGED;
 
     return DAT_SUCCESS;
 }
 
+DAT_RET dat_root_remove(DatFile *dat, uint32_t index) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_STAT_START(start);
+    DAT_RET err = dat_root_remove_inner(dat, index);
+    DAT_STAT_END(dat, DatStat_RootRemove, start);
+    return err;
+}
+
 DAT_RET dat_root_find(DatFile *dat, const char *root_name, DatRef *out) {
+    if (out == NULL) return DAT_ERR_NULL_PARAM;
+
+    uint32_t root_i;
+    DAT_RET err = dat_root_find_idx(dat, root_name, &root_i);
+    if (err) return err;
+    *out = dat->root_info[root_i].data_offset;
+    return DAT_SUCCESS;
+}
+
+DAT_RET dat_root_find_idx(DatFile *dat, const char *root_name, uint32_t *out) {
     if (dat == NULL) return DAT_ERR_NULL_PARAM;
     if (root_name == NULL) return DAT_ERR_NULL_PARAM;
     if (out == NULL) return DAT_ERR_NULL_PARAM;
-    
-    for (uint32_t root_i = 0; root_i < dat->root_count; ++root_i) {
-        DatRootInfo info = dat->root_info[root_i];
-        char *root_name_to_check = &dat->symbols[info.symbol_offset];
-        
-        for (uint64_t i = 0; ; ++i) {
-            char a = root_name_to_check[i];
-            char b = root_name[i];
-            
-            if (a != b) break;
-            if (a == 0) {
-                *out = info.data_offset;
-                return DAT_SUCCESS;
-            };
-        }
-    }
-    
-    return DAT_NOT_FOUND;
+
+    DAT_RET err = name_index_find(&dat->root_index, dat, (const uint32_t*)dat->root_info, dat->root_count, root_name, out);
+    DAT_STAT_CALL(dat, DatStat_NameLookup);
+    DAT_STAT_NAME_MISS(dat, err == DAT_NOT_FOUND);
+    return err;
 }
 
-DAT_RET dat_obj_location(const DatFile *dat, DatRef ptr, DatSlice *out) {
+DAT_RET dat_extern_find(DatFile *dat, const char *extern_name, DatRef *out) {
     if (dat == NULL) return DAT_ERR_NULL_PARAM;
-    if (dat->object_count == 0) return DAT_NOT_FOUND;
-    
-    uint32_t object_idx = binary_search_refs(dat->objects, dat->object_count, ptr);
-    
-    if (dat->object_count == object_idx)
-        object_idx--;
-    
-    if (dat->objects[object_idx] > ptr) {
-        if (object_idx == 0) return DAT_NOT_FOUND;
-        object_idx--;
-    }
+    if (extern_name == NULL) return DAT_ERR_NULL_PARAM;
+    if (out == NULL) return DAT_ERR_NULL_PARAM;
+
+    const uint32_t *infos = (const uint32_t*)dat->extern_info;
+    uint32_t extern_i;
+    DAT_RET err = name_index_find(&dat->extern_index, dat, infos, dat->extern_count, extern_name, &extern_i);
+    DAT_STAT_CALL(dat, DatStat_NameLookup);
+    DAT_STAT_NAME_MISS(dat, err == DAT_NOT_FOUND);
+    if (err) return err;
+    *out = dat->extern_info[extern_i].data_offset;
+    return DAT_SUCCESS;
+}
+
+DAT_RET dat_obj_index(const DatFile *dat, DatRef ptr, uint32_t *out) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    if (dat->flags & DAT_FILE_OBJECTS_PENDING) return DAT_ERR_OBJECTS_PENDING;
     
-    if (dat->objects[object_idx] > ptr)
-        return DAT_NOT_FOUND;
-        
-    uint32_t offset = dat->objects[object_idx];
-    uint32_t end; 
-    if (object_idx+1 < dat->object_count)
-        end = dat->objects[object_idx+1];
-    else
-        end = dat->data_size;
+    uint32_t object_idx = object_idx_of(dat, ptr);
+    DAT_STAT_CALL(dat, DatStat_ObjLookup);
+    DAT_STAT_SEARCH(dat, dat->object_count, object_idx != UINT32_MAX);
+    if (object_idx == UINT32_MAX) return DAT_NOT_FOUND;
     
-    *out = (DatSlice) { offset, end-offset };
+    *out = object_idx;
     return DAT_SUCCESS;
 }
 
-DAT_RET dat_obj_copy_inner(
-    DatFile *dst, DatFile *src, DatRef src_ref, DatRef *dst_out,
-    DatRef *src_lookup, DatRef *dst_lookup, uint32_t *lookup_count 
-) {
-    // find src object location
-    DatSlice obj_location;
-    DAT_RET err = dat_obj_location(src, src_ref, &obj_location);
+DAT_RET dat_obj_location(const DatFile *dat, DatRef ptr, DatSlice *out) {
+    uint32_t object_idx;
+    DAT_RET err = dat_obj_index(dat, ptr, &object_idx);
     if (err) return err;
     
-    // alloc and copy object to dst
-    DatRef dst_ref;
-    dat_obj_alloc(dst, obj_location.size, &dst_ref);
-    *dst_out = dst_ref;
-    memcpy(&dst->data[dst_ref], &src->data[src_ref], obj_location.size);
-            
-    src_lookup[*lookup_count] = src_ref;
-    dst_lookup[*lookup_count] = dst_ref;
-    (*lookup_count)++;
-    
-    // Recursively copy child objects
-    DatRef obj_end = obj_location.offset + obj_location.size;
-    uint32_t reloc_i = dat_file_reloc_idx(src, obj_location.offset);
-    while (1) {
-        // find next child ref
-        if (reloc_i == src->reloc_count) break;
-        DatRef src_child_ref_offset = src->reloc_targets[reloc_i];
-        if (src_child_ref_offset >= obj_end) break;
-        
-        // read child object offset
-        DatRef dst_child_ref, src_child_ref;
-        err = dat_obj_read_ref(src, src_child_ref_offset, &src_child_ref);
+    *out = dat->objects[object_idx];
+    return DAT_SUCCESS;
+}
+
+static DAT_RET dat_obj_incoming_inner(DatFile *dat, DatRef ptr, const DatRef **out, uint32_t *count) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    if (out == NULL) return DAT_ERR_NULL_PARAM;
+    if (count == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_RET err = DAT_SUCCESS;
+    if (dat->flags & DAT_FILE_BUILDING)
+        err = dat_file_finalize(dat);
+    if (err) return err;
+
+    err = dat_file_find_objects(dat);
+    if (err) return err;
+    uint32_t object_idx;
+    err = dat_obj_index(dat, ptr, &object_idx);
+    if (err) return err;
+
+    if (dat->incoming_index == NULL) {
+        err = incoming_index_build(dat, &dat->incoming_index);
         if (err) return err;
-        
-        // check if already copied
-        bool found = false;
-        for (uint32_t i = 0; i < *lookup_count; ++i) {
-            if (src_lookup[i] == src_child_ref) {
-                found = true;
-                dst_child_ref = dst_lookup[i];
-                break;
-            }
+    }
+    DatIncomingIndex *ix = dat->incoming_index;
+    err = incoming_index_extend(dat, dat->object_count);
+    if (err) return err;
+
+    *out = &ix->slots[ix->firsts[object_idx]];
+    *count = ix->firsts[object_idx+1] - ix->firsts[object_idx];
+    return DAT_SUCCESS;
+}
+
+DAT_RET dat_obj_incoming(DatFile *dat, DatRef ptr, const DatRef **out, uint32_t *count) {
+    if (dat == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_STAT_START(start);
+    DAT_RET err = dat_obj_incoming_inner(dat, ptr, out, count);
+    DAT_STAT_END(dat, DatStat_Incoming, start);
+    return err;
+}
+
+// Open addressing map from src object offsets to dst object offsets.
+typedef struct CopyMapSlot {
+    DatRef src;     // COPY_MAP_EMPTY if unused
+    DatRef dst;
+} CopyMapSlot;
+
+#define COPY_MAP_EMPTY 0xFFFFFFFFu
+#define COPY_MAP_MIN_LOG_SIZE 8
+
+typedef struct CopyWork {
+    uint32_t src_object; // index into src objects
+    DatRef dst;
+} CopyWork;
+
+// Everything is sized to the copied objects rather than the whole src file,
+// so copying many small roots out of a large file stays cheap.
+typedef struct CopyState {
+    CopyMapSlot *slots;
+    uint32_t log_size;
+    uint32_t count;
+
+    // Objects are copied breadth first from a worklist, so deep chains can't overflow the stack.
+    // The worklist doubles as the list of copied objects, each copied at most once.
+    CopyWork *queue;
+    uint32_t queue_count;
+    uint32_t queue_capacity;
+
+    DatRef *new_relocs;
+    uint32_t new_reloc_count;
+    uint32_t new_reloc_capacity;
+} CopyState;
+
+static inline uint32_t copy_map_hash(DatRef src, uint32_t log_size) {
+    return (src * 0x9E3779B1u) >> (32 - log_size);
+}
+
+// Returns the slot holding `src`, or the empty slot it should be inserted into.
+static inline CopyMapSlot *copy_map_slot(CopyMapSlot *slots, uint32_t log_size, DatRef src) {
+    uint32_t mask = (1u << log_size) - 1;
+    uint32_t idx = copy_map_hash(src, log_size);
+    while (1) {
+        CopyMapSlot *slot = &slots[idx];
+        if (slot->src == src || slot->src == COPY_MAP_EMPTY)
+            return slot;
+        idx = (idx + 1) & mask;
+    }
+}
+
+static DAT_RET copy_map_resize(CopyState *st, uint32_t log_size) {
+    uint32_t size = 1u << log_size;
+    CopyMapSlot *slots = scratch_alloc(size * sizeof(CopyMapSlot));
+    if (slots == NULL) return DAT_ERR_ALLOCATION_FAILURE;
+    memset(slots, 0xFF, size * sizeof(CopyMapSlot));
+
+    if (st->slots != NULL) {
+        uint32_t old_size = 1u << st->log_size;
+        for (uint32_t i = 0; i < old_size; ++i) {
+            if (st->slots[i].src != COPY_MAP_EMPTY)
+                *copy_map_slot(slots, log_size, st->slots[i].src) = st->slots[i];
         }
-        
-        if (!found) {
-            // copy child object
-            err = dat_obj_copy_inner(
-                dst, src, src_child_ref, &dst_child_ref,
-                src_lookup, dst_lookup, lookup_count
-            );
+        scratch_free(st->slots);
+    }
+
+    st->slots = slots;
+    st->log_size = log_size;
+    return DAT_SUCCESS;
+}
+
+// Appends references to `dst` that all lie past its existing data.
+static DAT_RET append_new_relocs(DatFile *dst, const DatRef *relocs, uint32_t count) {
+    if (dst->flags & DAT_FILE_EDITING) {
+        for (uint32_t i = 0; i < count; ++i) {
+            DAT_RET err = reloc_blocks_insert(dst, relocs[i]);
             if (err) return err;
         }
-        
-        // replace with new child pointer
-        DatRef dst_child_ref_offset = dst_ref + src_child_ref_offset - obj_location.offset;  
-        err = dat_obj_set_ref(dst, dst_child_ref_offset, dst_child_ref);
+        dst->reloc_count += count;
+        return DAT_SUCCESS;
+    }
+
+    while (dst->reloc_count + count > dst->reloc_capacity) {
+        DAT_RET err = grow_arr(dst, DAT_FILE_BORROWED_RELOCS, (void **)&dst->reloc_targets, &dst->reloc_capacity, sizeof(DatRef));
         if (err) return err;
-        
-        reloc_i++;
     }
-    
+    memcpy(&dst->reloc_targets[dst->reloc_count], relocs, count * sizeof(DatRef));
+    dst->reloc_count += count;
     return DAT_SUCCESS;
 }
 
-DAT_RET dat_obj_copy(DatFile *dst, DatFile *src, DatRef src_ref, DatRef *dst_out) {
+// Allocates a dst object for the src object containing `src_ref` and queues it for copying,
+// unless it was already allocated. Puts the dst location of `src_ref` in `dst_out`.
+static DAT_RET copy_enqueue(DatFile *dst, DatFile *src, DatRef src_ref, DatRef *dst_out, CopyState *st) {
+    uint32_t object_idx;
+    DAT_RET err = dat_obj_index(src, src_ref, &object_idx);
+    if (err) return err;
+    DatSlice location = src->objects[object_idx];
+
+    CopyMapSlot *slot = copy_map_slot(st->slots, st->log_size, location.offset);
+    if (slot->src == COPY_MAP_EMPTY) {
+        DatRef dst_ref;
+        err = dat_obj_alloc(dst, location.size, &dst_ref);
+        if (err) return err;
+
+        if (st->queue_count == st->queue_capacity) {
+            err = realloc_arr(NULL, (void **)&st->queue, &st->queue_capacity, sizeof(CopyWork));
+            if (err) return err;
+        }
+        st->queue[st->queue_count++] = (CopyWork) { object_idx, dst_ref };
+
+        slot->src = location.offset;
+        slot->dst = dst_ref;
+        *dst_out = dst_ref + (src_ref - location.offset);
+
+        // keep the load factor at or below 1/2
+        st->count++;
+        if (st->count * 2 > (1u << st->log_size))
+            return copy_map_resize(st, st->log_size + 1);
+        return DAT_SUCCESS;
+    }
+
+    *dst_out = slot->dst + (src_ref - location.offset);
+    return DAT_SUCCESS;
+}
+
+static DAT_RET copy_objects(DatFile *dst, DatFile *src, DatRef src_ref, DatRef *dst_out, CopyState *st) {
+    DAT_RET err = copy_map_resize(st, COPY_MAP_MIN_LOG_SIZE);
+    if (err) return err;
+    err = copy_enqueue(dst, src, src_ref, dst_out, st);
+    if (err) return err;
+
+    for (uint32_t work_i = 0; work_i < st->queue_count; ++work_i) {
+        CopyWork work = st->queue[work_i];
+        DatSlice work_src = src->objects[work.src_object];
+        memcpy(&dst->data[work.dst], &src->data[work_src.offset], work_src.size);
+
+        DatRef work_end = work_src.offset + work_src.size;
+        RelocIter reloc_iter = reloc_iter_object(src, work.src_object);
+        DatRef src_child_ref_offset;
+        while (reloc_iter_next(&reloc_iter, &src_child_ref_offset)) {
+            if (src_child_ref_offset >= work_end) break;
+
+            DatRef src_child_ref = READ_U32(&src->data[src_child_ref_offset]);
+            DatRef dst_child_ref;
+            err = copy_enqueue(dst, src, src_child_ref, &dst_child_ref, st);
+            if (err) return err;
+
+            DatRef dst_child_ref_offset = work.dst + (src_child_ref_offset - work_src.offset);
+            WRITE_U32(&dst->data[dst_child_ref_offset], dst_child_ref);
+
+            if (st->new_reloc_count == st->new_reloc_capacity) {
+                err = realloc_arr(NULL, (void **)&st->new_relocs, &st->new_reloc_capacity, sizeof(DatRef));
+                if (err) return err;
+            }
+            st->new_relocs[st->new_reloc_count++] = dst_child_ref_offset;
+        }
+    }
+
+    // Objects are allocated past all existing dst data and processed in allocation order,
+    // so the new references are already sorted and follow every existing one.
+    return append_new_relocs(dst, st->new_relocs, st->new_reloc_count);
+}
+
+static DAT_RET dat_obj_copy_inner(DatFile *dst, DatFile *src, DatRef src_ref, DatRef *dst_out) {
     if (dst == NULL) return DAT_ERR_NULL_PARAM;
     if (src == NULL) return DAT_ERR_NULL_PARAM;
     if (src_ref >= src->data_size) return DAT_ERR_OUT_OF_BOUNDS;
-    
-    // Create object list for deduplicating children
-    // TODO: change to hash table or sort - something not O(n)
-    uint32_t object_array_size = src->object_count * sizeof(DatRef);  
-    uint8_t *buf = malloc(object_array_size * 2);
-    DatRef *src_lookup = (DatRef*)buf;
-    DatRef *dst_lookup = (DatRef*)(buf + object_array_size);
-    uint32_t lookup_count = 0;
-    
-    DAT_RET ret = dat_obj_copy_inner(
-        dst, src, src_ref, dst_out,
-        src_lookup, dst_lookup, &lookup_count
-    );
-    
-    free(buf); 
-    
-    return ret;
+    DAT_RET err = DAT_SUCCESS;
+    if (src->flags & DAT_FILE_BUILDING)
+        err = dat_file_finalize(src);
+    if (err) return err;
+    err = dat_file_find_objects(src);
+    if (err) return err;
+
+    DAT_ZONE(zone, "dat_obj_copy");
+    CopyState st = {0};
+    incoming_index_drop(dst);
+    reloc_bitmap_drop(dst);
+    uint32_t first_new_object = dst->object_count;
+    err = copy_objects(dst, src, src_ref, dst_out, &st);
+    if (err == DAT_SUCCESS) objects_refresh(dst, first_new_object);
+    DAT_ZONE_END(zone);
+
+    scratch_free(st.slots);
+    scratch_free(st.queue);
+    scratch_free(st.new_relocs);
+    return err;
+}
+
+DAT_RET dat_obj_copy(DatFile *dst, DatFile *src, DatRef src_ref, DatRef *dst_out) {
+    if (dst == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_STAT_START(start);
+    DAT_RET err = dat_obj_copy_inner(dst, src, src_ref, dst_out);
+    DAT_STAT_END(dst, DatStat_Copy, start);
+    return err;
+}
+
+// PARALLEL COPY ---------------------------------------------------
+
+// Objects per prefix sum chunk are balanced by count, not size,
+// so there are more chunks than threads for workers to claim.
+#define COPY_CHUNKS_PER_THREAD 8
+
+// Below this many copied bytes per thread, threads cost more than they save.
+#define COPY_MIN_BYTES_PER_THREAD (64u << 10)
+
+typedef struct CopyChunk {
+    uint32_t object_begin; // src object indices
+    uint32_t object_end;
+
+    // Sums over the copied objects in the chunk, then the exclusive prefix sums.
+    uint32_t bytes;
+    uint32_t relocs;
+    uint32_t objects;
+} CopyChunk;
+
+typedef struct CopyManyState {
+    DatFile *dst;
+    const DatFile *src;
+    const DatRef *src_refs;
+    uint32_t ref_count;
+    volatile DAT_RET err;
+
+    // Indexed by src object.
+    volatile uint8_t *claimed;
+    uint32_t *relocs;   // number of references in the object, then its first new reloc index
+    DatRef *dst_of;     // dst offset of each copied object
+
+    CopyChunk *chunks;
+    uint32_t chunk_count;
+
+    DatRef *new_relocs;
+    DatSlice *new_objects;
+
+    volatile uint32_t next_ref;
+    volatile uint32_t next_chunk;
+} CopyManyState;
+
+// Discovers every object reachable from src_refs. Workers claim roots, then each object
+// is claimed by the first worker to reach it, so shared objects are only visited once.
+static void copy_discover_worker(void *ctx, uint32_t worker_i) {
+    (void)worker_i;
+    CopyManyState *st = ctx;
+    const DatFile *src = st->src;
+
+    uint32_t *stack = NULL;
+    uint32_t stack_count = 0;
+    uint32_t stack_capacity = 0;
+
+    while (atomic_get_error(&st->err) == DAT_SUCCESS) {
+        uint32_t ref_i = atomic_next(&st->next_ref);
+        if (ref_i >= st->ref_count) break;
+
+        uint32_t root_i = object_idx_of(src, st->src_refs[ref_i]);
+        if (root_i == UINT32_MAX) { atomic_set_error(&st->err, DAT_NOT_FOUND); break; }
+        if (!atomic_claim(&st->claimed[root_i])) continue;
+
+        uint32_t object_i = root_i;
+        while (1) {
+            DatRef end = object_end(src, object_i);
+            uint32_t reloc_count = 0;
+            RelocIter reloc_iter = reloc_iter_object(src, object_i);
+            DatRef reloc;
+            while (reloc_iter_next(&reloc_iter, &reloc) && reloc < end) {
+                reloc_count++;
+                uint32_t child_i = object_idx_of(src, READ_U32(&src->data[reloc]));
+                if (child_i == UINT32_MAX) { atomic_set_error(&st->err, DAT_NOT_FOUND); goto done; }
+                if (!atomic_claim(&st->claimed[child_i])) continue;
+
+                if (stack_count == stack_capacity) {
+                    DAT_RET err = realloc_arr(NULL, (void **)&stack, &stack_capacity, sizeof(uint32_t));
+                    if (err) { atomic_set_error(&st->err, err); goto done; }
+                }
+                stack[stack_count++] = child_i;
+            }
+            st->relocs[object_i] = reloc_count;
+
+            if (stack_count == 0) break;
+            object_i = stack[--stack_count];
+        }
+    }
+
+done:
+    scratch_free(stack);
+}
+
+static void copy_sum_worker(void *ctx, uint32_t worker_i) {
+    (void)worker_i;
+    CopyManyState *st = ctx;
+    const DatFile *src = st->src;
+
+    while (1) {
+        uint32_t chunk_i = atomic_next(&st->next_chunk);
+        if (chunk_i >= st->chunk_count) return;
+
+        CopyChunk *chunk = &st->chunks[chunk_i];
+        for (uint32_t i = chunk->object_begin; i < chunk->object_end; ++i) {
+            if (st->claimed[i] == 0) continue;
+            chunk->bytes += align_forward(src->objects[i].size, 4);
+            chunk->relocs += st->relocs[i];
+            chunk->objects++;
+        }
+    }
+}
+
+// Lays out the chunk's objects from the chunk's prefix sums, the same as dat_obj_alloc would.
+static void copy_assign_worker(void *ctx, uint32_t worker_i) {
+    (void)worker_i;
+    CopyManyState *st = ctx;
+    const DatFile *src = st->src;
+
+    while (1) {
+        uint32_t chunk_i = atomic_next(&st->next_chunk);
+        if (chunk_i >= st->chunk_count) return;
+
+        CopyChunk *chunk = &st->chunks[chunk_i];
+        DatRef dst_offset = chunk->bytes;
+        uint32_t reloc_i = chunk->relocs;
+        uint32_t new_object_i = chunk->objects;
+        for (uint32_t i = chunk->object_begin; i < chunk->object_end; ++i) {
+            if (st->claimed[i] == 0) continue;
+            uint32_t reloc_count = st->relocs[i];
+            st->dst_of[i] = dst_offset;
+            st->relocs[i] = reloc_i;
+            st->new_objects[new_object_i++] = (DatSlice) { dst_offset, align_forward(src->objects[i].size, 4) };
+            dst_offset += align_forward(src->objects[i].size, 4);
+            reloc_i += reloc_count;
+        }
+    }
+}
+
+// Copies the chunk's objects and writes its run of new relocs.
+// Runs are sorted and placed in chunk order, so the merged table is sorted too.
+static void copy_data_worker(void *ctx, uint32_t worker_i) {
+    (void)worker_i;
+    CopyManyState *st = ctx;
+    const DatFile *src = st->src;
+    uint8_t *dst_data = st->dst->data;
+
+    while (1) {
+        uint32_t chunk_i = atomic_next(&st->next_chunk);
+        if (chunk_i >= st->chunk_count) return;
+
+        CopyChunk *chunk = &st->chunks[chunk_i];
+        for (uint32_t i = chunk->object_begin; i < chunk->object_end; ++i) {
+            if (st->claimed[i] == 0) continue;
+
+            DatRef src_offset = src->objects[i].offset;
+            uint32_t size = src->objects[i].size;
+            DatRef end = src_offset + size;
+            DatRef dst_offset = st->dst_of[i];
+            memcpy(&dst_data[dst_offset], &src->data[src_offset], size);
+            memset(&dst_data[dst_offset + size], 0, align_forward(size, 4) - size);
+
+            uint32_t reloc_i = st->relocs[i];
+            RelocIter reloc_iter = reloc_iter_object(src, i);
+            DatRef reloc;
+            while (reloc_iter_next(&reloc_iter, &reloc) && reloc < end) {
+                DatRef target = READ_U32(&src->data[reloc]);
+                uint32_t target_i = object_idx_of(src, target);
+                DatRef dst_reloc = dst_offset + (reloc - src_offset);
+                WRITE_U32(&dst_data[dst_reloc], st->dst_of[target_i] + (target - src->objects[target_i].offset));
+                st->new_relocs[reloc_i++] = dst_reloc;
+            }
+        }
+    }
+}
+
+static DAT_RET dat_obj_copy_many_inner(
+    DatFile *dst, DatFile *src, const DatRef *src_refs, uint32_t count, uint32_t thread_count,
+    DatRef *dst_out
+) {
+    if (dst == NULL) return DAT_ERR_NULL_PARAM;
+    if (src == NULL) return DAT_ERR_NULL_PARAM;
+    if (count == 0) return DAT_SUCCESS;
+    if (src_refs == NULL) return DAT_ERR_NULL_PARAM;
+    if (dst_out == NULL) return DAT_ERR_NULL_PARAM;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (src_refs[i] >= src->data_size) return DAT_ERR_OUT_OF_BOUNDS;
+    }
+
+    DAT_RET err = DAT_SUCCESS;
+    if (src->flags & DAT_FILE_BUILDING)
+        err = dat_file_finalize(src);
+    if (err) return err;
+    err = dat_file_find_objects(src);
+    if (err) return err;
+    if (src->object_count == 0) return DAT_NOT_FOUND;
+    if (thread_count == 0) thread_count = cpu_count();
+    DAT_ZONE(zone, "dat_obj_copy_many");
+
+    uint32_t object_count = src->object_count;
+    uint32_t chunk_count = thread_count * COPY_CHUNKS_PER_THREAD;
+    if (chunk_count > object_count) chunk_count = object_count;
+
+    CopyManyState st = {0};
+    st.dst = dst;
+    st.src = src;
+    st.src_refs = src_refs;
+    st.ref_count = count;
+    st.chunk_count = chunk_count;
+    st.claimed = scratch_calloc(object_count, 1);
+    st.relocs = scratch_alloc(object_count * sizeof(uint32_t));
+    st.dst_of = scratch_alloc(object_count * sizeof(DatRef));
+    st.chunks = scratch_calloc(chunk_count, sizeof(CopyChunk));
+    if (st.claimed == NULL || st.relocs == NULL || st.dst_of == NULL || st.chunks == NULL) {
+        err = DAT_ERR_ALLOCATION_FAILURE;
+        goto cleanup;
+    }
+
+    // plan ----------------------------
+
+    DAT_ZONE(discover_zone, "copy discover");
+    run_workers(thread_count < count ? thread_count : count, copy_discover_worker, &st);
+    DAT_ZONE_END(discover_zone);
+    err = st.err;
+    if (err) goto cleanup;
+
+    for (uint32_t i = 0; i < chunk_count; ++i) {
+        st.chunks[i].object_begin = (uint32_t)((uint64_t)object_count * i / chunk_count);
+        st.chunks[i].object_end = (uint32_t)((uint64_t)object_count * (i+1) / chunk_count);
+    }
+    DAT_ZONE(sum_zone, "copy sum");
+    run_workers(thread_count < chunk_count ? thread_count : chunk_count, copy_sum_worker, &st);
+    DAT_ZONE_END(sum_zone);
+
+    DatRef dst_base = align_forward(dst->data_size, 4);
+    uint64_t total_bytes = 0;
+    uint32_t total_relocs = 0;
+    uint32_t total_objects = 0;
+    for (uint32_t i = 0; i < chunk_count; ++i) {
+        CopyChunk *chunk = &st.chunks[i];
+        uint32_t bytes = chunk->bytes;
+        uint32_t relocs = chunk->relocs;
+        uint32_t objects = chunk->objects;
+        chunk->bytes = (uint32_t)(dst_base + total_bytes);
+        chunk->relocs = total_relocs;
+        chunk->objects = total_objects;
+        total_bytes += bytes;
+        total_relocs += relocs;
+        total_objects += objects;
+    }
+    if (dst_base + total_bytes > UINT32_MAX) {
+        err = DAT_ERR_INVALID_SIZE;
+        goto cleanup;
+    }
+    uint32_t new_data_size = dst_base + (uint32_t)total_bytes;
+
+    // Fewer threads for small copies. Each needs a decent share of the bytes.
+    uint64_t max_threads = total_bytes / COPY_MIN_BYTES_PER_THREAD;
+    if (max_threads == 0) max_threads = 1;
+    if (thread_count > max_threads) thread_count = (uint32_t)max_threads;
+    if (thread_count > chunk_count) thread_count = chunk_count;
+
+    // grow dst ------------------------
+
+    err = detach_patch_data(dst);
+    if (err) goto cleanup;
+    incoming_index_drop(dst);
+    reloc_bitmap_drop(dst);
+
+    while (new_data_size > dst->data_capacity) {
+        err = grow_arr(dst, DAT_FILE_BORROWED_DATA, (void **)&dst->data, &dst->data_capacity, 1);
+        if (err) goto cleanup;
+    }
+    err = reserve_objects(dst, dst->object_count + total_objects);
+    if (err) goto cleanup;
+    st.new_objects = &dst->objects[dst->object_count];
+
+    // Edit mode inserts into the blocks afterwards. Otherwise runs are written straight into
+    // reloc_targets, as every new reference is past the existing data.
+    bool editing = (dst->flags & DAT_FILE_EDITING) != 0;
+    if (editing) {
+        st.new_relocs = scratch_alloc(total_relocs * sizeof(DatRef));
+        if (st.new_relocs == NULL && total_relocs != 0) {
+            err = DAT_ERR_ALLOCATION_FAILURE;
+            goto cleanup;
+        }
+    } else {
+        while (dst->reloc_count + total_relocs > dst->reloc_capacity) {
+            err = grow_arr(dst, DAT_FILE_BORROWED_RELOCS, (void **)&dst->reloc_targets, &dst->reloc_capacity, sizeof(DatRef));
+            if (err) goto cleanup;
+        }
+        st.new_relocs = &dst->reloc_targets[dst->reloc_count];
+    }
+
+    // copy ----------------------------
+
+    DAT_ZONE(copy_zone, "copy data");
+    st.next_chunk = 0;
+    run_workers(thread_count, copy_assign_worker, &st);
+    memset(&dst->data[dst->data_size], 0, dst_base - dst->data_size);
+    st.next_chunk = 0;
+    run_workers(thread_count, copy_data_worker, &st);
+    DAT_ZONE_END(copy_zone);
+
+    dst->data_size = new_data_size;
+    uint32_t first_new_object = dst->object_count;
+    dst->object_count += total_objects;
+    dst->flags |= DAT_FILE_LAYOUT_CHANGED;
+    if (editing) {
+        err = append_new_relocs(dst, st.new_relocs, total_relocs);
+        scratch_free(st.new_relocs);
+        if (err) goto cleanup;
+    } else {
+        dst->reloc_count += total_relocs;
+    }
+    objects_refresh(dst, first_new_object);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t object_i = object_idx_of(src, src_refs[i]);
+        dst_out[i] = st.dst_of[object_i] + (src_refs[i] - src->objects[object_i].offset);
+    }
+
+cleanup:
+    scratch_free((void*)(uintptr_t)st.claimed);
+    scratch_free(st.relocs);
+    scratch_free(st.dst_of);
+    scratch_free(st.chunks);
+    DAT_ZONE_END(zone);
+    return err;
+}
+
+DAT_RET dat_obj_copy_many(
+    DatFile *dst, DatFile *src, const DatRef *src_refs, uint32_t count, uint32_t thread_count,
+    DatRef *dst_out
+) {
+    if (dst == NULL) return DAT_ERR_NULL_PARAM;
+    DAT_STAT_START(start);
+    DAT_RET err = dat_obj_copy_many_inner(dst, src, src_refs, count, thread_count, dst_out);
+    DAT_STAT_END(dst, DatStat_CopyMany, start);
+    return err;
 }
 
 const char *dat_return_string(DAT_RET ret) {
@@ -610,6 +4264,14 @@ const char *dat_return_string(DAT_RET ret) {
             return "alignment is invalid";
         case DAT_ERR_OUT_OF_BOUNDS:
             return "out of bounds";
+        case DAT_ERR_IO:
+            return "could not read or write file";
+        case DAT_ERR_NOT_FINALIZED:
+            return "file is in builder mode, call dat_file_finalize";
+        case DAT_ERR_NOT_PATCHING:
+            return "file was not opened with dat_file_open_patch";
+        case DAT_ERR_OBJECTS_PENDING:
+            return "objects are not built, call dat_file_find_objects";
     }
 
     return "unknown return value";
@@ -617,18 +4279,14 @@ const char *dat_return_string(DAT_RET ret) {
 
 // Returns either the matching index or the insertion index.
 static uint32_t binary_search_refs(const DatRef *refs, uint32_t count, DatRef ref) {
-    uint32_t left = 0;
-    uint32_t right = count;
-    while (left < right) {
-        uint32_t mid = left + count / 2;
-        DatRef m = refs[mid];
+    if (count == 0) return 0;
 
-        if (m < ref) left = mid + 1;
-        else if (m > ref) right = mid;
-        else return mid;
-
-        count = right - left;
+    // Branchless, so the compiler emits a conditional move rather than a hard to predict branch.
+    const DatRef *base = refs;
+    while (count > 1) {
+        uint32_t half = count / 2;
+        base = base[half] < ref ? base + half : base;
+        count -= half;
     }
-    
-    return right;
+    return (uint32_t)(base - refs) + (*base < ref);
 }
@@ -1,6 +1,7 @@
 #ifndef CDAT_H
 #define CDAT_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
@@ -31,6 +32,11 @@
 #define WRITE_U32(ptr, data) (*((uint32_t*)(ptr)) = dat_be32u(data))
 #define WRITE_I32(ptr, data) (*((int32_t*)(ptr)) = (int32_t)dat_be32u(data))
 
+// Byte swaps `count` u32s between big endian and host order.
+// Buffers do not need to be aligned. `dst` and `src` may be equal, but must not otherwise overlap.
+// Uses SSSE3 or AVX2 when the cpu supports them.
+void dat_be32u_array(void *dst, const void *src, uint32_t count);
+
 // TYPES ##########################################################
 
 typedef uint32_t DAT_RET;
@@ -43,6 +49,62 @@ enum DAT_RET_VARIANTS {
     DAT_ERR_INVALID_SIZE,
     DAT_ERR_INVALID_ALIGNMENT,
     DAT_ERR_OUT_OF_BOUNDS,
+    DAT_ERR_IO,
+    DAT_ERR_NOT_FINALIZED,
+    DAT_ERR_NOT_PATCHING,
+    DAT_ERR_OBJECTS_PENDING,
+};
+
+// State stored in DatFile.flags.
+enum DAT_FILE_FLAGS {
+    // Tables that point into the buffer passed to the importer rather than into their own allocations.
+    // These are copied the first time they need to grow.
+    DAT_FILE_BORROWED_DATA      = (1u << 0),
+    DAT_FILE_BORROWED_RELOCS    = (1u << 1),
+    DAT_FILE_BORROWED_ROOTS     = (1u << 2),
+    DAT_FILE_BORROWED_EXTERNS   = (1u << 3),
+    DAT_FILE_BORROWED_SYMBOLS   = (1u << 4),
+
+    // `objects` only contains allocated objects. The rest are found on first use.
+    DAT_FILE_OBJECTS_PENDING    = (1u << 5),
+
+    // Set by dat_file_begin_build. `reloc_targets` is unsorted and may contain duplicates.
+    DAT_FILE_BUILDING           = (1u << 6),
+
+    // Set by dat_file_begin_edit. References live in `reloc_blocks` and `reloc_targets` is stale.
+    DAT_FILE_EDITING            = (1u << 7),
+
+    // `mapping` was allocated with the file's allocator rather than mapped.
+    DAT_FILE_ALLOCATED_MAPPING  = (1u << 8),
+
+    // Opened with dat_file_open_patch.
+    DAT_FILE_PATCHING           = (1u << 9),
+
+    // The data size or a table changed, so dat_file_sync can't patch the file in place.
+    DAT_FILE_LAYOUT_CHANGED     = (1u << 10),
+
+    // Set by dat_file_validate. Cleared by dat_obj_write_* and dat_root_add if they break it,
+    // but not by writing to `data` directly.
+    DAT_FILE_VALIDATED          = (1u << 11),
+};
+
+enum DAT_IMPORT_FLAGS {
+    // Build `objects` during import rather than the first time it is needed.
+    DAT_IMPORT_EAGER_OBJECTS    = (1u << 0),
+
+    // Run dat_file_validate during import, failing if the file is malformed.
+    DAT_IMPORT_VALIDATE         = (1u << 1),
+
+    // Build `reloc_bitmap` during import rather than the first time it is needed.
+    DAT_IMPORT_RELOC_BITMAP     = (1u << 2),
+};
+
+enum DAT_GRAPH_FLAGS {
+    // Visit breadth first rather than depth first.
+    DAT_GRAPH_BFS               = (1u << 0),
+
+    // Don't clear the visited bitmap, so objects already marked in it are skipped.
+    DAT_GRAPH_KEEP_VISITED      = (1u << 1),
 };
 
 typedef uint32_t DatRef;
@@ -63,6 +125,113 @@ typedef struct DatSlice {
     uint32_t size;
 } DatSlice;
 
+// Allocator for everything a DatFile keeps: its tables, indexes, bitmap and patch path.
+// A zeroed DatAllocator uses malloc, realloc and free. Sizes are always passed back,
+// so allocators do not need to track them. Temporary buffers freed before a call returns,
+// such as sort, export and compaction scratch, always use malloc.
+typedef struct DatAllocator {
+    // Returns NULL on failure.
+    void *(*alloc)(void *ctx, size_t size);
+
+    // Like realloc. `ptr` may be NULL. Returns NULL on failure, leaving `ptr` untouched.
+    void *(*realloc)(void *ctx, void *ptr, size_t old_size, size_t new_size);
+
+    // `ptr` may be NULL.
+    void (*free)(void *ctx, void *ptr, size_t size);
+
+    void *ctx;
+} DatAllocator;
+
+// Bump allocator over a caller provided buffer, see dat_arena_allocator.
+// Freeing and growing only reclaim memory for the most recent allocation,
+// so reset the arena between files rather than relying on dat_file_destroy.
+typedef struct DatArena {
+    uint8_t *base;
+    size_t capacity;
+    size_t used;
+    size_t last; // start of the most recent allocation
+} DatArena;
+
+// One file for dat_file_import_many.
+typedef struct DatImportSource {
+    // If not NULL, the file at `path` is imported as by dat_file_import_mapped.
+    const char *path;
+
+    // Otherwise this buffer is imported as by dat_file_import_flags.
+    const uint8_t *buffer;
+    uint32_t buffer_size;
+} DatImportSource;
+
+// Blocked sorted array used for reloc_targets in edit mode. Private to dat.c.
+typedef struct DatRelocBlocks DatRelocBlocks;
+
+// Hash index from symbol name to root or extern index. Private to dat.c.
+typedef struct DatNameIndex DatNameIndex;
+
+// Index from each object to the reference slots pointing into it. Private to dat.c.
+typedef struct DatIncomingIndex DatIncomingIndex;
+
+// One bit per aligned word of data, set for reference slots. Private to dat.c.
+typedef struct DatRelocBitmap DatRelocBitmap;
+
+#ifdef DAT_STATS
+// Operation counters kept in each DatFile when cdat is built with DAT_STATS.
+// Outside Windows, DAT_STATS also needs _POSIX_C_SOURCE >= 199309L for clock_gettime.
+// Only the calling thread records, the worker threads of dat_obj_copy_many do not.
+
+typedef enum DatStatOp {
+    DatStat_Import,
+    DatStat_Export,
+    DatStat_FindObjects,
+    DatStat_Validate,
+    DatStat_Finalize,
+    DatStat_BeginEdit,
+    DatStat_Compact,
+    DatStat_Dedup,
+    DatStat_ObjAlloc,
+    DatStat_SetRef,
+    DatStat_RemoveRef,
+    DatStat_Incoming,
+    DatStat_RootAdd,
+    DatStat_RootRemove,
+    DatStat_Copy,
+    DatStat_CopyMany,
+
+    // Counted but not timed, the clock would cost more than they do.
+    DatStat_Read,
+    DatStat_Write,
+    DatStat_ObjLookup,
+    DatStat_NameLookup,
+
+    DatStat_Count,
+} DatStatOp;
+
+// Calls taking less than 2^(i+1) ns land in latency bucket i. The last bucket takes the rest.
+#define DAT_STAT_BUCKETS 32
+
+typedef struct DatStats {
+    uint64_t calls[DatStat_Count];
+    uint64_t time_ns[DatStat_Count];
+    uint64_t latency[DatStat_Count][DAT_STAT_BUCKETS];
+
+    // Bytes shifted within a table to insert or remove an entry.
+    uint64_t moved_bytes;
+
+    // Times a table outgrew its capacity, and bytes copied to the new allocation.
+    uint64_t grow_count;
+    uint64_t grown_bytes;
+
+    // Binary searches by lookups and reference edits. Searches are branchless,
+    // so searching n entries always takes the same ceil(log2(n)) probes, counted in depth[probes].
+    uint64_t search_count;
+    uint64_t search_misses;
+    uint64_t search_depth[33];
+
+    // Root and extern names that were not found.
+    uint64_t name_misses;
+} DatStats;
+#endif
+
 typedef struct DatFile {
     // everything in here is big endian
     uint8_t *data;
@@ -73,7 +242,13 @@ typedef struct DatFile {
     DatExternInfo *extern_info;
     
     char *symbols;
-    DatRef *objects; // TODO change to slice
+
+    // Sorted by offset. Each object runs up to the next, or to the end of the data.
+    DatSlice *objects;
+
+    // Per object, index into reloc_targets of its first reference, or of the next object's
+    // if it has none. Not kept up to date in builder or edit mode, dat_file_finalize rebuilds it.
+    uint32_t *object_relocs;
 
     uint32_t data_size;
     uint32_t reloc_count;
@@ -87,9 +262,64 @@ typedef struct DatFile {
     uint32_t root_capacity;
     uint32_t extern_capacity;
     uint32_t symbol_capacity;
-    uint32_t object_capacity;
+    uint32_t object_capacity; // of both objects and object_relocs
+
+    // Replaces reloc_targets in edit mode, see dat_file_begin_edit.
+    DatRelocBlocks *reloc_blocks;
+
+    // Built by the first dat_root_find or dat_extern_find.
+    // Kept up to date by dat_root_add and dat_root_remove.
+    DatNameIndex *root_index;
+    DatNameIndex *extern_index;
+
+    // Interned symbol strings, so roots with the same name share a symbol_offset.
+    // Built by the first dat_root_add.
+    DatNameIndex *symbol_set;
+
+    // Built by the first dat_obj_incoming. Kept up to date by dat_obj_alloc, dat_obj_set_ref
+    // and dat_obj_remove_ref. Dropped by anything else that moves objects or references.
+    DatIncomingIndex *incoming_index;
+
+    // Built by dat_file_build_reloc_bitmap. Kept up to date by dat_obj_set_ref and
+    // dat_obj_remove_ref in every mode. Dropped by compacting or copying into the file.
+    DatRelocBitmap *reloc_bitmap;
+
+    DatAllocator allocator;
+
+    // Set by importing. Borrowed tables point into this.
+    void *mapping;
+    uint64_t mapping_size;
+
+    // Set by dat_file_open_patch. `data` points into this writable shared mapping of the file.
+    uint8_t *patch_mapping;
+    char *patch_path;
+
+    #ifdef DAT_STATS
+        DatStats stats;
+    #endif
+
+    uint32_t flags;
 } DatFile;
 
+// Walks the objects reachable from a set of references, see dat_graph_begin.
+// Everything is stored in the iterator and the caller's buffers, so walking never allocates.
+typedef struct DatGraphIter {
+    DatFile *dat;
+    uint8_t *visited;       // one bit per object
+    uint32_t *stack;        // every object is pushed at most once
+    uint32_t head;          // breadth first walks pop from here
+    uint32_t count;
+    uint32_t flags;
+
+    // The object last returned by dat_graph_next, or UINT32_MAX.
+    uint32_t object_idx;
+    DatRef object_end;
+
+    // Position of the next reference in the current object.
+    uint32_t reloc_block;
+    uint32_t reloc_i;
+} DatGraphIter;
+
 // FUNCTIONS ##########################################################
 
 const char *dat_return_string(DAT_RET ret);
@@ -99,36 +329,184 @@ const char *dat_return_string(DAT_RET ret);
 // Creates an empty dat file. Does not allocate.
 DAT_RET dat_file_new(DatFile *dat);
 
+// dat_file_new, with tables allocated by `allocator`. `allocator` is copied into the DatFile.
+DAT_RET dat_file_new_with_allocator(DatFile *dat, const DatAllocator *allocator);
+
 // Frees allocations and zeros struct.
 DAT_RET dat_file_destroy(DatFile *dat);
 
-// `file` can be safely freed after this. All data is copied to internal allocations.
+// `file` can be safely freed after this. The file is copied into one allocation that the
+// tables point into, so they are only copied out the first time they need to grow.
 // The size parameter is the size of the buffer containing the dat file, which must be larger
 // than the internal file size listed in the dat file header.
 // If it is smaller, DAT_ERR_INVALID_SIZE will be returned.
 //
+// `objects` is not built until it is needed, see dat_file_find_objects.
+//
 // You may pass an uninitialized `out` ptr.
 DAT_RET dat_file_import(const uint8_t *file, uint32_t buffer_size, DatFile *out);
 
+// dat_file_import with DAT_IMPORT_FLAGS.
+DAT_RET dat_file_import_flags(const uint8_t *file, uint32_t buffer_size, uint32_t flags, DatFile *out);
+
+// dat_file_import_flags, allocating with `allocator`. Pass NULL for malloc.
+DAT_RET dat_file_import_with_allocator(
+    const uint8_t *file, uint32_t buffer_size, uint32_t flags,
+    const DatAllocator *allocator, DatFile *out
+);
+
+// Maps the file at `path` and points `out` straight into the mapping instead of copying.
+// The mapping is private, so modifications never reach the file on disk.
+// Tables are only copied to their own allocations the first time they need to grow,
+// e.g. by dat_obj_alloc, dat_obj_set_ref or dat_root_add.
+// The mapping is released by dat_file_destroy.
+//
+// Returns DAT_ERR_IO if the file could not be opened or mapped.
+// You may pass an uninitialized `out` ptr.
+DAT_RET dat_file_import_mapped(const char *path, uint32_t flags, DatFile *out);
+
+// Opens the file at `path` for patching in place.
+// `data` points into a writable shared mapping of the file, so writes that keep the layout,
+// such as dat_obj_write_u32 or dat_obj_set_ref on an existing reference, go straight to its pages.
+// Tables are imported from a separate private mapping, the same as dat_file_import_mapped.
+// Call dat_file_sync to save changes. On Windows the file is read instead of mapped,
+// so dat_file_sync always exports the whole file.
+DAT_RET dat_file_open_patch(const char *path, uint32_t flags, DatFile *out);
+
+// Saves a file opened with dat_file_open_patch back to its path.
+// If only data was written, just the dirty pages are flushed.
+// If the layout changed, e.g. by dat_obj_alloc, a new reference or a new root,
+// the whole file is exported as by dat_file_export_path instead, as will every later sync.
+// If `exported` is not NULL, it is set to whether the whole file was exported.
+// Returns DAT_ERR_NOT_PATCHING if the file was not opened with dat_file_open_patch.
+DAT_RET dat_file_sync(DatFile *dat, bool *exported);
+
+// Imports `count` files on a pool of `thread_count` threads, including the calling thread.
+// Pass 0 to use one thread per cpu core.
+// `out[i]` and `errors[i]` are set for `sources[i]`. A file that fails to import is left empty.
+// Returns the error of the first file that failed, or DAT_SUCCESS if every file was imported.
+DAT_RET dat_file_import_many(
+    const DatImportSource *sources, uint32_t count, uint32_t flags, uint32_t thread_count,
+    DatFile *out, DAT_RET *errors
+);
+
+// Checks that every reference slot is 4 byte aligned and in bounds and points in bounds,
+// that every root and extern is 4 byte aligned and in bounds, and that every root
+// and extern symbol is NUL terminated. Reference targets may be unaligned, e.g. strings.
+// Sets DAT_FILE_VALIDATED on success, after which the unchecked accessors below
+// and ML_ReadRef are safe to use on offsets read from references, roots and externs.
+// Returns DAT_ERR_INVALID_ALIGNMENT or DAT_ERR_OUT_OF_BOUNDS for the first failed check.
+DAT_RET dat_file_validate(DatFile *dat);
+
+// Finds every object in the file and fills `objects`.
+// Imports defer this until dat_obj_copy or another call that modifies the file needs it.
+// dat_obj_location and dat_obj_index only read, so call this before them.
+// Does nothing if `objects` is already built.
+DAT_RET dat_file_find_objects(DatFile *dat);
+
 // `dat` must not be NULL or this will crash.
 uint32_t dat_file_export_max_size(const DatFile *dat);
 
 // First call `dat_file_export_max_size`, then pass a buffer of at least that size to `dat_file_export`.
+// Symbol strings no root or extern refers to are dropped from the exported symbol table.
 //
 // UB if size is smaller than what `dat_file_export_max_size` returns!
 DAT_RET dat_file_export(const DatFile *dat, uint8_t *out, uint32_t *size);
 
+// Writes the exported file straight to `fd` without staging the whole file in memory.
+// The data section and symbol table are written directly from `dat`
+// unless unreferenced symbols need to be dropped.
+// Returns DAT_ERR_IO if a write fails.
+DAT_RET dat_file_export_fd(const DatFile *dat, int fd);
+
+// Exports to a temporary file next to `path`, then renames it over `path`.
+// It is safe to export a file imported with dat_file_import_mapped to the path it was mapped from.
+DAT_RET dat_file_export_path(const DatFile *dat, const char *path);
+
+// Also prints the stats of DAT_STATS builds.
 DAT_RET dat_file_debug_print(DatFile *dat);
 
+#ifdef DAT_STATS
+// Prints the counters and the latency histograms of every call made so far.
+void dat_file_print_stats(const DatFile *dat);
+
+// Zeroes the counters, e.g. to leave out importing.
+void dat_file_reset_stats(DatFile *dat);
+#endif
+
+// Uses `buffer` for every allocation made through dat_arena_allocator.
+void dat_arena_init(DatArena *arena, void *buffer, size_t capacity);
+
+// Returns an allocator that allocates from `arena`. Allocations fail once it is full.
+// The arena must outlive every DatFile using it.
+DatAllocator dat_arena_allocator(DatArena *arena);
+
+// Frees every allocation at once. Any DatFile using the arena must not be used afterwards,
+// though it is fine to call dat_file_destroy on it first.
+void dat_arena_reset(DatArena *arena);
+
 // dat files modification -----------------------------------------
 
+// Enters builder mode for adding many references at once.
+// dat_obj_set_ref appends to reloc_targets instead of keeping it sorted,
+// so adding N references is O(N) instead of O(N^2).
+// dat_obj_remove_ref and dat_obj_copy (as the source) call dat_file_finalize first.
+// Exporting returns DAT_ERR_NOT_FINALIZED until dat_file_finalize is called.
+DAT_RET dat_file_begin_build(DatFile *dat);
+
+// Enters edit mode for many scattered reference edits.
+// References are moved from reloc_targets into a blocked sorted array,
+// so dat_obj_set_ref and dat_obj_remove_ref are O(log n) instead of an O(n) memmove.
+// reloc_count stays correct, but reloc_targets is stale until dat_file_finalize.
+// Exporting writes straight from the blocks and does not leave edit mode.
+DAT_RET dat_file_begin_edit(DatFile *dat);
+
+// Leaves builder or edit mode, restoring a sorted and deduplicated reloc_targets.
+// Does nothing in neither mode.
+DAT_RET dat_file_finalize(DatFile *dat);
+
+// Removes every object that can't be reached from a root or extern through references.
+// Live objects slide down to fill the gaps, keeping their alignment up to 32 bytes,
+// and every reference, root and extern is rewritten to match. Leaves builder or edit mode first.
+// If `freed` is not NULL, the number of bytes removed from the data section is put in it.
+DAT_RET dat_file_compact(DatFile *dat, uint32_t *freed);
+
+// Folds identical subgraphs into one copy, then runs dat_file_compact to remove the duplicates.
+// Objects are identical if their bytes match and their references point to the same offsets
+// in identical objects, including through cycles. Objects containing an extern are never folded.
+// If `saved` is not NULL, the number of bytes removed from the data section is put in it.
+DAT_RET dat_file_dedup(DatFile *dat, uint32_t *saved);
+
 // Returns either the matching idx or insertion idx into reloc_targets.
-// Does not check for errors.
+// Does not check for errors. Meaningless in builder or edit mode.
 uint32_t dat_file_reloc_idx(const DatFile *dat, DatRef ref);
 
+// Builds `reloc_bitmap` if needed, for the dat_reloc_* queries below.
+// Also brings its rank entries up to date after references were set or removed.
+// Returns DAT_ERR_OUT_OF_BOUNDS if a reference slot lies past the data.
+DAT_RET dat_file_build_reloc_bitmap(DatFile *dat);
+
+// These need `reloc_bitmap` built and do not check for errors. They work in every mode.
+// After setting or removing references, the next dat_reloc_rank or dat_reloc_select updates
+// the rank entries. Call dat_file_build_reloc_bitmap first to query from several threads.
+
+// Returns whether the aligned word containing `ptr` is a reference slot.
+bool dat_reloc_is_slot(const DatFile *dat, DatRef ptr);
+
+// Returns the number of reference slots before `ptr`.
+// Outside builder and edit mode, this is the same as dat_file_reloc_idx.
+uint32_t dat_reloc_rank(const DatFile *dat, DatRef ptr);
+
+// Returns the reference slot with `rank` slots before it. `rank` must be less than the number of slots.
+DatRef dat_reloc_select(const DatFile *dat, uint32_t rank);
+
+// Returns the first reference slot at or after `ptr`, or UINT32_MAX if there are none.
+DatRef dat_reloc_next(const DatFile *dat, DatRef ptr);
+
 // Allocated object is uninitialized.
 DAT_RET dat_obj_alloc(DatFile *dat, uint32_t size, DatRef *out);
 DAT_RET dat_obj_set_ref(DatFile *dat, DatRef from, DatRef to);
+// Returns DAT_NOT_FOUND if `from` is not a reference.
 DAT_RET dat_obj_remove_ref(DatFile *dat, DatRef from);
 DAT_RET dat_obj_read_ref(DatFile *dat, DatRef ptr, DatRef *out);
 
@@ -142,8 +520,18 @@ DAT_RET dat_obj_write_u8(DatFile *dat, DatRef ptr, uint8_t num);
 
 // Places the ptr and size of the object containing the passed ptr in out.
 // Returns DAT_NOT_FOUND if a surrounding object is not found.
+// Returns DAT_ERR_OBJECTS_PENDING until dat_file_find_objects has built `objects`.
 DAT_RET dat_obj_location(const DatFile *dat, DatRef ptr, DatSlice *out);
 
+// Like dat_obj_location, but places the index into `objects` and `object_relocs` in out.
+DAT_RET dat_obj_index(const DatFile *dat, DatRef ptr, uint32_t *out);
+
+// Places the reference slots pointing into the object containing `ptr` in `out`, sorted by offset.
+// `out` points into `incoming_index`, so it is not copied and is only valid until references change.
+// Builds `objects` and `incoming_index` first if needed.
+// Returns DAT_NOT_FOUND if a surrounding object is not found.
+DAT_RET dat_obj_incoming(DatFile *dat, DatRef ptr, const DatRef **out, uint32_t *count);
+
 // Inserts the object as a root at the specified index. 
 // Appends if `index` == `root_count`.
 DAT_RET dat_root_add(DatFile *dat, uint32_t index, DatRef root_obj, const char *symbol);
@@ -152,10 +540,67 @@ DAT_RET dat_root_add(DatFile *dat, uint32_t index, DatRef root_obj, const char *
 DAT_RET dat_root_remove(DatFile *dat, uint32_t root_index);
 
 // Returns DAT_NOT_FOUND if the dat file does not contain a root with this name.
+// If several roots share a name, the first is found.
 DAT_RET dat_root_find(DatFile *dat, const char *root_name, DatRef *out);
 
+// Like dat_root_find, but puts the index into root_info in `out`.
+DAT_RET dat_root_find_idx(DatFile *dat, const char *root_name, uint32_t *out);
+
+// Returns DAT_NOT_FOUND if the dat file does not contain an extern with this name.
+DAT_RET dat_extern_find(DatFile *dat, const char *extern_name, DatRef *out);
+
 // Copies the source object and all its children to the reference destination dat file.
 // Puts a reference to the copied object in dst_out.
 DAT_RET dat_obj_copy(DatFile *dst, DatFile *src, DatRef src_ref, DatRef *dst_out);
 
+// Copies the objects at each of `src_refs` and all their children into `dst`,
+// using `thread_count` threads including the calling thread. Pass 0 to use one per cpu core.
+// Puts a reference to the copy of `src_refs[i]` in `dst_out[i]`.
+// Unlike calling dat_obj_copy for each ref, objects reachable from several refs are copied once.
+// Copied objects keep their order from `src`. `dst` is unchanged if a reference can not be followed.
+DAT_RET dat_obj_copy_many(
+    DatFile *dst, DatFile *src, const DatRef *src_refs, uint32_t count, uint32_t thread_count,
+    DatRef *dst_out
+);
+
+// graph walking -----------------------------------------------
+
+// Builds `objects` and places the sizes needed for dat_graph_begin's buffers in the outs:
+// bytes for the visited bitmap and entries for the stack.
+DAT_RET dat_graph_buffer_sizes(DatFile *dat, uint32_t *visited_size, uint32_t *stack_count);
+
+// Starts a walk from the objects containing each of `starts`,
+// or from every root and extern if `starts` is NULL.
+// `visited` and `stack` are sized with dat_graph_buffer_sizes. `flags` are DAT_GRAPH_FLAGS.
+// `dat` must not change until the walk is done.
+// Returns DAT_ERR_OUT_OF_BOUNDS if one of `starts` is past the end of the data,
+// or DAT_NOT_FOUND if it is not in an object.
+DAT_RET dat_graph_begin(
+    DatGraphIter *it, DatFile *dat, const DatRef *starts, uint32_t start_count, uint32_t flags,
+    uint8_t *visited, uint32_t *stack
+);
+
+// Places the next unvisited object in `out` and returns true, or returns false when done.
+// Its index is in it->object_idx.
+bool dat_graph_next(DatGraphIter *it, DatSlice *out);
+
+// Places the next reference out of the object last returned by dat_graph_next in the outs
+// and returns true, or returns false when there are none left. Either out may be NULL.
+// Edges are followed whether or not they are visited with this.
+bool dat_graph_next_edge(DatGraphIter *it, DatRef *from, DatRef *to);
+
+// unchecked accessors -----------------------------------------
+
+// No NULL, alignment or bounds checks, see dat_file_validate.
+// Writes do not clear DAT_FILE_VALIDATED.
+
+static inline uint32_t dat_obj_read_u32_unchecked(const DatFile *dat, DatRef ptr) { return READ_U32(&dat->data[ptr]); }
+static inline uint16_t dat_obj_read_u16_unchecked(const DatFile *dat, DatRef ptr) { return READ_U16(&dat->data[ptr]); }
+static inline uint8_t  dat_obj_read_u8_unchecked (const DatFile *dat, DatRef ptr) { return dat->data[ptr]; }
+static inline DatRef   dat_obj_read_ref_unchecked(const DatFile *dat, DatRef ptr) { return READ_U32(&dat->data[ptr]); }
+
+static inline void dat_obj_write_u32_unchecked(DatFile *dat, DatRef ptr, uint32_t num) { WRITE_U32(&dat->data[ptr], num); }
+static inline void dat_obj_write_u16_unchecked(DatFile *dat, DatRef ptr, uint16_t num) { WRITE_U16(&dat->data[ptr], num); }
+static inline void dat_obj_write_u8_unchecked (DatFile *dat, DatRef ptr, uint8_t num)  { dat->data[ptr] = num; }
+
 #endif
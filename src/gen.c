@@ -0,0 +1,200 @@
+#include "utils.h"
+
+#include "dat.h"
+#include "dat.c"
+#include "gen.h"
+
+#include <time.h>
+
+static const char *HELP = "\
+USAGE:\n\
+    dat_gen -o <output.dat> [flags]\n\
+\n\
+Writes a synthetic dat file. The same flags always write the same file.\n\
+\n\
+OPTIONAL FLAGS:\n\
+    -h                   : Show dat_gen usage.\n\
+    -q                   : Do not print to stdout.\n\
+    -seed <n>            : Random seed. Is 1 by default.\n\
+    -objects <n>         : Number of objects. Is 100000 by default.\n\
+    -roots <n>           : Number of roots. Is 100 by default.\n\
+    -min-size <bytes>    : Smallest object size, a multiple of 4. Is 8 by default.\n\
+    -max-size <bytes>    : Largest object size, a multiple of 4. Is 256 by default.\n\
+    -sizes <uniform|log> : Object size distribution. Is 'log' by default.\n\
+    -fanout <n>          : Mean number of new objects each object references. Is 2 by default.\n\
+    -share <n>           : Mean number of extra references to later objects. Is 0.25 by default.\n\
+    -cycles <chance>     : Chance for each object to reference an ancestor. Is 0.01 by default.\n\
+";
+
+// ARGS --------------------------------------------------------------
+
+enum ArgFlags {
+    Arg_Help        = (1ul << 0),
+    Arg_Quiet       = (1ul << 1),
+};
+
+typedef struct Args {
+    const char *output_dat_path;  // -o
+    const char *seed;             // -seed
+    const char *objects;          // -objects
+    const char *roots;            // -roots
+    const char *min_size;         // -min-size
+    const char *max_size;         // -max-size
+    const char *sizes;            // -sizes
+    const char *fanout;           // -fanout
+    const char *share;            // -share
+    const char *cycles;           // -cycles
+
+    uint64_t flags;
+} Args;
+
+static Args args;
+static NoArgFlag no_arg_flags[] = {
+    { "-h", Arg_Help },
+    { "-q", Arg_Quiet },
+};
+static SingleArgFlag single_arg_flags[] = {
+    { "-o", &args.output_dat_path },
+    { "-seed", &args.seed },
+    { "-objects", &args.objects },
+    { "-roots", &args.roots },
+    { "-min-size", &args.min_size },
+    { "-max-size", &args.max_size },
+    { "-sizes", &args.sizes },
+    { "-fanout", &args.fanout },
+    { "-share", &args.share },
+    { "-cycles", &args.cycles },
+};
+
+static bool parse_u64(const char *flag, const char *arg, uint64_t max, uint64_t *out) {
+    if (arg == NULL) return false;
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(arg, &end, 0);
+    if (errno != 0 || *end != 0 || end == arg || n > max) {
+        fprintf(stderr, ERROR_STR "Invalid number '%s' passed to '%s'.\n", arg, flag);
+        return true;
+    }
+    *out = n;
+    return false;
+}
+
+static bool parse_u32(const char *flag, const char *arg, uint32_t *out) {
+    uint64_t n = *out;
+    bool err = parse_u64(flag, arg, UINT32_MAX, &n);
+    *out = (uint32_t)n;
+    return err;
+}
+
+static bool parse_f32(const char *flag, const char *arg, float *out) {
+    if (arg == NULL) return false;
+    char *end;
+    float n = strtof(arg, &end);
+    if (*end != 0 || end == arg || !(n >= 0.0f)) {
+        fprintf(stderr, ERROR_STR "Invalid number '%s' passed to '%s'.\n", arg, flag);
+        return true;
+    }
+    *out = n;
+    return false;
+}
+
+static GenParams parse_args(int argc, const char *argv[]) {
+    if (argc == 1) {
+        printf("%s", HELP);
+        exit(0);
+    }
+
+    read_args(
+        argc, argv, &args.flags,
+        no_arg_flags, countof(no_arg_flags),
+        single_arg_flags, countof(single_arg_flags),
+        NULL, 0
+    );
+
+    if (args.flags & Arg_Help) {
+        printf("%s", HELP);
+        exit(0);
+    }
+
+    GenParams params = gen_default_params;
+    bool err = false;
+    bool print_usage = false;
+
+    if (args.output_dat_path == NULL) {
+        fprintf(stderr, ERROR_STR "No output dat path passed! Use '-o' to pass an output dat path.\n");
+        print_usage = true;
+        err = true;
+    }
+
+    err |= parse_u64("-seed", args.seed, UINT64_MAX, &params.seed);
+    err |= parse_u32("-objects", args.objects, &params.object_count);
+    err |= parse_u32("-roots", args.roots, &params.root_count);
+    err |= parse_u32("-min-size", args.min_size, &params.min_size);
+    err |= parse_u32("-max-size", args.max_size, &params.max_size);
+    err |= parse_f32("-fanout", args.fanout, &params.fanout);
+    err |= parse_f32("-share", args.share, &params.share);
+    err |= parse_f32("-cycles", args.cycles, &params.cycles);
+
+    if (args.sizes != NULL) {
+        if (strcmp(args.sizes, "uniform") == 0) {
+            params.sizes = Gen_SizesUniform;
+        } else if (strcmp(args.sizes, "log") == 0) {
+            params.sizes = Gen_SizesLog;
+        } else {
+            fprintf(stderr, ERROR_STR "Unknown size distribution '%s'. Use 'uniform' or 'log'.\n", args.sizes);
+            err = true;
+        }
+    }
+
+    if (params.root_count == 0 || params.root_count > params.object_count) {
+        fprintf(stderr, ERROR_STR "The root count must be between 1 and the object count.\n");
+        err = true;
+    }
+    if (params.min_size < 4 || params.min_size > params.max_size || ((params.min_size | params.max_size) & 3)) {
+        fprintf(stderr, ERROR_STR "Object sizes must be multiples of 4, with 4 <= min <= max.\n");
+        err = true;
+    }
+    if (params.fanout < 1.0f) {
+        fprintf(stderr, ERROR_STR "The fanout must be at least 1, or some objects would be unreachable.\n");
+        err = true;
+    }
+
+    if (print_usage)
+        fprintf(stderr, "\n%s", HELP);
+
+    if (err)
+        exit(1);
+
+    return params;
+}
+
+int main(int argc, const char *argv[]) {
+    GenParams params = parse_args(argc, argv);
+    bool quiet = args.flags & Arg_Quiet;
+
+    clock_t start = clock();
+    DatFile dat;
+    GenStats stats;
+    DAT_RET err = gen_file(&params, &dat, &stats);
+    if (err != DAT_SUCCESS) {
+        fprintf(stderr, ERROR_STR "Could not generate dat file: %s\n", dat_return_string(err));
+        return 1;
+    }
+
+    err = dat_file_export_path(&dat, args.output_dat_path);
+    if (err != DAT_SUCCESS) {
+        fprintf(stderr, ERROR_STR "Could not write dat file '%s': %s\n", args.output_dat_path, dat_return_string(err));
+        return 1;
+    }
+
+    if (!quiet) {
+        printf("%s: %u objects, %u roots, %u references, %u bytes of data in %.2fs\n",
+            args.output_dat_path, params.object_count, params.root_count, stats.ref_count,
+            dat.data_size, (double)(clock() - start) / CLOCKS_PER_SEC);
+        if (stats.dropped_refs)
+            printf("%u references did not fit in their objects\n", stats.dropped_refs);
+    }
+
+    dat_file_destroy(&dat);
+    return 0;
+}
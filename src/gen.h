@@ -0,0 +1,207 @@
+#ifndef GEN_H_
+#define GEN_H_
+
+// Deterministic synthetic dat files, for benchmarks and scaling tests.
+// Include after dat.c.
+
+typedef enum GenSizes {
+    Gen_SizesUniform,   // every multiple of 4 between min and max is equally likely
+    Gen_SizesLog,       // every power of two between min and max is equally likely
+} GenSizes;
+
+typedef struct GenParams {
+    uint64_t seed;
+    uint32_t object_count;
+    uint32_t root_count;        // the first objects, named "root_<n>"
+    uint32_t min_size;          // bytes, multiples of 4, at least 4
+    uint32_t max_size;
+    GenSizes sizes;
+
+    // Every object other than a root is referenced by an earlier object, so every object is
+    // reachable. `fanout` is the mean number of objects each object is the first to reference.
+    float fanout;
+
+    // Mean number of extra references from each object to a random later object.
+    // These make the graph a DAG rather than a forest, and make copies share objects.
+    float share;
+
+    // Chance for each object to also reference one of its ancestors, closing a cycle.
+    float cycles;
+} GenParams;
+
+static const GenParams gen_default_params = {
+    .seed = 1,
+    .object_count = 100000,
+    .root_count = 100,
+    .min_size = 8,
+    .max_size = 256,
+    .sizes = Gen_SizesLog,
+    .fanout = 2.0f,
+    .share = 0.25f,
+    .cycles = 0.01f,
+};
+
+typedef struct GenStats {
+    uint32_t ref_count;
+    uint32_t dropped_refs;  // references that did not fit in their object
+} GenStats;
+
+// splitmix64, so nearby seeds give unrelated files.
+static uint64_t gen_rand(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Uniform in [0, n). n must not be 0.
+static uint32_t gen_below(uint64_t *state, uint32_t n) {
+    return (uint32_t)(((gen_rand(state) >> 32) * n) >> 32);
+}
+
+// Uniform in [0, 1).
+static float gen_unit(uint64_t *state) {
+    return (float)(gen_rand(state) >> 40) * (1.0f / 16777216.0f);
+}
+
+// Rounds `mean` up or down at random so the average is `mean`.
+static uint32_t gen_count(uint64_t *state, float mean) {
+    uint32_t whole = (uint32_t)mean;
+    return whole + (gen_unit(state) < mean - (float)whole);
+}
+
+// Index of the highest set bit. n must not be 0.
+static uint32_t gen_log2(uint32_t n) {
+    uint32_t bit = 0;
+    while (n >>= 1) bit++;
+    return bit;
+}
+
+static uint32_t gen_size(uint64_t *state, const GenParams *params) {
+    uint32_t min = params->min_size;
+    uint32_t max = params->max_size;
+    if (params->sizes == Gen_SizesLog) {
+        uint32_t lo_bit = gen_log2(min);
+        uint32_t hi_bit = gen_log2(max);
+        uint32_t bit = lo_bit + gen_below(state, hi_bit - lo_bit + 1);
+        min = (1u << bit) > min ? (1u << bit) : min;
+        max = bit < 31 && (2u << bit) - 4 < max ? (2u << bit) - 4 : max;
+    }
+    return min + gen_below(state, (max - min) / 4 + 1) * 4;
+}
+
+// Takes the next free reference slot of `obj`, or returns false if it is full.
+static bool gen_slot(uint32_t *used, const uint32_t *sizes, uint32_t obj, uint32_t *slot) {
+    if ((used[obj] + 1) * 4 > sizes[obj]) return false;
+    *slot = used[obj]++ * 4;
+    return true;
+}
+
+// Builds a new file in `out` from `params`. The same params always give the same file.
+static DAT_RET gen_file(const GenParams *params, DatFile *out, GenStats *stats) {
+    uint32_t count = params->object_count;
+    if (params->root_count == 0 || params->root_count > count) return DAT_ERR_INVALID_SIZE;
+    if (params->min_size < 4 || params->min_size > params->max_size) return DAT_ERR_INVALID_SIZE;
+    if ((params->min_size | params->max_size) & 3) return DAT_ERR_INVALID_ALIGNMENT;
+
+    uint64_t state = params->seed;
+    *stats = (GenStats) { 0 };
+
+    DatRef *offsets = malloc(count * sizeof(DatRef));
+    uint32_t *sizes = malloc(count * sizeof(uint32_t));
+    uint32_t *parents = malloc(count * sizeof(uint32_t));
+    uint32_t *children_left = malloc(count * sizeof(uint32_t));
+    uint32_t *used = calloc(count, sizeof(uint32_t));
+    DAT_RET err = DAT_ERR_ALLOCATION_FAILURE;
+    if (!offsets || !sizes || !parents || !children_left || !used) goto cleanup;
+
+    err = dat_file_new(out);
+    if (err) goto cleanup;
+
+    // Fill each object with noise. References are written over it below.
+    for (uint32_t i = 0; i < count; ++i) {
+        sizes[i] = gen_size(&state, params);
+        children_left[i] = gen_count(&state, params->fanout);
+        err = dat_obj_alloc(out, sizes[i], &offsets[i]);
+        if (err) goto destroy;
+        for (uint32_t k = 0; k < sizes[i]; k += 4)
+            WRITE_U32(&out->data[offsets[i] + k], (uint32_t)gen_rand(&state));
+    }
+
+    err = dat_file_begin_build(out);
+    if (err) goto destroy;
+
+    // Spanning forest: objects take parents in order, so the first references are breadth first.
+    uint32_t parent = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        parents[i] = UINT32_MAX;
+        if (i < params->root_count) continue;
+
+        while (parent < i && children_left[parent] == 0) parent++;
+        uint32_t p = parent;
+        uint32_t slot;
+        if (p == i || !gen_slot(used, sizes, p, &slot)) {
+            // Ran out of planned children. Take any earlier object with room.
+            for (p = i - 1; !gen_slot(used, sizes, p, &slot); --p) {
+                if (p == 0) { err = DAT_ERR_INVALID_SIZE; goto destroy; }
+            }
+        } else {
+            children_left[p]--;
+        }
+
+        parents[i] = p;
+        err = dat_obj_set_ref(out, offsets[p] + slot, offsets[i]);
+        if (err) goto destroy;
+        stats->ref_count++;
+    }
+
+    // Sharing and cycles.
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t share = i + 1 < count ? gen_count(&state, params->share) : 0;
+        for (uint32_t k = 0; k < share; ++k) {
+            uint32_t target = i + 1 + gen_below(&state, count - i - 1);
+            uint32_t slot;
+            if (!gen_slot(used, sizes, i, &slot)) { stats->dropped_refs += share - k; break; }
+            err = dat_obj_set_ref(out, offsets[i] + slot, offsets[target]);
+            if (err) goto destroy;
+            stats->ref_count++;
+        }
+
+        if (parents[i] != UINT32_MAX && gen_unit(&state) < params->cycles) {
+            uint32_t ancestor = parents[i];
+            for (uint32_t up = gen_below(&state, 8); up != 0 && parents[ancestor] != UINT32_MAX; --up)
+                ancestor = parents[ancestor];
+            uint32_t slot;
+            if (!gen_slot(used, sizes, i, &slot)) {
+                stats->dropped_refs++;
+                continue;
+            }
+            err = dat_obj_set_ref(out, offsets[i] + slot, offsets[ancestor]);
+            if (err) goto destroy;
+            stats->ref_count++;
+        }
+    }
+
+    err = dat_file_finalize(out);
+    if (err) goto destroy;
+
+    for (uint32_t i = 0; i < params->root_count; ++i) {
+        char name[32];
+        snprintf(name, sizeof(name), "root_%u", i);
+        err = dat_root_add(out, i, offsets[i], name);
+        if (err) goto destroy;
+    }
+    goto cleanup;
+
+destroy:
+    dat_file_destroy(out);
+cleanup:
+    free(offsets);
+    free(sizes);
+    free(parents);
+    free(children_left);
+    free(used);
+    return err;
+}
+
+#endif
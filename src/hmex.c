@@ -3,13 +3,6 @@
 #include "dat.h"
 #include "dat.c"
 
-#ifdef TRACY_ENABLE
-    #include "TracyC.h"
-#else
-    #define tracy_start(x)
-    #define tracy_end
-#endif
-
 #define MAX_CMD_LEN 8192
 #define MAX_PATH_LEN 4096
 #define MAX_RELOC_COUNT (1024*1024)
@@ -305,6 +298,7 @@ int main(int argc, const char *argv[]) {
     #endif
 
     // compile c files
+    DAT_ZONE(compile_zone, "compile");
     char **objs = malloc(args.input_filepaths_count * sizeof(*objs));
     {
         char *cmd = malloc(MAX_CMD_LEN);
@@ -349,34 +343,31 @@ int main(int argc, const char *argv[]) {
         
         free(cmd);
     }
+    DAT_ZONE_END(compile_zone);
     
     if (args.flags & Arg_NoLink)
         return 0;
     
     // import input dat file
+    DAT_ZONE(import_zone, "import dat");
     DatFile dat;
     {
         if (args.input_dat_path != NULL) {
-            uint8_t *input_dat_bytes;
-            uint64_t size;
-            if (read_file(args.input_dat_path, &input_dat_bytes, &size))
-                exit(1);
-
-            if (dat_file_import(input_dat_bytes, (uint32_t)size, &dat) != DAT_SUCCESS) {
+            if (dat_file_import_mapped(args.input_dat_path, 0, &dat) != DAT_SUCCESS) {
                 fprintf(stderr,
                     ERROR_STR "Could not import dat file '%s'. File is not a dat file or is malformed.\n",
                     args.input_dat_path
                 );
                 exit(1);
             }
-
-            free(input_dat_bytes);
         } else {
             dat_expect(dat_file_new(&dat));
         }
     }
+    DAT_ZONE_END(import_zone);
 
     // parse melee link table file
+    DAT_ZONE(link_table_zone, "parse link table");
     Map link_map = map_alloc(LINK_ENTRY_MAP_BITS);
     if (args.link_table_path) {
         uint8_t *lt;
@@ -450,8 +441,10 @@ int main(int argc, const char *argv[]) {
 
         free(lt);
     }
+    DAT_ZONE_END(link_table_zone);
     
     // read and parse compiled object files
+    DAT_ZONE(elf_zone, "parse elf");
     Elf *elfs = malloc(args.input_filepaths_count * sizeof(*elfs));
     {
         bool read_err = false;
@@ -525,8 +518,10 @@ int main(int argc, const char *argv[]) {
         if (read_err)
             exit(1);
     }
+    DAT_ZONE_END(elf_zone);
     
     // add sections to dat
+    DAT_ZONE(sections_zone, "add sections");
     DatRef code_offset;
     DatRef code_size;
     {
@@ -569,8 +564,10 @@ int main(int argc, const char *argv[]) {
         
         free(code);
     }
+    DAT_ZONE_END(sections_zone);
     
     // add symbols to link table
+    DAT_ZONE(symbols_zone, "link symbols");
     for (uint32_t elf_i = 0; elf_i < args.input_filepaths_count; ++elf_i) {
         Elf *elf = &elfs[elf_i];
         uint8_t *data = elf->data;
@@ -601,8 +598,10 @@ int main(int argc, const char *argv[]) {
             map_insert(&link_map, map_hash_str((char*)sym_name), offset_in_code);
         }
     }
+    DAT_ZONE_END(symbols_zone);
     
     // parse symbol table file
+    DAT_ZONE(symbol_table_zone, "parse symbol table");
     uint8_t **symbol_table;
     {
         uint8_t *st;
@@ -611,8 +610,10 @@ int main(int argc, const char *argv[]) {
             exit(1);
         symbol_table = read_lines(st, st_size);
     }
+    DAT_ZONE_END(symbol_table_zone);
     
     // relocate 
+    DAT_ZONE(relocate_zone, "relocate");
     MEXReloc *reloc = malloc(MAX_RELOC_COUNT * sizeof(MEXReloc));
     uint64_t reloc_count = 0;
     bool link_err = false;
@@ -710,8 +711,10 @@ int main(int argc, const char *argv[]) {
         }
         exit(1);
     }
+    DAT_ZONE_END(relocate_zone);
     
     // find mex functions
+    DAT_ZONE(functions_zone, "find mex functions");
     MEXSymbol *fn_table = malloc(MAX_FN_COUNT * sizeof(MEXSymbol));
     uint64_t fn_count = 0;
     {
@@ -746,8 +749,10 @@ int main(int argc, const char *argv[]) {
         if (find_err)
             exit(1);
     }
+    DAT_ZONE_END(functions_zone);
 
     // write dat file
+    DAT_ZONE(write_zone, "write dat");
     {
         // alloc and write relocation table.
         DatRef reloc_table_offset;
@@ -789,17 +794,22 @@ int main(int argc, const char *argv[]) {
         dat_expect(dat_obj_write_u32(&dat, fn_obj + 0x18, 0)); // debug symbol num
         dat_expect(dat_obj_write_u32(&dat, fn_obj + 0x1C, 0)); // debug symbol ptr
     }
+    DAT_ZONE_END(write_zone);
 
     // export!
+    DAT_ZONE(export_zone, "export");
     {
-        uint32_t dat_max_size = dat_file_export_max_size(&dat);
-        uint8_t *outbuf = malloc(dat_max_size);
-        uint32_t dat_size;
-        dat_expect(dat_file_export(&dat, outbuf, &dat_size));
-
-        if (write_file(args.output_dat_path, outbuf, dat_size))
+        DAT_RET err = dat_file_export_path(&dat, args.output_dat_path);
+        if (err != DAT_SUCCESS) {
+            fprintf(stderr,
+                ERROR_STR "Could not write dat file '%s': %s\n",
+                args.output_dat_path,
+                dat_return_string(err)
+            );
             exit(1);
+        }
     }
+    DAT_ZONE_END(export_zone);
     
     return 0;
 }
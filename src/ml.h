@@ -30,6 +30,14 @@ static inline int16_t  ML_ReadI16(ML_I16 n) { return (int16_t)dat_be16u((uint16_
 static inline uint8_t  ML_ReadU8 (ML_U8  n) { return n; }
 static inline int8_t   ML_ReadI8 (ML_I8  n) { return n; }
 
+// Bulk conversions. `out` may be the same buffer as `in`.
+static inline void ML_ReadU32Array(uint32_t *out, const ML_U32 *in, uint32_t count) { dat_be32u_array(out, in, count); }
+static inline void ML_ReadI32Array(int32_t  *out, const ML_I32 *in, uint32_t count) { dat_be32u_array(out, in, count); }
+static inline void ML_ReadF32Array(float    *out, const ML_F32 *in, uint32_t count) { dat_be32u_array(out, in, count); }
+static inline void ML_WriteU32Array(ML_U32 *out, const uint32_t *in, uint32_t count) { dat_be32u_array(out, in, count); }
+static inline void ML_WriteI32Array(ML_I32 *out, const int32_t  *in, uint32_t count) { dat_be32u_array(out, in, count); }
+static inline void ML_WriteF32Array(ML_F32 *out, const float    *in, uint32_t count) { dat_be32u_array(out, in, count); }
+
 static inline void *ML_ReadDatRef(DatFile *file, DatRef ref) {
     return (void *)(file->data + ref);
 }
@@ -38,6 +46,7 @@ static inline DatRef ML_AsDatRef(ML_Ref ref) {
     return (DatRef)ML_ReadU32(ref.offset);
 }
 
+// Unchecked. Only safe for references read from a file that passed dat_file_validate.
 static inline void *ML_ReadRef(DatFile *file, ML_Ref ref) {
     return ML_ReadDatRef(file, ML_AsDatRef(ref));
 }
@@ -12,36 +12,38 @@ USAGE:\n\
         Extract a root from a dat file into its own file.\n\
     dat_mod insert <dat file> <input dat file>\n\
         Copy roots from one dat file into another.\n\
+    dat_mod compact <dat file>\n\
+        Remove objects that are unreachable from any root or extern.\n\
+    dat_mod dedup <dat file>\n\
+        Merge identical objects and subgraphs, then compact.\n\
+    dat_mod stats <dat file>\n\
+        Read every object, reference and root, then print cdat's operation counters.\n\
+        Needs a build with DAT_STATS, see './build.sh stats'.\n\
 "
 
 DatFile read_dat(const char *path) {
     DatFile dat;
-    uint8_t *file;
-    uint64_t file_size;
-    if (read_file(path, &file, &file_size)) {
+    DAT_RET err = dat_file_import_mapped(path, 0, &dat);
+    if (err != DAT_SUCCESS) {
+        fprintf(stderr, ERROR_STR "Could not import dat file '%s': %s\n", path, dat_return_string(err));
         exit(1);
-    } else {
-        dat_file_import(file, (uint32_t)file_size, &dat);
     }
     
     return dat;
 }
 
 void write_dat(DatFile *dat, const char *path) {
-    uint32_t max_size = dat_file_export_max_size(dat);
-    uint8_t *buf = malloc(max_size);
-    uint32_t export_size;
-    dat_file_export(dat, buf, &export_size);
-    if (write_file(path, buf, export_size))
+    DAT_RET err = dat_file_export_path(dat, path);
+    if (err != DAT_SUCCESS) {
+        fprintf(stderr, ERROR_STR "Could not write dat file '%s': %s\n", path, dat_return_string(err));
         exit(1);
+    }
 }
 
 DatRootInfo *find_root(DatFile *dat, const char *root_name) {
-    for (int64_t root_i = 0; root_i < dat->root_count; ++root_i) {
-        DatRootInfo *r = &dat->root_info[root_i];
-        if (strcmp(root_name, dat->symbols + r->symbol_offset) == 0)
-            return r;
-    }
+    uint32_t root_i;
+    if (dat_root_find_idx(dat, root_name, &root_i) == DAT_SUCCESS)
+        return &dat->root_info[root_i];
     
     fprintf(stderr, ERROR_STR "root '%s' not found.\n", root_name);
     exit(1);
@@ -94,12 +96,15 @@ int main(int argc, const char *argv[]) {
             }
             
             // find object
-            DatSlice object;
-            DAT_RET err = dat_obj_location(&dat, offset, &object);
+            dat_expect(dat_file_find_objects(&dat));
+            uint32_t object_idx;
+            DAT_RET err = dat_obj_index(&dat, offset, &object_idx);
             if (err != DAT_SUCCESS) {
                 fprintf(stderr, ERROR_STR "no object at offset %s\n", offset_str);
                 exit(1);
             }
+            DatSlice object = dat.objects[object_idx];
+            dat_expect(dat_file_build_reloc_bitmap(&dat));
             
             DatRef i = object.offset;
             for (uint32_t o = 0; o < i%4; ++o) printf("  ");
@@ -111,14 +116,7 @@ int main(int argc, const char *argv[]) {
                 uint32_t word;
                 dat_expect(dat_obj_read_u32(&dat, i, &word));
                 
-                // check is reference
-                bool is_ref = false;
-                for (uint32_t reloc_i = 0; reloc_i < dat.reloc_count; ++reloc_i) {
-                    if (dat.reloc_targets[reloc_i] == i) {
-                        is_ref = true;
-                        break;
-                    }
-                }
+                bool is_ref = dat_reloc_is_slot(&dat, i);
                 
                 printf("%2x  %8x", i - object.offset, word);
                 
@@ -133,6 +131,17 @@ int main(int argc, const char *argv[]) {
             for (; i < object_end; ++i) printf("%02x", dat.data[i]);
             
             printf("OBJECT 0x%x-0x%x (0x%x)\n", object.offset, object.offset + object.size, object.size);
+            
+            const DatRef *incoming;
+            uint32_t incoming_count;
+            dat_expect(dat_obj_incoming(&dat, object.offset, &incoming, &incoming_count));
+            for (uint32_t k = 0; k < incoming_count; ++k) {
+                DatSlice from;
+                if (dat_obj_location(&dat, incoming[k], &from) == DAT_SUCCESS)
+                    printf("  <- 0x%x in 0x%x-0x%x\n", incoming[k], from.offset, from.offset + from.size);
+                else
+                    printf("  <- 0x%x\n", incoming[k]);
+            }
         }
     } else if (strcmp(arg1, "extract") == 0) {
         if (argc < 4)
@@ -149,11 +158,15 @@ int main(int argc, const char *argv[]) {
         push_str(ext, ".dat");
         
         // copy root
+        DAT_ZONE(zone, "extract");
         DatFile out;
         dat_file_new(&out);
+        dat_file_begin_build(&out);
         DatRef copied_root;
         dat_obj_copy(&out, &dat_in, root_in->data_offset, &copied_root);
         dat_root_add(&out, 0, copied_root, root_name);
+        dat_expect(dat_file_finalize(&out));
+        DAT_ZONE_END(zone);
         
         write_dat(&out, dat_path_out);
     } else if (strcmp(arg1, "insert") == 0) {
@@ -161,17 +174,83 @@ int main(int argc, const char *argv[]) {
         DatFile dat_dst = read_dat(argv[2]);
         DatFile dat_src = read_dat(argv[3]);
         
+        DAT_ZONE(zone, "insert");
         uint32_t root_count = dat_src.root_count; 
+        DatRef *src_roots = malloc(root_count * sizeof(DatRef));
+        DatRef *copied_roots = malloc(root_count * sizeof(DatRef));
+        for (uint32_t i = 0; i < root_count; ++i)
+            src_roots[i] = dat_src.root_info[i].data_offset;
+        dat_expect(dat_obj_copy_many(&dat_dst, &dat_src, src_roots, root_count, 0, copied_roots));
+        
         for (uint32_t i = 0; i < root_count; ++i) {
-            DatRootInfo *info = &dat_src.root_info[i];
-            
-            DatRef copied_root;
-            dat_obj_copy(&dat_dst, &dat_src, info->data_offset, &copied_root);
-            char *root_name = dat_src.symbols + info->symbol_offset;
-            dat_root_add(&dat_dst, dat_dst.root_count, copied_root, root_name);
+            char *root_name = dat_src.symbols + dat_src.root_info[i].symbol_offset;
+            dat_root_add(&dat_dst, dat_dst.root_count, copied_roots[i], root_name);
         }
+        free(src_roots);
+        free(copied_roots);
+        DAT_ZONE_END(zone);
         
         write_dat(&dat_dst, argv[2]);
+    } else if (strcmp(arg1, "compact") == 0) {
+        if (argc < 3)
+            usage_exit(); 
+        
+        DatFile dat = read_dat(argv[2]);
+        DAT_ZONE(zone, "compact");
+        dat_expect(dat_file_find_objects(&dat));
+        uint32_t objects_before = dat.object_count;
+        
+        uint32_t freed;
+        dat_expect(dat_file_compact(&dat, &freed));
+        DAT_ZONE_END(zone);
+        printf("removed %u objects (0x%x bytes)\n", objects_before - dat.object_count, freed);
+        
+        write_dat(&dat, argv[2]);
+    } else if (strcmp(arg1, "dedup") == 0) {
+        if (argc < 3)
+            usage_exit();
+        
+        DatFile dat = read_dat(argv[2]);
+        DAT_ZONE(zone, "dedup");
+        dat_expect(dat_file_find_objects(&dat));
+        uint32_t objects_before = dat.object_count;
+        
+        uint32_t saved;
+        dat_expect(dat_file_dedup(&dat, &saved));
+        DAT_ZONE_END(zone);
+        printf("merged %u objects, saved 0x%x bytes\n", objects_before - dat.object_count, saved);
+        
+        write_dat(&dat, argv[2]);
+    } else if (strcmp(arg1, "stats") == 0) {
+        if (argc < 3)
+            usage_exit();
+        
+        #ifndef DAT_STATS
+            fprintf(stderr, ERROR_STR "dat_mod was built without DAT_STATS. Build it with './build.sh stats'.\n");
+            exit(1);
+        #else
+            DatFile dat = read_dat(argv[2]);
+            dat_expect(dat_file_find_objects(&dat));
+            dat_expect(dat_file_validate(&dat));
+            
+            for (uint32_t i = 0; i < dat.root_count; ++i) {
+                DatRef root;
+                dat_expect(dat_root_find(&dat, dat.symbols + dat.root_info[i].symbol_offset, &root));
+            }
+            for (uint32_t i = 0; i < dat.reloc_count; ++i) {
+                DatRef target;
+                DatSlice object;
+                dat_expect(dat_obj_read_ref(&dat, dat.reloc_targets[i], &target));
+                dat_expect(dat_obj_location(&dat, target, &object));
+            }
+            
+            uint8_t *out = malloc(dat_file_export_max_size(&dat));
+            uint32_t out_size;
+            dat_expect(dat_file_export(&dat, out, &out_size));
+            free(out);
+            
+            dat_file_print_stats(&dat);
+        #endif
     }
     
     return 0;
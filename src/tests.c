@@ -2,6 +2,7 @@
 #include "dat.c"
 #include "utils.h"
 #include "ml.h"
+#include "gen.h"
 
 void print_err(const char *test_name, int line, const char *cond) {
     fprintf(stderr, "TEST \"%s\" FAILED\n", test_name);
@@ -19,16 +20,126 @@ void test_ml(void);
 void test_dat(void);
 void test_map(void);
 void test_path_utils(void);
+void test_sort(void);
+void test_bswap(void);
 
 int main(void) {
     // test_path_utils();
     // test_map();
-    // test_dat();
+    test_dat();
+    test_sort();
+    test_bswap();
     test_ml();
 
     return 0;
 }
 
+typedef struct CountingAllocator {
+    uint32_t allocs;
+    size_t live_bytes;
+} CountingAllocator;
+
+static void *counting_alloc(void *ctx, size_t size) {
+    CountingAllocator *c = ctx;
+    c->allocs++;
+    c->live_bytes += size;
+    return malloc(size);
+}
+
+static void *counting_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size) {
+    CountingAllocator *c = ctx;
+    if (ptr == NULL) c->allocs++;
+    c->live_bytes += new_size - old_size;
+    return realloc(ptr, new_size);
+}
+
+static void counting_free(void *ctx, void *ptr, size_t size) {
+    CountingAllocator *c = ctx;
+    if (ptr != NULL) c->live_bytes -= size;
+    free(ptr);
+}
+
+// Fails zero sized allocations, as some allocators do.
+static void *nonzero_alloc(void *ctx, size_t size) {
+    return size == 0 ? NULL : counting_alloc(ctx, size);
+}
+
+// Builds every index a DatFile keeps beside its tables, and edits through them.
+static bool build_every_index(DatFile *dat) {
+    DatRef root = dat->root_info[0].data_offset;
+    const char *root_name = &dat->symbols[dat->root_info[0].symbol_offset];
+    DatRef found, obj;
+    const DatRef *incoming;
+    uint32_t incoming_count;
+    return dat_root_find(dat, root_name, &found) == DAT_SUCCESS
+        && dat_extern_find(dat, "not an extern", &found) == DAT_NOT_FOUND
+        && dat_obj_incoming(dat, root, &incoming, &incoming_count) == DAT_SUCCESS
+        && dat_file_build_reloc_bitmap(dat) == DAT_SUCCESS
+        && dat_obj_alloc(dat, 64, &obj) == DAT_SUCCESS
+        && dat_root_add(dat, 0, obj, "every_index") == DAT_SUCCESS
+        && dat_file_begin_edit(dat) == DAT_SUCCESS
+        && dat_obj_set_ref(dat, obj, root) == DAT_SUCCESS
+        && dat_obj_set_ref(dat, obj + 4, obj) == DAT_SUCCESS
+        && dat_obj_remove_ref(dat, obj + 4) == DAT_SUCCESS
+        && dat_reloc_is_slot(dat, obj)
+        && dat->reloc_blocks != NULL && dat->root_index != NULL && dat->extern_index != NULL
+        && dat->symbol_set != NULL && dat->incoming_index != NULL && dat->reloc_bitmap != NULL;
+}
+
+// Checks object sizes and first references against a search of the whole file.
+static bool object_table_ok(const DatFile *dat) {
+    for (uint32_t i = 0; i < dat->object_count; ++i) {
+        DatRef end = i+1 < dat->object_count ? dat->objects[i+1].offset : dat->data_size;
+        if (dat->objects[i].offset + dat->objects[i].size != end) return false;
+        if (dat->object_relocs[i] != dat_file_reloc_idx(dat, dat->objects[i].offset)) return false;
+    }
+    return true;
+}
+
+// Checks that every reference is listed once, under the object it points into.
+static bool incoming_ok(DatFile *dat) {
+    uint32_t listed = 0;
+    for (uint32_t i = 0; i < dat->object_count; ++i) {
+        const DatRef *incoming;
+        uint32_t count;
+        if (dat_obj_incoming(dat, dat->objects[i].offset, &incoming, &count)) return false;
+        for (uint32_t k = 0; k < count; ++k) {
+            if (k != 0 && incoming[k-1] >= incoming[k]) return false;
+            RelocIter it = reloc_iter_seek(dat, incoming[k]);
+            DatRef reloc;
+            if (!reloc_iter_next(&it, &reloc) || reloc != incoming[k]) return false;
+            if (object_idx_of(dat, READ_U32(&dat->data[reloc])) != i) return false;
+        }
+        listed += count;
+    }
+
+    uint32_t expected = 0;
+    RelocIter it = reloc_iter_seek(dat, 0);
+    DatRef reloc;
+    while (reloc_iter_next(&it, &reloc))
+        expected += object_idx_of(dat, READ_U32(&dat->data[reloc])) != UINT32_MAX;
+    return listed == expected;
+}
+
+// Compares the kept up to date bitmap against one built from scratch.
+static bool reloc_bitmap_ok(DatFile *dat) {
+    if (dat_file_build_reloc_bitmap(dat)) return false;
+    DatRelocBitmap *kept = dat->reloc_bitmap;
+    dat->reloc_bitmap = NULL;
+    if (dat_file_build_reloc_bitmap(dat)) return false;
+    DatRelocBitmap *built = dat->reloc_bitmap;
+    dat->reloc_bitmap = kept;
+
+    bool ok = kept->word_count == built->word_count && kept->slot_count == built->slot_count;
+    for (uint32_t w = 0; ok && w < built->word_count; ++w) {
+        ok = kept->words[w] == built->words[w];
+        if (w % RELOC_RANK_WORDS == 0)
+            ok = ok && kept->ranks[w / RELOC_RANK_WORDS] == built->ranks[w / RELOC_RANK_WORDS];
+    }
+    reloc_bitmap_free(built, &dat->allocator);
+    return ok;
+}
+
 void pjobj(DatFile *grps, ML_JObjDesc *jobjdesc) {
     // float x = ML_ReadF32(jobjdesc->position.x);
     // float y = ML_ReadF32(jobjdesc->position.y);
@@ -205,10 +316,10 @@ void test_dat(void) {
         EXPECT(obj4 == 292);
         EXPECT(dat.object_count == 4);
         
-        EXPECT(dat.objects[0] == obj1);
-        EXPECT(dat.objects[1] == obj2);
-        EXPECT(dat.objects[2] == obj3);
-        EXPECT(dat.objects[3] == obj4);
+        EXPECT(dat.objects[0].offset == obj1);
+        EXPECT(dat.objects[1].offset == obj2);
+        EXPECT(dat.objects[2].offset == obj3);
+        EXPECT(dat.objects[3].offset == obj4);
     }
     
     {
@@ -268,6 +379,95 @@ void test_dat(void) {
         EXPECT(strcmp(dat.symbols + info.symbol_offset, root3) == 0);
     }
     
+    {
+        test_name = "root name index";
+        
+        DatFile named;
+        DAT_TEST(dat_file_new(&named));
+        DatRef obj;
+        DAT_TEST(dat_obj_alloc(&named, 4, &obj));
+        
+        // index is built on first lookup, then kept up to date
+        char name[32];
+        for (uint32_t i = 0; i < 100; ++i) {
+            snprintf(name, sizeof(name), "root_%u", i);
+            DAT_TEST(dat_root_add(&named, named.root_count, obj, name));
+        }
+        uint32_t idx;
+        DAT_TEST(dat_root_find_idx(&named, "root_50", &idx));
+        EXPECT(idx == 50);
+        EXPECT(named.root_index != NULL);
+        
+        DAT_TEST(dat_root_add(&named, 0, obj, "first"));
+        DAT_TEST(dat_root_find_idx(&named, "root_50", &idx));
+        EXPECT(idx == 51);
+        DAT_TEST(dat_root_find_idx(&named, "first", &idx));
+        EXPECT(idx == 0);
+        
+        for (uint32_t i = 0; i < 100; i += 2) {
+            snprintf(name, sizeof(name), "root_%u", i);
+            DAT_TEST(dat_root_find_idx(&named, name, &idx));
+            DAT_TEST(dat_root_remove(&named, idx));
+            EXPECT(dat_root_find_idx(&named, name, &idx) == DAT_NOT_FOUND);
+        }
+        for (uint32_t i = 1; i < 100; i += 2) {
+            snprintf(name, sizeof(name), "root_%u", i);
+            DAT_TEST(dat_root_find_idx(&named, name, &idx));
+            EXPECT(strcmp(&named.symbols[named.root_info[idx].symbol_offset], name) == 0);
+        }
+        
+        // duplicate names find the first, and the next after removing it
+        DAT_TEST(dat_root_add(&named, named.root_count, obj + 0, "dup"));
+        DAT_TEST(dat_root_add(&named, named.root_count, obj + 4, "dup"));
+        DAT_TEST(dat_root_find_idx(&named, "dup", &idx));
+        EXPECT(idx == named.root_count - 2);
+        DAT_TEST(dat_root_remove(&named, idx));
+        DatRef found;
+        DAT_TEST(dat_root_find(&named, "dup", &found));
+        EXPECT(found == obj + 4);
+        
+        DAT_TEST(dat_file_destroy(&named));
+    }
+    
+    {
+        test_name = "interned symbols";
+        
+        DatFile named;
+        DAT_TEST(dat_file_new(&named));
+        DatRef obj;
+        DAT_TEST(dat_obj_alloc(&named, 8, &obj));
+        
+        // re-adding the same name does not grow the symbol table
+        for (uint32_t i = 0; i < 10; ++i) {
+            DAT_TEST(dat_root_add(&named, named.root_count, obj, "scene_data"));
+            DAT_TEST(dat_root_remove(&named, 0));
+        }
+        DAT_TEST(dat_root_add(&named, 0, obj, "scene_data"));
+        DAT_TEST(dat_root_add(&named, 1, obj + 4, "scene_data"));
+        EXPECT(named.symbol_size == sizeof("scene_data"));
+        EXPECT(named.root_info[0].symbol_offset == named.root_info[1].symbol_offset);
+        
+        // unreferenced names are dropped on export
+        DAT_TEST(dat_root_add(&named, 2, obj, "removed"));
+        DAT_TEST(dat_root_add(&named, 3, obj, "kept"));
+        DAT_TEST(dat_root_remove(&named, 2));
+        uint8_t buf[256];
+        uint32_t size;
+        EXPECT(dat_file_export_max_size(&named) <= sizeof(buf));
+        DAT_TEST(dat_file_export(&named, buf, &size));
+        
+        DatFile exported;
+        DAT_TEST(dat_file_import(buf, size, &exported));
+        EXPECT(exported.symbol_size == sizeof("scene_data") + sizeof("kept"));
+        EXPECT(exported.root_count == 3);
+        DatRef found;
+        DAT_TEST(dat_root_find(&exported, "kept", &found));
+        EXPECT(dat_root_find(&exported, "removed", &found) == DAT_NOT_FOUND);
+        DAT_TEST(dat_file_destroy(&exported));
+        
+        DAT_TEST(dat_file_destroy(&named));
+    }
+    
     {
         test_name = "read/writes";
         DatRef ref1;
@@ -330,6 +530,104 @@ void test_dat(void) {
         EXPECT(reloc2 == ref4);
     }
     
+    {
+        test_name = "builder mode";
+        
+        DatFile built;
+        DAT_TEST(dat_file_new(&built));
+        DAT_TEST(dat_file_begin_build(&built));
+        DatRef obj;
+        DAT_TEST(dat_obj_alloc(&built, 64, &obj));
+        DAT_TEST(dat_obj_set_ref(&built, obj + 0x8, obj));
+        DAT_TEST(dat_obj_set_ref(&built, obj + 0x0, obj));
+        DAT_TEST(dat_obj_set_ref(&built, obj + 0x8, obj + 4));
+        DAT_TEST(dat_obj_set_ref(&built, obj + 0x4, obj));
+        
+        uint8_t buf[256];
+        uint32_t size;
+        EXPECT(dat_file_export(&built, buf, &size) == DAT_ERR_NOT_FINALIZED);
+        
+        DAT_TEST(dat_file_finalize(&built));
+        EXPECT(built.reloc_count == 3);
+        EXPECT(built.reloc_targets[0] == obj + 0x0);
+        EXPECT(built.reloc_targets[1] == obj + 0x4);
+        EXPECT(built.reloc_targets[2] == obj + 0x8);
+        DatRef ref;
+        DAT_TEST(dat_obj_read_ref(&built, obj + 0x8, &ref));
+        EXPECT(ref == obj + 4);
+        DAT_TEST(dat_file_export(&built, buf, &size));
+        
+        // removing triggers finalize
+        DAT_TEST(dat_file_begin_build(&built));
+        DAT_TEST(dat_obj_set_ref(&built, obj + 0xC, obj));
+        DAT_TEST(dat_obj_set_ref(&built, obj + 0x4, obj));
+        DAT_TEST(dat_obj_remove_ref(&built, obj + 0x4));
+        EXPECT((built.flags & DAT_FILE_BUILDING) == 0);
+        EXPECT(built.reloc_count == 3);
+        EXPECT(dat_obj_remove_ref(&built, obj + 0x4) == DAT_NOT_FOUND);
+        
+        DAT_TEST(dat_file_destroy(&built));
+    }
+    
+    {
+        test_name = "edit mode";
+        
+        // apply the same random edits to a flat file and an editing file
+        DatFile flat, edit;
+        DAT_TEST(dat_file_new(&flat));
+        DAT_TEST(dat_file_new(&edit));
+        uint32_t slot_count = 4096;
+        DatRef obj;
+        DAT_TEST(dat_obj_alloc(&flat, slot_count*4, &obj));
+        DAT_TEST(dat_obj_alloc(&edit, slot_count*4, &obj));
+        memset(&flat.data[obj], 0, slot_count*4);
+        memset(&edit.data[obj], 0, slot_count*4);
+        for (uint32_t i = 0; i < slot_count; i += 3) {
+            DAT_TEST(dat_obj_set_ref(&flat, obj + i*4, obj));
+            DAT_TEST(dat_obj_set_ref(&edit, obj + i*4, obj));
+        }
+        DAT_TEST(dat_file_begin_edit(&edit));
+        EXPECT(edit.flags & DAT_FILE_EDITING);
+        
+        uint32_t seed = 1;
+        for (uint32_t i = 0; i < 20000; ++i) {
+            seed = seed * 1103515245u + 12345u;
+            uint32_t slot = (seed >> 8) % slot_count;
+            // bias towards removal in the second half so blocks empty and merge
+            bool remove = ((seed >> 4) & 3) < (i < 10000 ? 1u : 3u);
+            if (remove) {
+                DAT_RET e1 = dat_obj_remove_ref(&flat, obj + slot*4);
+                DAT_RET e2 = dat_obj_remove_ref(&edit, obj + slot*4);
+                EXPECT(e1 == e2);
+            } else {
+                DAT_TEST(dat_obj_set_ref(&flat, obj + slot*4, obj + slot*4));
+                DAT_TEST(dat_obj_set_ref(&edit, obj + slot*4, obj + slot*4));
+            }
+            EXPECT(flat.reloc_count == edit.reloc_count);
+        }
+        
+        // export writes straight from the blocks
+        uint32_t size = dat_file_export_max_size(&flat);
+        uint8_t *flat_buf = malloc(size);
+        uint8_t *edit_buf = malloc(size);
+        uint32_t flat_size, edit_size;
+        DAT_TEST(dat_file_export(&flat, flat_buf, &flat_size));
+        DAT_TEST(dat_file_export(&edit, edit_buf, &edit_size));
+        EXPECT(flat_size == edit_size);
+        EXPECT(memcmp(flat_buf, edit_buf, flat_size) == 0);
+        EXPECT(edit.flags & DAT_FILE_EDITING);
+        free(flat_buf);
+        free(edit_buf);
+        
+        DAT_TEST(dat_file_finalize(&edit));
+        EXPECT((edit.flags & DAT_FILE_EDITING) == 0);
+        EXPECT(edit.reloc_count == flat.reloc_count);
+        EXPECT(memcmp(edit.reloc_targets, flat.reloc_targets, flat.reloc_count*sizeof(DatRef)) == 0);
+        
+        DAT_TEST(dat_file_destroy(&flat));
+        DAT_TEST(dat_file_destroy(&edit));
+    }
+    
     {
         test_name = "copy object";
          
@@ -353,10 +651,10 @@ void test_dat(void) {
         EXPECT(dst.object_count == 4);
         EXPECT(dst.reloc_count == 5);
         
-        EXPECT(dst.objects[0] == 0);
-        EXPECT(dst.objects[1] == 64);
-        EXPECT(dst.objects[2] == 128);
-        EXPECT(dst.objects[3] == 192);
+        EXPECT(dst.objects[0].offset == 0);
+        EXPECT(dst.objects[1].offset == 64);
+        EXPECT(dst.objects[2].offset == 128);
+        EXPECT(dst.objects[3].offset == 192);
         
         DatRef reloc1, reloc2, reloc3, reloc4, reloc5;
         DAT_TEST(dat_obj_read_ref(&dst, dst.reloc_targets[0], &reloc1));
@@ -365,13 +663,231 @@ void test_dat(void) {
         DAT_TEST(dat_obj_read_ref(&dst, dst.reloc_targets[3], &reloc4));
         DAT_TEST(dat_obj_read_ref(&dst, dst.reloc_targets[4], &reloc5));
         
-        EXPECT(reloc1 == dst.objects[1]);
-        EXPECT(reloc2 == dst.objects[1]);
-        EXPECT(reloc3 == dst.objects[2]);
-        EXPECT(reloc4 == dst.objects[3]);
-        EXPECT(reloc5 == dst.objects[0]);
+        EXPECT(reloc1 == dst.objects[1].offset);
+        EXPECT(reloc2 == dst.objects[1].offset);
+        EXPECT(reloc3 == dst.objects[2].offset);
+        EXPECT(reloc4 == dst.objects[3].offset);
+        EXPECT(reloc5 == dst.objects[0].offset);
+        
+        DAT_TEST(dat_file_destroy(&dst));
+    }
+    
+    {
+        test_name = "copy deep chain";
+        
+        // would overflow the stack if copying recursed per object
+        DatFile chain;
+        DAT_TEST(dat_file_new(&chain));
+        DAT_TEST(dat_file_begin_build(&chain));
+        uint32_t chain_len = 200000;
+        DatRef prev, head;
+        DAT_TEST(dat_obj_alloc(&chain, 8, &head));
+        WRITE_U32(&chain.data[head], 0);
+        prev = head;
+        for (uint32_t i = 1; i < chain_len; ++i) {
+            DatRef next;
+            DAT_TEST(dat_obj_alloc(&chain, 8, &next));
+            DAT_TEST(dat_obj_set_ref(&chain, prev + 4, next));
+            WRITE_U32(&chain.data[next], i);
+            prev = next;
+        }
+        DAT_TEST(dat_file_finalize(&chain));
+        
+        // copy into a file in edit mode with existing references
+        DatFile dst;
+        DAT_TEST(dat_file_new(&dst));
+        DatRef existing;
+        DAT_TEST(dat_obj_alloc(&dst, 16, &existing));
+        DAT_TEST(dat_obj_set_ref(&dst, existing + 8, existing));
+        DAT_TEST(dat_file_begin_edit(&dst));
+        
+        DatRef dst_head;
+        DAT_TEST(dat_obj_copy(&dst, &chain, head + 4, &dst_head));
+        EXPECT(dst.reloc_count == chain_len);
+        EXPECT(dst.data_size == 16 + chain_len * 8);
+        DAT_TEST(dat_file_finalize(&dst));
+        
+        DatRef obj = dst_head - 4;
+        for (uint32_t i = 0; i < chain_len; ++i) {
+            uint32_t value;
+            DAT_TEST(dat_obj_read_u32(&dst, obj, &value));
+            EXPECT(value == i);
+            EXPECT(dst.reloc_targets[i+1] == obj + 4 || i+1 == chain_len);
+            if (i+1 < chain_len)
+                DAT_TEST(dat_obj_read_ref(&dst, obj + 4, &obj));
+        }
         
         DAT_TEST(dat_file_destroy(&dst));
+        DAT_TEST(dat_file_destroy(&chain));
+    }
+    
+    {
+        test_name = "copy many";
+        
+        // a and b share s, s points back to a, c is unreachable
+        DatFile src;
+        DAT_TEST(dat_file_new(&src));
+        DatRef a, b, c, sh;
+        DAT_TEST(dat_obj_alloc(&src, 16, &a));
+        DAT_TEST(dat_obj_alloc(&src, 16, &c));
+        DAT_TEST(dat_obj_alloc(&src, 8, &b));
+        DAT_TEST(dat_obj_alloc(&src, 6, &sh));
+        memset(&src.data[a], 0xAA, src.data_size);
+        DAT_TEST(dat_obj_set_ref(&src, a + 8, sh));
+        DAT_TEST(dat_obj_set_ref(&src, b + 4, sh));
+        DAT_TEST(dat_obj_set_ref(&src, sh, a + 4));
+        
+        DatFile dst;
+        DAT_TEST(dat_file_new(&dst));
+        DatRef existing;
+        DAT_TEST(dat_obj_alloc(&dst, 6, &existing));
+        memset(&dst.data[existing], 0x11, 6);
+        
+        DatRef src_refs[] = { a, b, a + 4 };
+        DatRef dst_refs[countof(src_refs)];
+        DatRef bad_ref = src.data_size;
+        EXPECT(dat_obj_copy_many(&dst, &src, &bad_ref, 1, 3, dst_refs) == DAT_ERR_OUT_OF_BOUNDS);
+        EXPECT(dst.data_size == 6);
+        DAT_TEST(dat_obj_copy_many(&dst, &src, src_refs, countof(src_refs), 3, dst_refs));
+        
+        // objects keep their src order: a, b, s
+        EXPECT(dst.object_count == 4);
+        EXPECT(dst.data_size == 8 + 16 + 8 + 8); // objects are padded to 4 bytes
+        EXPECT(dst_refs[0] == 8);
+        EXPECT(dst_refs[1] == 24);
+        EXPECT(dst_refs[2] == dst_refs[0] + 4);
+        EXPECT(memcmp(&dst.data[8], &src.data[a], 8) == 0);
+        EXPECT(dst.data[6] == 0 && dst.data[7] == 0);
+        
+        EXPECT(dst.reloc_count == 3);
+        EXPECT(dst.reloc_targets[0] == dst_refs[0] + 8);
+        EXPECT(dst.reloc_targets[1] == dst_refs[1] + 4);
+        EXPECT(dst.reloc_targets[2] == 32);
+        DatRef ref;
+        DAT_TEST(dat_obj_read_ref(&dst, dst_refs[0] + 8, &ref));
+        EXPECT(ref == 32);
+        DAT_TEST(dat_obj_read_ref(&dst, dst_refs[1] + 4, &ref));
+        EXPECT(ref == 32);
+        DAT_TEST(dat_obj_read_ref(&dst, 32, &ref));
+        EXPECT(ref == dst_refs[0] + 4);
+        
+        DAT_TEST(dat_file_destroy(&dst));
+        DAT_TEST(dat_file_destroy(&src));
+    }
+    
+    {
+        test_name = "compact";
+        
+        DatFile gc;
+        DAT_TEST(dat_file_new(&gc));
+        DatRef root, dead, live_child, dead_child, texture;
+        DAT_TEST(dat_obj_alloc(&gc, 16, &root));
+        DAT_TEST(dat_obj_alloc(&gc, 24, &dead));
+        DAT_TEST(dat_obj_alloc(&gc, 8, &live_child));
+        DAT_TEST(dat_obj_alloc(&gc, 8, &dead_child));
+        gc.data_size = align_forward(gc.data_size, 32) + 4; // misalign the next object
+        DAT_TEST(dat_obj_alloc(&gc, 64, &texture));
+        texture = align_forward(texture, 32);
+        gc.objects[gc.object_count-1].offset = texture;
+        gc.objects[gc.object_count-2].size = texture - dead_child;
+        gc.objects[gc.object_count-1].size = 64;
+        gc.data_size = texture + 64;
+        memset(gc.data, 0xAB, gc.data_size);
+        
+        DAT_TEST(dat_obj_set_ref(&gc, root + 0, live_child));
+        DAT_TEST(dat_obj_set_ref(&gc, root + 4, texture));
+        DAT_TEST(dat_obj_set_ref(&gc, root + 8, root));
+        DAT_TEST(dat_obj_set_ref(&gc, dead + 0, dead_child));
+        DAT_TEST(dat_obj_set_ref(&gc, dead + 4, live_child));
+        DAT_TEST(dat_obj_set_ref(&gc, live_child + 4, texture + 8));
+        DAT_TEST(dat_obj_write_u32(&gc, live_child, 0x12345678));
+        DAT_TEST(dat_root_add(&gc, 0, root, "root"));
+        
+        uint32_t old_size = gc.data_size;
+        uint32_t freed;
+        DAT_TEST(dat_file_compact(&gc, &freed));
+        // dead (24) and dead_child with the gap before the texture (48), less 8 bytes of realignment
+        EXPECT(freed == 64);
+        EXPECT(gc.data_size == old_size - freed);
+        EXPECT(gc.object_count == 3);
+        EXPECT(gc.reloc_count == 4);
+        
+        DatRef new_root, new_child, new_texture, ref;
+        DAT_TEST(dat_root_find(&gc, "root", &new_root));
+        DAT_TEST(dat_obj_read_ref(&gc, new_root + 0, &new_child));
+        DAT_TEST(dat_obj_read_ref(&gc, new_root + 4, &new_texture));
+        DAT_TEST(dat_obj_read_ref(&gc, new_root + 8, &ref));
+        EXPECT(ref == new_root);
+        EXPECT(new_child == 16);
+        EXPECT((new_texture & 31) == 0);
+        DAT_TEST(dat_obj_read_ref(&gc, new_child + 4, &ref));
+        EXPECT(ref == new_texture + 8);
+        uint32_t value;
+        DAT_TEST(dat_obj_read_u32(&gc, new_child, &value));
+        EXPECT(value == 0x12345678);
+        
+        for (uint32_t i = 1; i < gc.reloc_count; ++i)
+            EXPECT(gc.reloc_targets[i-1] < gc.reloc_targets[i]);
+        
+        // nothing left to remove
+        DAT_TEST(dat_file_compact(&gc, &freed));
+        EXPECT(freed == 0);
+        
+        // removing the root frees everything
+        DAT_TEST(dat_root_remove(&gc, 0));
+        DAT_TEST(dat_file_compact(&gc, &freed));
+        EXPECT(gc.data_size == 0);
+        EXPECT(gc.reloc_count == 0);
+        EXPECT(gc.object_count == 0);
+        
+        DAT_TEST(dat_file_destroy(&gc));
+    }
+    
+    {
+        test_name = "dedup";
+        
+        // three two-object cycles: a -> b -> a. The third differs only in b's target offset.
+        // Objects are 32 bytes so compaction alignment does not affect the saved size.
+        DatFile dd;
+        DAT_TEST(dat_file_new(&dd));
+        DatRef a[3], b[3];
+        for (uint32_t i = 0; i < 3; ++i) {
+            DAT_TEST(dat_obj_alloc(&dd, 32, &a[i]));
+            DAT_TEST(dat_obj_alloc(&dd, 32, &b[i]));
+            memset(&dd.data[a[i]], 0x11, 32);
+            memset(&dd.data[b[i]], 0x22, 32);
+            DAT_TEST(dat_obj_set_ref(&dd, a[i] + 4, b[i]));
+            DAT_TEST(dat_obj_set_ref(&dd, b[i] + 0, a[i] + (i == 2 ? 8 : 0)));
+        }
+        char name[8] = "root_0";
+        for (uint32_t i = 0; i < 3; ++i) {
+            name[5] = (char)('0' + i);
+            DAT_TEST(dat_root_add(&dd, i, a[i], name));
+        }
+        
+        uint32_t saved;
+        DAT_TEST(dat_file_dedup(&dd, &saved));
+        EXPECT(saved == 64);
+        EXPECT(dd.object_count == 4);
+        EXPECT(dd.reloc_count == 4);
+        
+        DatRef r0, r1, r2, ref;
+        DAT_TEST(dat_root_find(&dd, "root_0", &r0));
+        DAT_TEST(dat_root_find(&dd, "root_1", &r1));
+        DAT_TEST(dat_root_find(&dd, "root_2", &r2));
+        EXPECT(r0 == r1);
+        EXPECT(r0 != r2);
+        DAT_TEST(dat_obj_read_ref(&dd, r0 + 4, &ref));
+        DAT_TEST(dat_obj_read_ref(&dd, ref, &ref));
+        EXPECT(ref == r0);
+        DAT_TEST(dat_obj_read_ref(&dd, r2 + 4, &ref));
+        DAT_TEST(dat_obj_read_ref(&dd, ref, &ref));
+        EXPECT(ref == r2 + 8);
+        
+        // nothing left to merge
+        DAT_TEST(dat_file_dedup(&dd, &saved));
+        EXPECT(saved == 0);
+        DAT_TEST(dat_file_destroy(&dd));
     }
     
     {
@@ -390,14 +906,32 @@ void test_dat(void) {
         EXPECT(new.reloc_count == dat.reloc_count);
         EXPECT(new.root_count == dat.root_count);
         EXPECT(new.extern_count == dat.extern_count);
-        EXPECT(new.symbol_size == dat.symbol_size);
+        
+        // the removed root's name is dropped from the symbol table
+        EXPECT(new.symbol_size < dat.symbol_size);
         
         EXPECT(memcmp(new.data, dat.data, new.data_size) == 0);
         EXPECT(memcmp(new.reloc_targets, dat.reloc_targets, new.reloc_count*sizeof(*new.reloc_targets)) == 0);
-        EXPECT(memcmp(new.root_info, dat.root_info, new.root_count*sizeof(*new.root_info)) == 0);
+        for (uint32_t i = 0; i < new.root_count; ++i) {
+            EXPECT(new.root_info[i].data_offset == dat.root_info[i].data_offset);
+            EXPECT(strcmp(new.symbols + new.root_info[i].symbol_offset, dat.symbols + dat.root_info[i].symbol_offset) == 0);
+        }
         // These are null at the moment, memcmp doesn't like that
         //EXPECT(memcmp(new.extern_info, dat.extern_info, new.extern_count*sizeof(*new.extern_info)) == 0);
-        EXPECT(memcmp(new.symbols, dat.symbols, new.symbol_size) == 0);
+        
+        // objects allocated before lazy discovery are kept
+        DatRef alloced;
+        DatSlice slice;
+        DAT_TEST(dat_obj_alloc(&new, 12, &alloced));
+        EXPECT(new.flags & DAT_FILE_OBJECTS_PENDING);
+        EXPECT(dat_obj_location(&new, alloced + 4, &slice) == DAT_ERR_OBJECTS_PENDING);
+        DAT_TEST(dat_file_find_objects(&new));
+        EXPECT((new.flags & DAT_FILE_OBJECTS_PENDING) == 0);
+        DAT_TEST(dat_obj_location(&new, alloced + 4, &slice));
+        EXPECT(slice.offset == alloced);
+        EXPECT(slice.size == 12);
+        DAT_TEST(dat_obj_location(&new, new.root_info[0].data_offset, &slice));
+        EXPECT(slice.offset == new.root_info[0].data_offset);
         
         DAT_TEST(dat_file_destroy(&new));
         free(data);
@@ -419,9 +953,12 @@ void test_dat(void) {
         
         DatFile grps;
         DAT_TEST(dat_file_import(grps_buf, grps_size, &grps));
+        EXPECT(grps.object_count == 0);
+        DAT_TEST(dat_file_find_objects(&grps));
+        EXPECT(grps.object_count != 0);
         
         for (uint32_t i = 0; i < grps.object_count; ++i) {
-            DatRef object = grps.objects[i];
+            DatRef object = grps.objects[i].offset;
             EXPECT(object < grps.data_size);
         }
          
@@ -437,9 +974,1133 @@ void test_dat(void) {
             EXPECT(ext.symbol_offset < grps.symbol_size);
         } 
         
+        // name lookups agree with a linear scan for the first match
+        for (uint32_t i = 0; i < grps.root_count; ++i) {
+            const char *name = &grps.symbols[grps.root_info[i].symbol_offset];
+            uint32_t first = 0;
+            while (strcmp(&grps.symbols[grps.root_info[first].symbol_offset], name) != 0) first++;
+            uint32_t found_i;
+            DAT_TEST(dat_root_find_idx(&grps, name, &found_i));
+            EXPECT(found_i == first);
+        }
+        for (uint32_t i = 0; i < grps.extern_count; ++i) {
+            const char *name = &grps.symbols[grps.extern_info[i].symbol_offset];
+            uint32_t first = 0;
+            while (strcmp(&grps.symbols[grps.extern_info[first].symbol_offset], name) != 0) first++;
+            DatRef found;
+            DAT_TEST(dat_extern_find(&grps, name, &found));
+            EXPECT(found == grps.extern_info[first].data_offset);
+        }
+        DatRef not_found;
+        EXPECT(dat_extern_find(&grps, "map_head", &not_found) == DAT_NOT_FOUND);
+        
+        // importing through an allocator makes a single right sized allocation
+        CountingAllocator counter = {0};
+        DatAllocator counting = { counting_alloc, counting_realloc, counting_free, &counter };
+        DatFile counted;
+        DAT_TEST(dat_file_import_with_allocator(grps_buf, grps_size, 0, &counting, &counted));
+        EXPECT(counter.allocs == 1);
+        EXPECT(counter.live_bytes == grps_size);
+        DAT_TEST(dat_file_find_objects(&counted));
+        DatRef counted_obj;
+        DAT_TEST(dat_obj_alloc(&counted, 64, &counted_obj));
+        DAT_TEST(dat_root_add(&counted, 0, counted_obj, "counted"));
+        DAT_TEST(dat_file_destroy(&counted));
+        EXPECT(counter.live_bytes == 0);
+        
+        // and so do the indexes, which give back the same sizes they took
+        DAT_TEST(dat_file_import_with_allocator(grps_buf, grps_size, 0, &counting, &counted));
+        uint32_t import_allocs = counter.allocs;
+        EXPECT(build_every_index(&counted));
+        EXPECT(counter.allocs > import_allocs);
+        DAT_TEST(dat_file_destroy(&counted));
+        EXPECT(counter.live_bytes == 0);
+        
+        // arena imports behave the same as malloc imports, and can be recycled
+        size_t arena_size = (size_t)grps_size * 4;
+        void *arena_buf = malloc(arena_size);
+        DatArena arena;
+        dat_arena_init(&arena, arena_buf, arena_size);
+        DatAllocator arena_allocator = dat_arena_allocator(&arena);
+        uint32_t max_size = dat_file_export_max_size(&grps) + 0x1000;
+        uint8_t *expected = malloc(max_size);
+        uint8_t *actual = malloc(max_size);
+        for (uint32_t i = 0; i < 3; ++i) {
+            DatFile arena_dat, malloc_dat;
+            DAT_TEST(dat_file_import_with_allocator(grps_buf, grps_size, 0, &arena_allocator, &arena_dat));
+            DAT_TEST(dat_file_import(grps_buf, grps_size, &malloc_dat));
+            EXPECT(arena.used < (size_t)grps_size + ARENA_ALIGN);
+            
+            DatFile *dats[2] = { &arena_dat, &malloc_dat };
+            for (uint32_t d = 0; d < 2; ++d) {
+                DatRef obj;
+                DAT_TEST(dat_obj_alloc(dats[d], 64, &obj));
+                DAT_TEST(dat_obj_set_ref(dats[d], obj, dats[d]->root_info[0].data_offset));
+                DAT_TEST(dat_root_add(dats[d], 0, obj, "arena_root"));
+            }
+            
+            uint32_t expected_size, actual_size;
+            DAT_TEST(dat_file_export(&malloc_dat, expected, &expected_size));
+            DAT_TEST(dat_file_export(&arena_dat, actual, &actual_size));
+            EXPECT(expected_size == actual_size);
+            EXPECT(memcmp(expected, actual, expected_size) == 0);
+            
+            DAT_TEST(dat_file_destroy(&malloc_dat));
+            DAT_TEST(dat_file_destroy(&arena_dat));
+            dat_arena_reset(&arena);
+        }
+        
+        // resetting the arena frees the indexes too, anything from malloc would leak
+        for (uint32_t i = 0; i < 2; ++i) {
+            DatFile arena_dat;
+            DAT_TEST(dat_file_import_with_allocator(grps_buf, grps_size, 0, &arena_allocator, &arena_dat));
+            size_t import_used = arena.used;
+            EXPECT(build_every_index(&arena_dat));
+            EXPECT(arena.used > import_used);
+            dat_arena_reset(&arena);
+        }
+        
+        // a full arena fails cleanly
+        dat_arena_init(&arena, arena_buf, grps_size / 2);
+        DatFile too_big;
+        EXPECT(dat_file_import_with_allocator(grps_buf, grps_size, 0, &arena_allocator, &too_big) == DAT_ERR_ALLOCATION_FAILURE);
+        free(expected);
+        free(actual);
+        free(arena_buf);
+        
         DAT_TEST(dat_file_destroy(&grps));
         free(grps_buf);
     }
     
+    {
+        test_name = "import mapped ssbm grps dat";
+        
+        uint8_t *grps_buf;
+        uint64_t grps_size;
+        EXPECT(!read_file("GrPs.dat", &grps_buf, &grps_size));
+        
+        DatFile copied, mapped;
+        DAT_TEST(dat_file_import_flags(grps_buf, (uint32_t)grps_size, DAT_IMPORT_EAGER_OBJECTS, &copied));
+        DAT_TEST(dat_file_import_mapped("GrPs.dat", DAT_IMPORT_EAGER_OBJECTS, &mapped));
+        EXPECT(mapped.mapping != NULL);
+        EXPECT(mapped.flags & DAT_FILE_BORROWED_DATA);
+        
+        EXPECT(mapped.data_size == copied.data_size);
+        EXPECT(mapped.reloc_count == copied.reloc_count);
+        EXPECT(mapped.root_count == copied.root_count);
+        EXPECT(mapped.extern_count == copied.extern_count);
+        EXPECT(mapped.symbol_size == copied.symbol_size);
+        EXPECT(mapped.object_count == copied.object_count);
+        EXPECT(memcmp(mapped.data, copied.data, copied.data_size) == 0);
+        EXPECT(memcmp(mapped.reloc_targets, copied.reloc_targets, copied.reloc_count*sizeof(DatRef)) == 0);
+        EXPECT(memcmp(mapped.root_info, copied.root_info, copied.root_count*sizeof(DatRootInfo)) == 0);
+        EXPECT(memcmp(mapped.symbols, copied.symbols, copied.symbol_size) == 0);
+        EXPECT(memcmp(mapped.objects, copied.objects, copied.object_count*sizeof(DatSlice)) == 0);
+        EXPECT(memcmp(mapped.object_relocs, copied.object_relocs, copied.object_count*sizeof(uint32_t)) == 0);
+        
+        // mutating calls move tables out of the mapping
+        DatRef obj;
+        DAT_TEST(dat_obj_alloc(&mapped, 16, &obj));
+        EXPECT((mapped.flags & DAT_FILE_BORROWED_DATA) == 0);
+        DAT_TEST(dat_obj_set_ref(&mapped, obj, mapped.root_info[0].data_offset));
+        EXPECT((mapped.flags & DAT_FILE_BORROWED_RELOCS) == 0);
+        DAT_TEST(dat_root_add(&mapped, mapped.root_count, obj, "mapped_root"));
+        EXPECT((mapped.flags & DAT_FILE_BORROWED_ROOTS) == 0);
+        EXPECT((mapped.flags & DAT_FILE_BORROWED_SYMBOLS) == 0);
+        
+        DatRef found;
+        DAT_TEST(dat_root_find(&mapped, "mapped_root", &found));
+        EXPECT(found == obj);
+        EXPECT(mapped.reloc_count == copied.reloc_count + 1);
+        EXPECT(memcmp(mapped.data, copied.data, copied.data_size) == 0);
+        
+        DAT_TEST(dat_file_destroy(&mapped));
+        DAT_TEST(dat_file_destroy(&copied));
+        free(grps_buf);
+    }
+    
+    {
+        test_name = "import many";
+        
+        uint8_t *grps_buf;
+        uint64_t grps_size;
+        EXPECT(!read_file("GrPs.dat", &grps_buf, &grps_size));
+        
+        DatFile expected;
+        DAT_TEST(dat_file_import_flags(grps_buf, (uint32_t)grps_size, DAT_IMPORT_EAGER_OBJECTS, &expected));
+        
+        uint8_t bad[0x20] = {0};
+        DatImportSource sources[] = {
+            { NULL, grps_buf, (uint32_t)grps_size },
+            { "GrPs.dat", NULL, 0 },
+            { NULL, bad, sizeof(bad) },
+            { "build/does_not_exist.dat", NULL, 0 },
+            { NULL, grps_buf, (uint32_t)grps_size },
+        };
+        uint32_t count = countof(sources);
+        DatFile out[countof(sources)];
+        DAT_RET errors[countof(sources)];
+        
+        EXPECT(dat_file_import_many(sources, count, DAT_IMPORT_EAGER_OBJECTS, 3, out, errors) == DAT_ERR_INVALID_SIZE);
+        EXPECT(errors[0] == DAT_SUCCESS);
+        EXPECT(errors[1] == DAT_SUCCESS);
+        EXPECT(errors[2] == DAT_ERR_INVALID_SIZE);
+        EXPECT(errors[3] == DAT_ERR_IO);
+        EXPECT(errors[4] == DAT_SUCCESS);
+        EXPECT(out[2].data == NULL);
+        EXPECT(out[3].data == NULL);
+        
+        uint32_t good[] = { 0, 1, 4 };
+        for (uint32_t i = 0; i < countof(good); ++i) {
+            DatFile *dat_i = &out[good[i]];
+            EXPECT(dat_i->data_size == expected.data_size);
+            EXPECT(dat_i->reloc_count == expected.reloc_count);
+            EXPECT(dat_i->object_count == expected.object_count);
+            EXPECT(memcmp(dat_i->data, expected.data, expected.data_size) == 0);
+            EXPECT(memcmp(dat_i->reloc_targets, expected.reloc_targets, expected.reloc_count*sizeof(DatRef)) == 0);
+            EXPECT(memcmp(dat_i->objects, expected.objects, expected.object_count*sizeof(DatSlice)) == 0);
+        }
+        for (uint32_t i = 0; i < count; ++i)
+            DAT_TEST(dat_file_destroy(&out[i]));
+        
+        // more threads than files, and the default thread count
+        DAT_TEST(dat_file_import_many(sources, 2, 0, 8, out, errors));
+        DAT_TEST(dat_file_destroy(&out[0]));
+        DAT_TEST(dat_file_destroy(&out[1]));
+        DAT_TEST(dat_file_import_many(sources, 1, 0, 0, out, errors));
+        EXPECT(out[0].data_size == expected.data_size);
+        DAT_TEST(dat_file_destroy(&out[0]));
+        
+        DAT_TEST(dat_file_destroy(&expected));
+        free(grps_buf);
+    }
+    
+    {
+        test_name = "copy many ssbm grps dat";
+        
+        DatFile grps;
+        DAT_TEST(dat_file_import_mapped("GrPs.dat", 0, &grps));
+        uint32_t root_count = grps.root_count;
+        DatRef *src_refs = malloc(root_count * sizeof(DatRef));
+        DatRef *serial_refs = malloc(root_count * sizeof(DatRef));
+        DatRef *parallel_refs = malloc(root_count * sizeof(DatRef));
+        DatRef *edit_refs = malloc(root_count * sizeof(DatRef));
+        for (uint32_t i = 0; i < root_count; ++i)
+            src_refs[i] = grps.root_info[i].data_offset;
+        
+        // the layout does not depend on the thread count or the dst mode
+        DatFile serial, parallel, edit;
+        DAT_TEST(dat_file_new(&serial));
+        DAT_TEST(dat_file_new(&parallel));
+        DAT_TEST(dat_file_new(&edit));
+        DAT_TEST(dat_file_begin_edit(&edit));
+        DAT_TEST(dat_obj_copy_many(&serial, &grps, src_refs, root_count, 1, serial_refs));
+        DAT_TEST(dat_obj_copy_many(&parallel, &grps, src_refs, root_count, 4, parallel_refs));
+        DAT_TEST(dat_obj_copy_many(&edit, &grps, src_refs, root_count, 4, edit_refs));
+        DAT_TEST(dat_file_finalize(&edit));
+        
+        EXPECT(memcmp(serial_refs, parallel_refs, root_count * sizeof(DatRef)) == 0);
+        EXPECT(memcmp(serial_refs, edit_refs, root_count * sizeof(DatRef)) == 0);
+        EXPECT(serial.data_size == parallel.data_size);
+        EXPECT(serial.reloc_count == parallel.reloc_count);
+        EXPECT(memcmp(serial.data, parallel.data, serial.data_size) == 0);
+        EXPECT(memcmp(serial.reloc_targets, parallel.reloc_targets, serial.reloc_count * sizeof(DatRef)) == 0);
+        EXPECT(memcmp(serial.data, edit.data, serial.data_size) == 0);
+        EXPECT(memcmp(serial.reloc_targets, edit.reloc_targets, serial.reloc_count * sizeof(DatRef)) == 0);
+        
+        // every src object is copied once, and references point to the copy of their target
+        DAT_TEST(dat_file_find_objects(&grps));
+        uint32_t *copy_of = malloc(grps.object_count * sizeof(uint32_t));
+        uint32_t *stack = malloc(grps.object_count * sizeof(uint32_t));
+        memset(copy_of, 0xFF, grps.object_count * sizeof(uint32_t));
+        uint32_t stack_count = 0;
+        uint32_t copied_count = 0;
+        for (uint32_t i = 0; i < root_count; ++i) {
+            DatSlice loc;
+            DAT_TEST(dat_obj_location(&grps, src_refs[i], &loc));
+            uint32_t object_i = object_idx_of(&grps, loc.offset);
+            DatRef dst_offset = parallel_refs[i] - (src_refs[i] - loc.offset);
+            if (copy_of[object_i] == UINT32_MAX) {
+                copy_of[object_i] = dst_offset;
+                stack[stack_count++] = object_i;
+                copied_count++;
+            }
+            EXPECT(copy_of[object_i] == dst_offset);
+        }
+        while (stack_count) {
+            uint32_t object_i = stack[--stack_count];
+            DatRef src_offset = grps.objects[object_i].offset;
+            DatRef dst_offset = copy_of[object_i];
+            DatRef end = object_end(&grps, object_i);
+            uint32_t reloc_i = grps.object_relocs[object_i];
+            for (DatRef at = src_offset; at < end; at += 4) {
+                DatRef dst_at = dst_offset + (at - src_offset);
+                bool is_ref = reloc_i < grps.reloc_count && grps.reloc_targets[reloc_i] == at;
+                if (!is_ref) {
+                    uint32_t n = end - at < 4 ? end - at : 4;
+                    EXPECT(memcmp(&grps.data[at], &parallel.data[dst_at], n) == 0);
+                    continue;
+                }
+                reloc_i++;
+                EXPECT(parallel.reloc_targets[dat_file_reloc_idx(&parallel, dst_at)] == dst_at);
+                
+                DatRef target = READ_U32(&grps.data[at]);
+                uint32_t target_i = object_idx_of(&grps, target);
+                DatRef dst_target = READ_U32(&parallel.data[dst_at]);
+                DatRef dst_target_object = dst_target - (target - grps.objects[target_i].offset);
+                if (copy_of[target_i] == UINT32_MAX) {
+                    copy_of[target_i] = dst_target_object;
+                    stack[stack_count++] = target_i;
+                    copied_count++;
+                }
+                EXPECT(copy_of[target_i] == dst_target_object);
+            }
+        }
+        EXPECT(parallel.object_count == copied_count);
+        free(copy_of);
+        free(stack);
+        
+        free(src_refs);
+        free(serial_refs);
+        free(parallel_refs);
+        free(edit_refs);
+        DAT_TEST(dat_file_destroy(&serial));
+        DAT_TEST(dat_file_destroy(&parallel));
+        DAT_TEST(dat_file_destroy(&edit));
+        DAT_TEST(dat_file_destroy(&grps));
+    }
+    
+    {
+        test_name = "patch in place";
+        
+        uint8_t *grps_buf;
+        uint64_t grps_size;
+        EXPECT(!read_file("GrPs.dat", &grps_buf, &grps_size));
+        const char *path = "build/test_patch.dat";
+        FILE *f = fopen(path, "wb");
+        EXPECT(f != NULL);
+        EXPECT(fwrite(grps_buf, grps_size, 1, f) == 1);
+        fclose(f);
+        
+        DatFile plain;
+        DAT_TEST(dat_file_import(grps_buf, (uint32_t)grps_size, &plain));
+        EXPECT(dat_file_sync(&plain, NULL) == DAT_ERR_NOT_PATCHING);
+        
+        DatFile patch;
+        DAT_TEST(dat_file_open_patch(path, 0, &patch));
+        EXPECT(patch.flags & DAT_FILE_PATCHING);
+        
+        // size preserving writes go straight to the file
+        DatRef reloc = patch.reloc_targets[0];
+        DatRef other_root = patch.root_info[1].data_offset;
+        DAT_TEST(dat_obj_write_u32(&patch, 0x40, 0xDEADBEEF));
+        DAT_TEST(dat_obj_set_ref(&patch, reloc, other_root));
+        bool exported;
+        DAT_TEST(dat_file_sync(&patch, &exported));
+        EXPECT(!exported);
+        
+        uint8_t *written;
+        uint64_t written_size;
+        EXPECT(!read_file(path, &written, &written_size));
+        EXPECT(written_size == grps_size);
+        EXPECT(READ_U32(written + 0x20 + 0x40) == 0xDEADBEEF);
+        EXPECT(READ_U32(written + 0x20 + reloc) == other_root);
+        memcpy(grps_buf + 0x20 + 0x40, written + 0x20 + 0x40, 4);
+        memcpy(grps_buf + 0x20 + reloc, written + 0x20 + reloc, 4);
+        EXPECT(memcmp(written, grps_buf, grps_size) == 0);
+        free(written);
+        
+        // changing the layout falls back to a full export
+        DatRef obj;
+        DAT_TEST(dat_obj_alloc(&patch, 16, &obj));
+        DAT_TEST(dat_obj_set_ref(&patch, obj, other_root));
+        DAT_TEST(dat_obj_write_u32(&patch, 0x44, 0xCAFEF00D));
+        DAT_TEST(dat_file_sync(&patch, &exported));
+        EXPECT(exported);
+        DAT_TEST(dat_obj_write_u32(&patch, 0x48, 0x12345678));
+        DAT_TEST(dat_file_sync(&patch, &exported));
+        EXPECT(exported);
+        
+        DatFile reread;
+        DAT_TEST(dat_file_import_mapped(path, 0, &reread));
+        EXPECT(reread.data_size == obj + 16);
+        EXPECT(reread.reloc_count == plain.reloc_count + 1);
+        DatRef ref;
+        DAT_TEST(dat_obj_read_ref(&reread, obj, &ref));
+        EXPECT(ref == other_root);
+        uint32_t n;
+        DAT_TEST(dat_obj_read_u32(&reread, 0x40, &n));
+        EXPECT(n == 0xDEADBEEF);
+        DAT_TEST(dat_obj_read_u32(&reread, 0x44, &n));
+        EXPECT(n == 0xCAFEF00D);
+        DAT_TEST(dat_obj_read_u32(&reread, 0x48, &n));
+        EXPECT(n == 0x12345678);
+        DAT_TEST(dat_file_destroy(&reread));
+        DAT_TEST(dat_file_destroy(&patch));
+        
+        // compacting never moves data in the file before the export
+        uint8_t *before;
+        uint64_t before_size;
+        EXPECT(!read_file(path, &before, &before_size));
+        DAT_TEST(dat_file_open_patch(path, 0, &patch));
+        DAT_TEST(dat_obj_remove_ref(&patch, obj));
+        DAT_TEST(dat_root_remove(&patch, 0));
+        uint32_t freed;
+        DAT_TEST(dat_file_compact(&patch, &freed));
+        EXPECT(freed != 0);
+        EXPECT(!read_file(path, &written, &written_size));
+        EXPECT(written_size == before_size);
+        EXPECT(memcmp(written, before, before_size) == 0);
+        free(written);
+        free(before);
+        DAT_TEST(dat_file_sync(&patch, &exported));
+        EXPECT(exported);
+        DAT_TEST(dat_file_destroy(&patch));
+        
+        // new references in the original data don't reach the file before the export
+        for (int edit = 0; edit < 2; ++edit) {
+            EXPECT(!read_file(path, &before, &before_size));
+            DAT_TEST(dat_file_open_patch(path, 0, &patch));
+            DatRef slot = 0;
+            while (dat_file_reloc_idx(&patch, slot) < patch.reloc_count
+                && patch.reloc_targets[dat_file_reloc_idx(&patch, slot)] == slot)
+                slot += 4;
+            if (edit) DAT_TEST(dat_file_begin_edit(&patch));
+            EXPECT(slot + 4 <= patch.data_size);
+            DatRef target = patch.root_info[0].data_offset;
+            EXPECT(READ_U32(&patch.data[slot]) != target);
+            DAT_TEST(dat_obj_set_ref(&patch, slot, target));
+            EXPECT(!read_file(path, &written, &written_size));
+            EXPECT(written_size == before_size);
+            EXPECT(memcmp(written, before, before_size) == 0);
+            free(written);
+            DAT_TEST(dat_obj_remove_ref(&patch, slot));
+            EXPECT(!read_file(path, &written, &written_size));
+            EXPECT(memcmp(written, before, before_size) == 0);
+            free(written);
+            free(before);
+            DAT_TEST(dat_obj_set_ref(&patch, slot, target));
+            DAT_TEST(dat_file_sync(&patch, &exported));
+            EXPECT(exported);
+            DAT_TEST(dat_file_destroy(&patch));
+            
+            DAT_TEST(dat_file_import_mapped(path, 0, &reread));
+            DAT_TEST(dat_obj_read_ref(&reread, slot, &ref));
+            EXPECT(ref == target);
+            DAT_TEST(dat_file_destroy(&reread));
+        }
+        
+        remove(path);
+        DAT_TEST(dat_file_destroy(&plain));
+        free(grps_buf);
+    }
+    
+    {
+        test_name = "object table";
+        
+        uint8_t *grps_buf;
+        uint64_t grps_size;
+        EXPECT(!read_file("GrPs.dat", &grps_buf, &grps_size));
+        DatFile grps;
+        DAT_TEST(dat_file_import(grps_buf, (uint32_t)grps_size, &grps));
+        DAT_TEST(dat_file_find_objects(&grps));
+        EXPECT(object_table_ok(&grps));
+        
+        DatSlice location;
+        uint32_t object_idx;
+        DatRef inner = grps.objects[10].offset + grps.objects[10].size - 1;
+        DAT_TEST(dat_obj_location(&grps, inner, &location));
+        DAT_TEST(dat_obj_index(&grps, inner, &object_idx));
+        EXPECT(object_idx == 10);
+        EXPECT(location.offset == grps.objects[10].offset);
+        EXPECT(location.size == grps.objects[10].size);
+        
+        // flat mode keeps the table up to date
+        DatRef obj;
+        DAT_TEST(dat_obj_alloc(&grps, 10, &obj));
+        EXPECT(object_table_ok(&grps));
+        DAT_TEST(dat_obj_set_ref(&grps, obj + 4, grps.objects[3].offset));
+        DAT_TEST(dat_obj_set_ref(&grps, grps.objects[5].offset, obj));
+        EXPECT(object_table_ok(&grps));
+        DAT_TEST(dat_obj_remove_ref(&grps, grps.objects[5].offset));
+        EXPECT(object_table_ok(&grps));
+        
+        // builder and edit mode rebuild it when finalized
+        DAT_TEST(dat_file_begin_edit(&grps));
+        DAT_TEST(dat_obj_alloc(&grps, 8, &obj));
+        DAT_TEST(dat_obj_set_ref(&grps, obj, grps.objects[0].offset));
+        DAT_TEST(dat_obj_set_ref(&grps, grps.objects[7].offset, obj));
+        DAT_TEST(dat_file_finalize(&grps));
+        EXPECT(object_table_ok(&grps));
+        DAT_TEST(dat_file_begin_build(&grps));
+        DAT_TEST(dat_obj_alloc(&grps, 8, &obj));
+        DAT_TEST(dat_obj_set_ref(&grps, obj, grps.objects[1].offset));
+        DAT_TEST(dat_obj_set_ref(&grps, grps.objects[2].offset, obj));
+        DAT_TEST(dat_file_finalize(&grps));
+        EXPECT(object_table_ok(&grps));
+        
+        DatFile dst;
+        DAT_TEST(dat_file_new(&dst));
+        DatRef dst_ref;
+        DAT_TEST(dat_obj_copy(&dst, &grps, grps.root_info[0].data_offset, &dst_ref));
+        EXPECT(object_table_ok(&dst));
+        DatRef src_refs[2] = { grps.root_info[1].data_offset, grps.root_info[2].data_offset };
+        DatRef dst_refs[2];
+        DAT_TEST(dat_obj_copy_many(&dst, &grps, src_refs, 2, 2, dst_refs));
+        EXPECT(object_table_ok(&dst));
+        DAT_TEST(dat_file_destroy(&dst));
+        
+        DAT_TEST(dat_file_compact(&grps, NULL));
+        EXPECT(object_table_ok(&grps));
+        DAT_TEST(dat_file_dedup(&grps, NULL));
+        EXPECT(object_table_ok(&grps));
+        
+        DAT_TEST(dat_file_destroy(&grps));
+        free(grps_buf);
+    }
+    
+    {
+        test_name = "incoming references";
+        
+        uint8_t *grps_buf;
+        uint64_t grps_size;
+        EXPECT(!read_file("GrPs.dat", &grps_buf, &grps_size));
+        DatFile grps;
+        DAT_TEST(dat_file_import(grps_buf, (uint32_t)grps_size, &grps));
+        
+        const DatRef *incoming;
+        uint32_t count;
+        DatRef root = grps.root_info[0].data_offset;
+        DAT_TEST(dat_obj_incoming(&grps, root, &incoming, &count));
+        EXPECT(grps.incoming_index != NULL);
+        EXPECT(incoming_ok(&grps));
+        
+        // flat mode updates it in place
+        DatRef obj;
+        DAT_TEST(dat_obj_alloc(&grps, 16, &obj));
+        DAT_TEST(dat_obj_incoming(&grps, obj, &incoming, &count));
+        EXPECT(count == 0);
+        DatRef slot = grps.reloc_targets[100];
+        DAT_TEST(dat_obj_set_ref(&grps, slot, obj + 4));
+        DAT_TEST(dat_obj_set_ref(&grps, obj + 8, obj));
+        DAT_TEST(dat_obj_set_ref(&grps, obj, root));
+        DAT_TEST(dat_obj_incoming(&grps, obj + 12, &incoming, &count));
+        EXPECT(count == 2);
+        EXPECT(incoming[0] == slot);
+        EXPECT(incoming[1] == obj + 8);
+        DAT_TEST(dat_obj_remove_ref(&grps, obj + 8));
+        DAT_TEST(dat_obj_incoming(&grps, obj, &incoming, &count));
+        EXPECT(count == 1);
+        EXPECT(grps.incoming_index != NULL);
+        EXPECT(incoming_ok(&grps));
+        
+        // and so does edit mode
+        DAT_TEST(dat_file_begin_edit(&grps));
+        DAT_TEST(dat_obj_set_ref(&grps, obj + 8, obj));
+        DAT_TEST(dat_obj_set_ref(&grps, slot, root));
+        DAT_TEST(dat_obj_remove_ref(&grps, obj));
+        EXPECT(grps.incoming_index != NULL);
+        EXPECT(incoming_ok(&grps));
+        DAT_TEST(dat_obj_incoming(&grps, obj, &incoming, &count));
+        EXPECT(count == 1);
+        EXPECT(incoming[0] == obj + 8);
+        
+        // writing over a reference drops it, other writes don't
+        DAT_TEST(dat_obj_write_u32(&grps, obj + 12, 0));
+        EXPECT(grps.incoming_index != NULL);
+        DAT_TEST(dat_obj_write_u32(&grps, obj + 8, root));
+        EXPECT(grps.incoming_index == NULL);
+        EXPECT(incoming_ok(&grps));
+        
+        DAT_TEST(dat_file_finalize(&grps));
+        DAT_TEST(dat_file_compact(&grps, NULL));
+        EXPECT(grps.incoming_index == NULL);
+        EXPECT(incoming_ok(&grps));
+        
+        DAT_TEST(dat_file_destroy(&grps));
+        free(grps_buf);
+    }
+    
+    {
+        test_name = "generated file";
+        
+        GenParams params = gen_default_params;
+        params.object_count = 5000;
+        params.root_count = 7;
+        params.sizes = Gen_SizesUniform;
+        params.share = 0.5f;
+        params.cycles = 0.1f;
+        
+        DatFile a, b;
+        GenStats stats;
+        DAT_TEST(gen_file(&params, &a, &stats));
+        DAT_TEST(gen_file(&params, &b, &stats));
+        EXPECT(a.data_size == b.data_size);
+        EXPECT(a.reloc_count == b.reloc_count);
+        EXPECT(a.reloc_count == stats.ref_count);
+        EXPECT(memcmp(a.data, b.data, a.data_size) == 0);
+        DAT_TEST(dat_file_destroy(&b));
+        params.seed++;
+        DAT_TEST(gen_file(&params, &b, &stats));
+        EXPECT(a.data_size != b.data_size || memcmp(a.data, b.data, a.data_size) != 0);
+        DAT_TEST(dat_file_destroy(&b));
+        
+        // valid, and every object is reachable from a root
+        EXPECT(a.root_count == 7);
+        DAT_TEST(dat_file_validate(&a));
+        DAT_TEST(dat_file_find_objects(&a));
+        EXPECT(a.object_count == params.object_count);
+        DAT_TEST(dat_file_compact(&a, NULL));
+        EXPECT(a.object_count == params.object_count);
+        
+        params.min_size = 6;
+        EXPECT(gen_file(&params, &b, &stats) == DAT_ERR_INVALID_ALIGNMENT);
+        DAT_TEST(dat_file_destroy(&a));
+    }
+    
+    {
+        test_name = "reloc bitmap";
+        
+        uint8_t *grps_buf;
+        uint64_t grps_size;
+        EXPECT(!read_file("GrPs.dat", &grps_buf, &grps_size));
+        DatFile grps;
+        DAT_TEST(dat_file_import_flags(grps_buf, (uint32_t)grps_size, DAT_IMPORT_RELOC_BITMAP, &grps));
+        EXPECT(grps.reloc_bitmap != NULL);
+        EXPECT(reloc_bitmap_ok(&grps));
+        
+        EXPECT(dat_reloc_next(&grps, grps.data_size) == UINT32_MAX);
+        EXPECT(dat_reloc_rank(&grps, grps.data_size) == grps.reloc_count);
+        for (uint32_t i = 0; i < grps.reloc_count; ++i) {
+            DatRef slot = grps.reloc_targets[i];
+            EXPECT(dat_reloc_select(&grps, i) == slot);
+            EXPECT(dat_reloc_rank(&grps, slot + 1) == i + 1);
+            EXPECT(dat_reloc_next(&grps, slot + 1) == (i + 1 < grps.reloc_count ? grps.reloc_targets[i+1] : UINT32_MAX));
+        }
+        
+        // flat mode updates it in place
+        DatRef obj;
+        DAT_TEST(dat_obj_alloc(&grps, 4000, &obj));
+        DAT_TEST(dat_obj_set_ref(&grps, obj + 3996, obj));
+        DAT_TEST(dat_obj_set_ref(&grps, obj, obj + 8));
+        DAT_TEST(dat_obj_remove_ref(&grps, grps.reloc_targets[50]));
+        EXPECT(dat_reloc_is_slot(&grps, obj + 3996));
+        EXPECT(dat_reloc_next(&grps, obj + 4) == obj + 3996);
+        EXPECT(grps.reloc_bitmap->rank_dirty != RELOC_RANKS_CLEAN);
+        EXPECT(dat_reloc_rank(&grps, obj + 3996) == grps.reloc_count - 1);
+        EXPECT(dat_reloc_select(&grps, grps.reloc_count - 1) == obj + 3996);
+        EXPECT(grps.reloc_bitmap->rank_dirty == RELOC_RANKS_CLEAN);
+        EXPECT(reloc_bitmap_ok(&grps));
+        
+        // and so do edit and builder mode
+        DAT_TEST(dat_file_begin_edit(&grps));
+        DAT_TEST(dat_obj_set_ref(&grps, obj + 8, obj));
+        DAT_TEST(dat_obj_remove_ref(&grps, obj));
+        DAT_TEST(dat_file_finalize(&grps));
+        EXPECT(grps.reloc_bitmap != NULL);
+        EXPECT(reloc_bitmap_ok(&grps));
+        
+        DAT_TEST(dat_file_begin_build(&grps));
+        DAT_TEST(dat_obj_set_ref(&grps, obj + 12, obj));
+        DAT_TEST(dat_obj_set_ref(&grps, obj + 12, obj + 4));
+        EXPECT(dat_reloc_is_slot(&grps, obj + 12));
+        DAT_TEST(dat_file_finalize(&grps));
+        EXPECT(grps.reloc_bitmap != NULL);
+        EXPECT(reloc_bitmap_ok(&grps));
+        
+        // compacting drops it, building again matches
+        DAT_TEST(dat_file_compact(&grps, NULL));
+        EXPECT(grps.reloc_bitmap == NULL);
+        DAT_TEST(dat_file_build_reloc_bitmap(&grps));
+        EXPECT(reloc_bitmap_ok(&grps));
+        
+        DAT_TEST(dat_file_destroy(&grps));
+        free(grps_buf);
+    }
+    
+    {
+        test_name = "graph walk";
+        
+        DatFile graph;
+        DAT_TEST(dat_file_new(&graph));
+        DatRef a, b, c, d, e;
+        DAT_TEST(dat_obj_alloc(&graph, 16, &a));
+        DAT_TEST(dat_obj_alloc(&graph, 8, &b));
+        DAT_TEST(dat_obj_alloc(&graph, 8, &c));
+        DAT_TEST(dat_obj_alloc(&graph, 8, &d));
+        DAT_TEST(dat_obj_alloc(&graph, 8, &e));
+        memset(graph.data, 0, graph.data_size);
+        DAT_TEST(dat_obj_set_ref(&graph, a + 0, b));
+        DAT_TEST(dat_obj_set_ref(&graph, a + 4, c));
+        DAT_TEST(dat_obj_set_ref(&graph, b + 0, d));
+        DAT_TEST(dat_obj_set_ref(&graph, c + 0, a));
+        DAT_TEST(dat_obj_set_ref(&graph, c + 4, d + 4));
+        DAT_TEST(dat_obj_set_ref(&graph, e + 0, a));
+        DAT_TEST(dat_root_add(&graph, 0, a, "a"));
+        
+        uint32_t visited_size, stack_count;
+        DAT_TEST(dat_graph_buffer_sizes(&graph, &visited_size, &stack_count));
+        EXPECT(visited_size == 1);
+        EXPECT(stack_count == 5);
+        uint8_t visited[1];
+        uint32_t stack[5];
+        
+        DatGraphIter it;
+        DatSlice object;
+        DatRef order[5];
+        uint32_t order_count = 0;
+        DAT_TEST(dat_graph_begin(&it, &graph, NULL, 0, 0, visited, stack));
+        while (dat_graph_next(&it, &object)) {
+            EXPECT(object.offset == graph.objects[it.object_idx].offset);
+            order[order_count++] = object.offset;
+        }
+        EXPECT(order_count == 4);
+        EXPECT(order[0] == a && order[1] == c && order[2] == d && order[3] == b);
+        
+        order_count = 0;
+        DAT_TEST(dat_graph_begin(&it, &graph, NULL, 0, DAT_GRAPH_BFS, visited, stack));
+        while (dat_graph_next(&it, &object))
+            order[order_count++] = object.offset;
+        EXPECT(order_count == 4);
+        EXPECT(order[0] == a && order[1] == b && order[2] == c && order[3] == d);
+        
+        // starts past the data are not clamped to the last object
+        DatRef past_end = graph.data_size;
+        EXPECT(dat_graph_begin(&it, &graph, &past_end, 1, 0, visited, stack) == DAT_ERR_OUT_OF_BOUNDS);
+        
+        // edges, including ones to visited objects
+        DAT_TEST(dat_graph_begin(&it, &graph, &c, 1, 0, visited, stack));
+        EXPECT(dat_graph_next(&it, &object));
+        EXPECT(object.offset == c);
+        DatRef from, to;
+        EXPECT(dat_graph_next_edge(&it, &from, &to));
+        EXPECT(from == c && to == a);
+        EXPECT(dat_graph_next_edge(&it, &from, &to));
+        EXPECT(from == c + 4 && to == d + 4);
+        EXPECT(!dat_graph_next_edge(&it, &from, &to));
+        EXPECT(dat_graph_next(&it, &object));
+        EXPECT(object.offset == d);
+        EXPECT(!dat_graph_next_edge(&it, NULL, NULL));
+        EXPECT(dat_graph_next(&it, &object));
+        EXPECT(object.offset == a);
+        
+        // a second walk can skip what the first one found
+        DAT_TEST(dat_graph_begin(&it, &graph, &a, 1, 0, visited, stack));
+        while (dat_graph_next(&it, NULL));
+        DAT_TEST(dat_graph_begin(&it, &graph, &e, 1, DAT_GRAPH_KEEP_VISITED, visited, stack));
+        EXPECT(dat_graph_next(&it, &object));
+        EXPECT(object.offset == e);
+        EXPECT(!dat_graph_next(&it, &object));
+        
+        DAT_TEST(dat_file_begin_edit(&graph));
+        order_count = 0;
+        DAT_TEST(dat_graph_begin(&it, &graph, &e, 1, 0, visited, stack));
+        while (dat_graph_next(&it, &object))
+            order[order_count++] = object.offset;
+        EXPECT(order_count == 5);
+        EXPECT(order[0] == e && order[1] == a && order[2] == c && order[3] == d && order[4] == b);
+        DAT_TEST(dat_file_destroy(&graph));
+        
+        // every reference out of a visited object is an edge
+        uint8_t *grps_buf;
+        uint64_t grps_size;
+        EXPECT(!read_file("GrPs.dat", &grps_buf, &grps_size));
+        DatFile grps;
+        DAT_TEST(dat_file_import(grps_buf, (uint32_t)grps_size, &grps));
+        DAT_TEST(dat_graph_buffer_sizes(&grps, &visited_size, &stack_count));
+        uint8_t *grps_visited = malloc(visited_size);
+        uint32_t *grps_stack = malloc(stack_count * sizeof(uint32_t));
+        uint32_t object_count = 0;
+        uint32_t edge_count = 0;
+        uint32_t reloc_count = 0;
+        DAT_TEST(dat_graph_begin(&it, &grps, NULL, 0, DAT_GRAPH_BFS, grps_visited, grps_stack));
+        while (dat_graph_next(&it, &object)) {
+            object_count++;
+            while (dat_graph_next_edge(&it, &from, &to)) {
+                EXPECT(from >= object.offset && from < object.offset + object.size);
+                EXPECT(to == READ_U32(&grps.data[from]));
+                edge_count++;
+            }
+            uint32_t end = it.object_idx + 1 < grps.object_count ? grps.object_relocs[it.object_idx + 1] : grps.reloc_count;
+            reloc_count += end - grps.object_relocs[it.object_idx];
+        }
+        EXPECT(edge_count == reloc_count);
+        DAT_TEST(dat_file_compact(&grps, NULL));
+        EXPECT(object_count == grps.object_count);
+        free(grps_visited);
+        free(grps_stack);
+        DAT_TEST(dat_file_destroy(&grps));
+        free(grps_buf);
+    }
+    
+    {
+        test_name = "validate";
+        
+        uint8_t *grps_buf;
+        uint64_t grps_size;
+        EXPECT(!read_file("GrPs.dat", &grps_buf, &grps_size));
+        
+        DatFile checked;
+        DAT_TEST(dat_file_import_flags(grps_buf, (uint32_t)grps_size, DAT_IMPORT_VALIDATE, &checked));
+        EXPECT(checked.flags & DAT_FILE_VALIDATED);
+        
+        // writing non-references keeps the file valid
+        DatRef reloc = checked.reloc_targets[0];
+        DatRef plain = 0;
+        while (dat_file_reloc_idx(&checked, plain) < checked.reloc_count
+            && checked.reloc_targets[dat_file_reloc_idx(&checked, plain)] == plain) plain += 4;
+        DAT_TEST(dat_obj_write_u32(&checked, plain, 0xFFFFFFF0));
+        EXPECT(checked.flags & DAT_FILE_VALIDATED);
+        DatRef target = dat_obj_read_ref_unchecked(&checked, reloc);
+        DAT_TEST(dat_obj_write_u32(&checked, reloc, target));
+        EXPECT(checked.flags & DAT_FILE_VALIDATED);
+        
+        // but an out of bounds reference breaks it
+        DAT_TEST(dat_obj_write_u32(&checked, reloc, 0xFFFFFFF0));
+        EXPECT(!(checked.flags & DAT_FILE_VALIDATED));
+        EXPECT(dat_file_validate(&checked) == DAT_ERR_OUT_OF_BOUNDS);
+        dat_obj_write_u32_unchecked(&checked, reloc, target);
+        DAT_TEST(dat_file_validate(&checked));
+        EXPECT(checked.flags & DAT_FILE_VALIDATED);
+        
+        checked.reloc_targets[0] = reloc + 1;
+        EXPECT(dat_file_validate(&checked) == DAT_ERR_INVALID_ALIGNMENT);
+        EXPECT(!(checked.flags & DAT_FILE_VALIDATED));
+        checked.reloc_targets[0] = reloc;
+        
+        checked.root_info[0].data_offset += checked.data_size;
+        EXPECT(dat_file_validate(&checked) == DAT_ERR_OUT_OF_BOUNDS);
+        checked.root_info[0].data_offset -= checked.data_size;
+        
+        checked.symbols[checked.symbol_size-1] = 'x';
+        EXPECT(dat_file_validate(&checked) == DAT_ERR_OUT_OF_BOUNDS);
+        checked.symbols[checked.symbol_size-1] = 0;
+        
+        // edit mode checks every block
+        DAT_TEST(dat_file_begin_edit(&checked));
+        DAT_TEST(dat_file_validate(&checked));
+        DAT_TEST(dat_obj_write_u32(&checked, plain, 0));
+        EXPECT(checked.flags & DAT_FILE_VALIDATED);
+        DAT_TEST(dat_obj_write_u32(&checked, reloc, checked.data_size));
+        EXPECT(!(checked.flags & DAT_FILE_VALIDATED));
+        DAT_TEST(dat_file_destroy(&checked));
+        
+        // rejected during import
+        uint32_t data_size = READ_U32(grps_buf + 4);
+        WRITE_U32(grps_buf + 0x20 + reloc, data_size);
+        EXPECT(dat_file_import_flags(grps_buf, (uint32_t)grps_size, DAT_IMPORT_VALIDATE, &checked) == DAT_ERR_OUT_OF_BOUNDS);
+        DAT_TEST(dat_file_import(grps_buf, (uint32_t)grps_size, &checked));
+        EXPECT(!(checked.flags & DAT_FILE_VALIDATED));
+        DAT_TEST(dat_file_destroy(&checked));
+        
+        free(grps_buf);
+    }
+    
+    {
+        test_name = "malformed headers";
+        
+        // tables past the end of the file are rejected without leaking the copy
+        uint32_t bad_words[0x10] = {0};
+        uint8_t *bad = (uint8_t*)bad_words;
+        WRITE_U32(bad + 0, sizeof(bad_words));
+        WRITE_U32(bad + 4, 0x10);
+        WRITE_U32(bad + 8, 0x1000);
+        DatFile rejected;
+        EXPECT(dat_file_import(bad, sizeof(bad_words), &rejected) == DAT_ERR_INVALID_SIZE);
+        EXPECT(rejected.mapping == NULL);
+        
+        CountingAllocator counter = {0};
+        DatAllocator counting = { counting_alloc, counting_realloc, counting_free, &counter };
+        EXPECT(dat_file_import_with_allocator(bad, sizeof(bad_words), 0, &counting, &rejected) == DAT_ERR_INVALID_SIZE);
+        EXPECT(counter.allocs == 1);
+        EXPECT(counter.live_bytes == 0);
+        
+        // and the mapping when importing from a path
+        const char *path = "build/test_malformed.dat";
+        FILE *f = fopen(path, "wb");
+        EXPECT(f != NULL);
+        EXPECT(fwrite(bad, sizeof(bad_words), 1, f) == 1);
+        fclose(f);
+        EXPECT(dat_file_import_mapped(path, 0, &rejected) == DAT_ERR_INVALID_SIZE);
+        EXPECT(rejected.mapping == NULL);
+        remove(path);
+        
+        // so is a file size past the end of the buffer
+        WRITE_U32(bad + 0, sizeof(bad_words) * 2);
+        EXPECT(dat_file_import(bad, sizeof(bad_words), &rejected) == DAT_ERR_INVALID_SIZE);
+        
+        // reference slots past the data fail the reloc bitmap
+        memset(bad_words, 0, sizeof(bad_words));
+        WRITE_U32(bad + 0, 0x34);
+        WRITE_U32(bad + 4, 0x10);
+        WRITE_U32(bad + 8, 1);
+        WRITE_U32(bad + 0x30, 0x100000);
+        EXPECT(dat_file_import_flags(bad, sizeof(bad_words), DAT_IMPORT_RELOC_BITMAP, &rejected) == DAT_ERR_OUT_OF_BOUNDS);
+        EXPECT(rejected.mapping == NULL);
+        DAT_TEST(dat_file_import(bad, sizeof(bad_words), &rejected));
+        EXPECT(dat_file_build_reloc_bitmap(&rejected) == DAT_ERR_OUT_OF_BOUNDS);
+        EXPECT(rejected.reloc_bitmap == NULL);
+        DAT_TEST(dat_file_destroy(&rejected));
+        
+        // empty unaligned tables need no allocation
+        memset(bad_words, 0, sizeof(bad_words));
+        WRITE_U32(bad + 0, 0x32);
+        WRITE_U32(bad + 4, 0x12);
+        counter = (CountingAllocator) {0};
+        DatAllocator nonzero = { nonzero_alloc, counting_realloc, counting_free, &counter };
+        DatFile empty;
+        DAT_TEST(dat_file_import_with_allocator(bad, sizeof(bad_words), 0, &nonzero, &empty));
+        EXPECT(empty.reloc_count == 0 && empty.root_count == 0 && empty.extern_count == 0);
+        EXPECT(counter.allocs == 1);
+        DAT_TEST(dat_file_destroy(&empty));
+        EXPECT(counter.live_bytes == 0);
+    }
+    
+    {
+        test_name = "export to path";
+        
+        // enough relocs to go through the staging buffer more than once
+        DatFile big;
+        DAT_TEST(dat_file_new(&big));
+        DatRef table;
+        DAT_TEST(dat_obj_alloc(&big, 4 * 20000, &table));
+        for (uint32_t i = 0; i < 20000; ++i)
+            DAT_TEST(dat_obj_set_ref(&big, table + i*4, table));
+        DAT_TEST(dat_root_add(&big, 0, table, "table"));
+        
+        uint32_t max_size = dat_file_export_max_size(&big);
+        uint8_t *expected = malloc(max_size);
+        uint32_t expected_size;
+        DAT_TEST(dat_file_export(&big, expected, &expected_size));
+        
+        const char *path = "build/test_export.dat";
+        DAT_TEST(dat_file_export_path(&big, path));
+        uint8_t *written;
+        uint64_t written_size;
+        EXPECT(!read_file(path, &written, &written_size));
+        EXPECT(written_size == expected_size);
+        EXPECT(memcmp(written, expected, expected_size) == 0);
+        free(written);
+        
+        // export a mapped file over itself
+        DatFile mapped;
+        DAT_TEST(dat_file_import_mapped(path, 0, &mapped));
+        DatRef obj;
+        DAT_TEST(dat_obj_alloc(&mapped, 8, &obj));
+        DAT_TEST(dat_obj_set_ref(&mapped, obj, table));
+        DAT_TEST(dat_file_export_path(&mapped, path));
+        DAT_TEST(dat_file_destroy(&mapped));
+        
+        DAT_TEST(dat_file_import_mapped(path, 0, &mapped));
+        EXPECT(mapped.reloc_count == 20001);
+        EXPECT(memcmp(mapped.data, big.data, big.data_size) == 0);
+        DAT_TEST(dat_file_destroy(&mapped));
+        
+        remove(path);
+        free(expected);
+        DAT_TEST(dat_file_destroy(&big));
+    }
+    
+    #ifdef DAT_STATS
+    {
+        test_name = "stats";
+        
+        DatFile st;
+        DAT_TEST(dat_file_new(&st));
+        DatRef a, b, c;
+        DAT_TEST(dat_obj_alloc(&st, 64, &a));
+        DAT_TEST(dat_obj_alloc(&st, 64, &b));
+        DAT_TEST(dat_obj_alloc(&st, 64, &c));
+        EXPECT(st.stats.calls[DatStat_ObjAlloc] == 3);
+        EXPECT(st.stats.grow_count > 0);
+        
+        // inserting before existing references moves them
+        DAT_TEST(dat_obj_set_ref(&st, a + 8, b));
+        DAT_TEST(dat_obj_set_ref(&st, a + 12, c));
+        EXPECT(st.stats.moved_bytes == 0);
+        DAT_TEST(dat_obj_set_ref(&st, a + 4, c));
+        EXPECT(st.stats.moved_bytes == 2 * sizeof(DatRef));
+        DAT_TEST(dat_obj_remove_ref(&st, a + 4));
+        EXPECT(st.stats.moved_bytes == 4 * sizeof(DatRef));
+        EXPECT(st.stats.calls[DatStat_SetRef] == 3);
+        EXPECT(st.stats.calls[DatStat_RemoveRef] == 1);
+        
+        // every timed call lands in one latency bucket
+        uint64_t bucketed = 0;
+        for (uint32_t i = 0; i < DAT_STAT_BUCKETS; ++i)
+            bucketed += st.stats.latency[DatStat_SetRef][i];
+        EXPECT(bucketed == 3);
+        
+        uint32_t word;
+        DAT_TEST(dat_obj_write_u32(&st, b, 7));
+        DAT_TEST(dat_obj_read_u32(&st, b, &word));
+        EXPECT(st.stats.calls[DatStat_Read] == 1);
+        EXPECT(st.stats.calls[DatStat_Write] == 1);
+        
+        // 3 objects take 2 probes
+        uint64_t searches = st.stats.search_count;
+        uint64_t two_probes = st.stats.search_depth[2];
+        uint32_t idx;
+        DAT_TEST(dat_obj_index(&st, b + 4, &idx));
+        EXPECT(st.stats.search_count == searches + 1);
+        EXPECT(st.stats.search_depth[2] == two_probes + 1);
+        
+        DAT_TEST(dat_root_add(&st, 0, a, "a"));
+        DatRef found;
+        EXPECT(dat_root_find(&st, "missing", &found) == DAT_NOT_FOUND);
+        EXPECT(st.stats.name_misses == 1);
+        
+        // edit mode inserts only move the rest of one block
+        DAT_TEST(dat_file_begin_edit(&st));
+        uint64_t moved = st.stats.moved_bytes;
+        DAT_TEST(dat_obj_set_ref(&st, a + 4, c));
+        EXPECT(st.stats.moved_bytes == moved + 2 * sizeof(DatRef));
+        DAT_TEST(dat_file_finalize(&st));
+        EXPECT(st.stats.calls[DatStat_BeginEdit] == 1);
+        EXPECT(st.stats.calls[DatStat_Finalize] >= 1);
+        
+        dat_file_reset_stats(&st);
+        EXPECT(st.stats.calls[DatStat_SetRef] == 0);
+        EXPECT(st.stats.moved_bytes == 0);
+        
+        // importing starts from zero
+        uint32_t max_size = dat_file_export_max_size(&st);
+        uint8_t *buf = malloc(max_size);
+        uint32_t size;
+        DAT_TEST(dat_file_export(&st, buf, &size));
+        EXPECT(st.stats.calls[DatStat_Export] == 1);
+        DatFile imported;
+        DAT_TEST(dat_file_import(buf, size, &imported));
+        EXPECT(imported.stats.calls[DatStat_Import] == 1);
+        EXPECT(imported.stats.calls[DatStat_Export] == 0);
+        DAT_TEST(dat_file_destroy(&imported));
+        free(buf);
+        
+        DAT_TEST(dat_file_destroy(&st));
+    }
+    #endif
+    
     DAT_TEST(dat_file_destroy(&dat));
 }
+
+static int test_cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+void test_sort(void) {
+    const char *test_name = "";
+    uint32_t count = 5000;
+    uint32_t *arr = malloc(count * sizeof(uint32_t));
+    uint32_t *expected = malloc(count * sizeof(uint32_t));
+    uint8_t *tmp = malloc(count * sizeof(uint64_t));
+    uint32_t seed = 12345;
+    
+    {
+        test_name = "radix sort u32";
+        for (uint32_t i = 0; i < count; ++i) {
+            seed = seed * 1103515245 + 12345;
+            arr[i] = expected[i] = (seed >> 4) & 0x3FFFC;
+        }
+        qsort(expected, count, sizeof(uint32_t), test_cmp_u32);
+        EXPECT(sort_by_key((uint8_t*)arr, tmp, count, sizeof(uint32_t), false) == count);
+        EXPECT(memcmp(arr, expected, count * sizeof(uint32_t)) == 0);
+    }
+    
+    {
+        test_name = "radix sort dedup";
+        for (uint32_t i = 0; i < count; ++i) {
+            seed = seed * 1103515245 + 12345;
+            arr[i] = expected[i] = ((seed >> 8) & 0x3FF) << 20;
+        }
+        qsort(expected, count, sizeof(uint32_t), test_cmp_u32);
+        uint32_t expected_count = dedup_sorted_u32(expected, count);
+        EXPECT(sort_by_key((uint8_t*)arr, tmp, count, sizeof(uint32_t), true) == expected_count);
+        EXPECT(memcmp(arr, expected, expected_count * sizeof(uint32_t)) == 0);
+        
+        // sorted input, small input and equal keys
+        EXPECT(sort_by_key((uint8_t*)arr, tmp, expected_count, sizeof(uint32_t), true) == expected_count);
+        uint32_t small[5] = { 8, 4, 8, 0, 4 };
+        EXPECT(sort_by_key((uint8_t*)small, NULL, 5, sizeof(uint32_t), true) == 3);
+        EXPECT(small[0] == 0 && small[1] == 4 && small[2] == 8);
+        for (uint32_t i = 0; i < 100; ++i) arr[i] = 40;
+        EXPECT(sort_by_key((uint8_t*)arr, tmp, 100, sizeof(uint32_t), true) == 1);
+    }
+    
+    {
+        test_name = "radix sort roots is stable";
+        DatRootInfo *roots = malloc(count * sizeof(DatRootInfo));
+        for (uint32_t i = 0; i < count; ++i) {
+            seed = seed * 1103515245 + 12345;
+            roots[i] = (DatRootInfo) { (seed >> 8) & 0xFFF, i };
+        }
+        sort_by_key((uint8_t*)roots, tmp, count, sizeof(DatRootInfo), false);
+        for (uint32_t i = 1; i < count; ++i) {
+            DatRootInfo a = roots[i-1];
+            DatRootInfo b = roots[i];
+            EXPECT(a.data_offset < b.data_offset || (a.data_offset == b.data_offset && a.symbol_offset < b.symbol_offset));
+        }
+        free(roots);
+    }
+    
+    free(tmp);
+    free(expected);
+    free(arr);
+}
+
+void test_bswap(void) {
+    const char *test_name = "";
+    uint8_t src[4*67 + 1];
+    uint8_t dst[4*67 + 1];
+    for (uint32_t i = 0; i < sizeof(src); ++i)
+        src[i] = (uint8_t)(i * 7 + 3);
+    
+    {
+        test_name = "byte swap arrays";
+        
+        // every length around the vector widths, unaligned
+        for (uint32_t count = 0; count <= 67; ++count) {
+            memset(dst, 0, sizeof(dst));
+            dat_be32u_array(dst + 1, src + 1, count);
+            for (uint32_t i = 0; i < count; ++i) {
+                const uint8_t *b = src + 1 + i*4;
+                uint32_t expected = ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+                uint32_t swapped;
+                memcpy(&swapped, dst + 1 + i*4, 4);
+                EXPECT(swapped == expected);
+            }
+            for (uint32_t i = count*4 + 1; i < sizeof(dst); ++i)
+                EXPECT(dst[i] == 0);
+        }
+        
+        #ifdef DAT_BSWAP_X86
+            // kernels the cpu dispatch did not pick
+            uint8_t expected[sizeof(dst)];
+            be32u_array_scalar(expected, src + 1, 67);
+            be32u_array_ssse3(dst, src + 1, 67);
+            EXPECT(memcmp(dst, expected, 67*4) == 0);
+            if (__builtin_cpu_supports("avx2")) {
+                be32u_array_avx2(dst, src + 1, 67);
+                EXPECT(memcmp(dst, expected, 67*4) == 0);
+            }
+        #endif
+        
+        // in place is its own inverse
+        memcpy(dst, src, sizeof(src));
+        dat_be32u_array(dst, dst, 67);
+        dat_be32u_array(dst, dst, 67);
+        EXPECT(memcmp(dst, src, sizeof(src)) == 0);
+    }
+    
+    {
+        test_name = "ml array reads";
+        ML_F32 be_floats[3];
+        float floats[3] = { 1.5f, -2.0f, 1234.25f };
+        float read[3];
+        ML_WriteF32Array(be_floats, floats, 3);
+        EXPECT(ML_ReadF32(be_floats[1]) == -2.0f);
+        ML_ReadF32Array(read, be_floats, 3);
+        EXPECT(memcmp(read, floats, sizeof(floats)) == 0);
+    }
+}
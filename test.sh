@@ -4,8 +4,12 @@ WARN_FLAGS="-Wall -Wextra -Wpedantic -Wuninitialized -Wcast-qual -Wdisabled-opti
 BASE_FLAGS="-O1 -ggdb"
 PATH_FLAGS="-I/usr/local/lib -I/usr/local/include"
 SAN_FLAGS="-fsanitize=address -fsanitize=undefined"
-LINK_FLAGS=""
+LINK_FLAGS="-pthread"
 
 export GCC_COLORS="warning=01;33"
 
 /usr/bin/c99 ${WARN_FLAGS} ${PATH_FLAGS} ${BASE_FLAGS} ${SAN_FLAGS} src/tests.c ${LINK_FLAGS} -o build/tests && build/tests
+
+# again with operation counters
+STATS_FLAGS="-DDAT_STATS -D_POSIX_C_SOURCE=200809L"
+/usr/bin/c99 ${WARN_FLAGS} ${PATH_FLAGS} ${BASE_FLAGS} ${SAN_FLAGS} ${STATS_FLAGS} src/tests.c ${LINK_FLAGS} -o build/tests_stats && build/tests_stats